@@ -24,7 +24,6 @@
 class Object {
     public:
         size_t Heap;
-        uint8_t Type;
 
         bool operator==(const Object& other) { return other.Heap == this->Heap; }
 };
@@ -95,6 +94,12 @@ class EXPORT VM {
          */
         static std::vector<Variable> GetParameters();
 
+        /**
+         * Get the object that the native method was called on.
+         * Static methods don't have one, so they get a null Object.
+         */
+        static Object GetInstance();
+
         /**
          * Retrieve a specific object from the Object Heap by ID.
          * NOTE: This is ridiculously insecure!
@@ -107,4 +112,30 @@ class EXPORT VM {
          * Retrieve the length of a Java array.
          */
         static size_t GetArrayLength(Object ID);
+
+        /**
+         * Retrieve the elements of a primitive Java array.
+         * They are packed at their natural width - a char[] is an array of uint16_t, an int[] of uint32_t, etc.
+         * GetObject on a primitive array only gives the header, so use this instead.
+         */
+        static uint8_t* GetArrayData(Object ID);
+
+        /**
+         * Retrieve the identity hash of an object, as Object.hashCode would return it.
+         * It is stable for as long as the object is alive.
+         */
+        static uint32_t GetIdentityHash(Object ID);
+
+        /**
+         * Read an instance field of an object, by name and descriptor. ie. GetField(String, "value", "[B")
+         * Fields are packed into objects, so this is the only safe way to read them.
+         * Returns a zero Variable if the object's class has no such field.
+         */
+        static Variable GetField(Object ID, const char* Name, const char* Descriptor);
+
+        /**
+         * Intern a String, as String.intern would.
+         * Returns the VM's canonical String with the same contents; this is the same Object that a literal with those contents loads.
+         */
+        static Object Intern(Object String);
 };
@@ -0,0 +1,59 @@
+/**************
+ * GEMWIRE    *
+ *    PURPURI *
+ **************/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "ClassPath.hpp"
+
+class Class;
+class ClassHeap;
+
+/**
+ * The Shared Archive holds classes that have already been parsed and linked, so that later runs can skip straight
+ *  to using them (-Xshare:dump, -Xshare:on).
+ * See Archive.cpp for the format, and how it's kept up to date.
+ */
+class SharedArchive {
+    public:
+        enum Mode {
+            Off,
+            // Write every class the program loaded to the archive, once it finishes.
+            Dump,
+            // Load classes from the archive, if it's still valid.
+            On
+        };
+
+        static Mode Sharing;
+        // Where the archive is, or is written to (-Xshare-archive=<file>).
+        static std::string Path;
+
+        static std::unique_ptr<SharedArchive> Open(const std::string& Filename, const std::string& ClassPath);
+        static bool Write(const std::string& Filename, const std::string& ClassPath, ClassHeap& Heap);
+
+        bool Load(const std::string& Name, Class* Into);
+        bool LoadSource(const std::string& Source, Class* Into);
+        bool Contains(const std::string& Name) { return Classes.find(Name) != Classes.end(); }
+
+    private:
+        struct Header;
+        struct ArchivedClass;
+        struct ArchivedMethod;
+
+        MappedFile File;
+        std::unordered_map<std::string, const ArchivedClass*> Classes;
+        // The classes that were read from loose class files, by the file.
+        std::unordered_map<std::string, const ArchivedClass*> Sources;
+
+        const char* At(uint32_t Offset) const { return File.GetData() + Offset; }
+        std::string GetString(uint32_t Offset) const;
+        std::string_view GetStringView(uint32_t Offset) const;
+        void Restore(const ArchivedClass& From, Class* Into);
+};
@@ -9,16 +9,24 @@
 #include <cstring>
 #include <list>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
 
+#include "Archive.hpp"
+#include "ClassPath.hpp"
 #include "Constants.hpp"
 #include "Fields.hpp"
 #include "Methods.hpp"
+#include "Native.hpp"
 #include "Objects.hpp"
+#include "Symbols.hpp"
 
 class Engine {
     public:
         static ObjectHeap _ObjectHeap;
-        static bool QuietMode;
+        static std::atomic<bool> QuietMode;
         ClassHeap* _ClassHeap;
 
         Engine();
@@ -26,25 +34,33 @@ class Engine {
         virtual uint32_t Ignite(StackFrame* Stack);
 
         void Invoke(StackFrame* Stack, uint16_t Type);
+        void InvokeStaticQuick(StackFrame* Stack);
+        void InvokeFrame(StackFrame* Stack, Class* Owner, uint32_t MethodIndex, size_t Parameters, bool Returns);
 
         void InvokeNative(const NativeContext& Context);
         void HandleNativeReturn(NativeContext Context, Variable Value);
 
         bool MethodClassMatches(uint16_t MethodInd, Class* pClass, const char* TestName);
 
-        void PutStatic(StackFrame* Stack) const;
+        void PutStatic(StackFrame* Stack);
+        void PutStaticQuick(StackFrame* Stack);
         void PutField(StackFrame* Stack);
         void GetStatic(StackFrame* Stack);
+        void GetStaticQuick(StackFrame* Stack);
         void GetField(StackFrame* Stack);
 
         Variable GetConstant(Class* Class, uint8_t Index) const;
 
-        uint16_t GetParameters(const char* Descriptor);
+        bool InitializeClass(Class* pClass, StackFrame* Frame, Variable* Base);
+
+        static uint16_t GetParameters(const char* Descriptor);
         uint16_t GetParametersStack(const char* Descriptor);
 
         int New(StackFrame* Stack);
+        void NewQuick(StackFrame* Stack);
         void NewArray(StackFrame* Stack);
         void ANewArray(StackFrame* Stack);
+        void MultiNewArray(StackFrame* Stack);
 
         Variable CreateObject(Class* Class);
         Variable* CreateArray(uint8_t Type, int32_t Count);
@@ -58,7 +74,8 @@ struct ClassFile {
     uint16_t BytecodeVersionMinor;
 
     uint16_t ConstantCount;
-    struct ConstantPoolEntry** Constants;
+    // Decoded by ParseConstants; ConstantCount + 1 entries, of which 0 is unused.
+    struct ConstantPoolEntry* Constants;
 
     uint16_t ClassAccess;
     uint16_t This;
@@ -78,41 +95,61 @@ struct ClassFile {
 };
 
 class ClassHeap {
-    std::list<std::string> ClassCache;
-    std::map<std::string, Class*> ClassMap;
-    std::list<std::string> ClassPath;
+    // Every class that has been added, by name. Nothing else is needed to find a class once it's loaded.
+    std::unordered_map<std::string, Class*> ClassMap;
+    // The same classes, in the order they were added.
+    std::vector<Class*> Classes;
+    std::list<ClassPathEntry> ClassPath;
+    // Whether each class file that has been looked for on the ClassPath exists. See ClassHeap#ProbeClassPath.
+    std::unordered_map<std::string, bool> Probes;
+    std::mutex ProbeLock;
+    // Reads and parses classes on other threads, before they're needed. See ClassLoader.cpp.
+    std::unique_ptr<ClassLoader> Loader;
+    // Classes that have already been parsed and linked by an earlier run, if -Xshare:on. See Archive.cpp.
+    std::unique_ptr<SharedArchive> Archive;
+    // How much of the Symbol Table has been counted towards the metadata so far. See ClassHeap#AddClass.
+    size_t SymbolsCounted{};
 
     public:
         ClassHeap();
-        
+        ~ClassHeap();
+
         static std::string UnknownClass;
         std::string ClassPrefix;
 
         void AddToClassPath(std::string);
-        std::string SearchClassPath(std::string&);
+        std::string DescribeClassPath();
+        void SetArchive(std::unique_ptr<SharedArchive> p_Archive);
 
         bool LoadClass(const char* ClassName, Class* pClass);
+        bool ReadClass(const std::string& ClassName, Class* pClass);
+        Class* ReadClass(const std::string& ClassName);
         bool AddClass(Class* pClass);
         bool ClassExists(const std::string& Name);
         Class* GetClass(const std::string& Name);
 
-        std::list<Class*> GetAllClasses() { 
-            std::list<Class*> list;
-            for(auto& it : ClassMap)
-                list.push_back(it.second);
+        const std::vector<Class*>& GetAllClasses() { return Classes; }
 
-            return list;
-        }
-        
+    private:
+        bool ProbeClassPath(const std::string& Path);
 };
 
 class Class : public ClassFile {
     public:
+        // Whether the static initializer of a class has been run yet. See Engine#InitializeClass.
+        enum InitState {
+            Loaded,
+            Initializing,
+            Initialized
+        };
+
         Class();
         virtual ~Class();
 
         virtual bool LoadFromFile(const char* Filename);
-        void SetCode(const char* Code);
+        bool LoadFromMemory(const char* Bytes, size_t Length, bool ReadOnly);
+        bool SetCode(const char* Code);
+        void RewriteCode(uint8_t* At, uint8_t Value);
 
         bool ParseFullClass();
         bool ParseInterfaces(const char* &ClassCode);
@@ -121,50 +158,141 @@ class Class : public ClassFile {
         bool ParseMethodCodePoints(int Method, CodePoint* MethodCode);
         bool ParseAttribs(const char* &ClassCode);
 
-        void ClassloadReferents();
+        bool Link();
 
         bool GetConstants(uint16_t index, ConstantPoolEntry &Pool);
-        std::string GetStringConstant(uint32_t index);
+        const std::string& GetStringConstant(uint32_t index);
+        Symbol* GetSymbol(uint32_t index);
 
-        std::string GetClassName();
-        std::string GetSuperName();
+        const std::string& GetClassName();
+        const std::string& GetSuperName();
 
         virtual uint32_t GetClassSize();
         virtual uint32_t GetClassFieldCount();
+        uint32_t GetInstanceSize();
+        size_t GetMetadataSize();
+        const std::vector<uint32_t>& GetReferenceOffsets();
 
         
         bool PutStatic(uint16_t Field, Variable Value);
         Variable GetStatic(uint16_t Field);
 
         Class* GetSuper();
+        const std::vector<Class*>& GetInterfaces();
+        bool IsAssignableTo(Class* Other);
 
         uint32_t GetMethodFromDescriptor(const char* MethodName, const char* Descriptor, const char* ClassName, Class* &Class);
-        uint32_t GetFieldFromDescriptor(const std::string& FieldAndDescriptor);
+        uint32_t GetMethodFromDescriptor(Symbol* MethodName, Symbol* Descriptor, Symbol* ClassName, Class* &Class);
+        Class* FindMethod(Symbol* Name, Symbol* Descriptor, uint16_t& Method);
+        const ResolvedMethod& ResolveMethod(uint16_t Index);
+        // Only for Method constants that ResolveMethod has already seen.
+        const ResolvedMethod& GetResolvedMethod(uint16_t Index) { return ResolvedMethods[Index]; }
+        uint32_t GetFieldFromDescriptor(const char* Name, const char* Descriptor);
+
+        Class* FindField(const char* Name, const char* Descriptor, uint16_t& Field);
+        Class* FindField(Symbol* Name, Symbol* Descriptor, uint16_t& Field);
+        void ResolveField(uint16_t Index, Class* &Owner, uint16_t& Field);
+        // Only for Field constants that ResolveField has already seen.
+        void GetResolvedField(uint16_t Index, Class* &Owner, uint16_t& Field) {
+            Owner = ResolvedFields[Index].Owner;
+            Field = ResolvedFields[Index].Field;
+        }
+        uint32_t GetFieldOffset(uint16_t Field) { return FieldOffsets[Field]; }
+        uint8_t GetFieldType(uint16_t Field) { return FieldTypes[Field]; }
 
 
         Object CreateObject(uint16_t Index, ObjectHeap* ObjectHeap);
-        bool CreateObjectArray(uint16_t Index, uint32_t Count, ObjectHeap ObjectHeap, Object &Object);
+        const AllocationTemplate& ResolveAllocation(uint16_t Index);
+        // Only for Class constants that ResolveAllocation has already seen.
+        const AllocationTemplate& GetResolvedAllocation(uint16_t Index) { return AllocationTemplates[Index]; }
+        Object ResolveString(uint16_t Index, ObjectHeap* ObjectHeap);
+        // The VM's own implementation of a Method constant, or nullptr if it isn't an intrinsic. Resolved by Link.
+        intrinsic_t GetIntrinsic(uint16_t Index) { return ResolvedIntrinsics[Index]; }
+        bool CreateObjectArray(uint16_t Index, uint32_t Count, ObjectHeap* ObjectHeap, Object &Object);
+        bool CreateMultiArray(uint16_t Index, const std::vector<uint32_t>& Counts, ObjectHeap* ObjectHeap, Object &Object);
+
+        void SetSource(const std::string& p_Source) { Source = p_Source; }
 
         void SetClassHeap(ClassHeap* p_ClassHeap) {
             this->_ClassHeap = p_ClassHeap;
         }
 
+        InitState GetInitState() { return State; }
+        void SetInitState(InitState NewState) { State = NewState; }
+
+        // The Collector treats static fields as roots.
+        Variable* GetStatics() { return ClassStatics; }
+        uint16_t GetStaticsCount() { return FieldsCount; }
+
     private:
+        // The Shared Archive saves and restores everything that parsing and linking work out. See Archive.cpp.
+        friend class SharedArchive;
+
         size_t BytecodeLength;
         size_t LoadedLocation;
+        // The start of the class file. Code is moved along it while it's being parsed.
+        const char* Bytes{};
         const char* Code;
+        // The class file, if it was loaded from one; it stays mapped for as long as the class. See LoadFromFile.
+        MappedFile File;
+        // The class file, or the JAR, that this class was read from; empty if it was handed over in memory.
+        std::string Source;
+        // Whether this class was restored from the Shared Archive, rather than parsed.
+        bool Archived{};
+        // Whether the class file is in a read-only mapping, rather than ordinary memory. See RewriteCode.
+        bool ReadOnly{};
 
         ClassHeap* _ClassHeap;
         uint16_t FieldsCount;
-        std::vector<std::string> StringConstants;
     
         uint16_t StaticFieldCount{};
         Variable* ClassStatics{};
         std::vector<size_t> StaticFieldIndexes;
 
+        InitState State = Loaded;
+
+        // Filled in by Link.
+        bool Linked{};
+        Class* SuperClass{};
+        std::vector<Class*> InterfaceClasses;
+        // How many instance fields an Object of this class has, including those of every super class.
+        uint32_t InstanceFieldCount{};
+        // How many bytes of Variable Data an Object of this class has, including the class pointer.
+        uint32_t InstanceSize{};
+        // For each field; the byte offset in an Object's Variable Data if it's an instance field, or the index into
+        //  the statics if it's static.
+        std::vector<uint32_t> FieldOffsets;
+        // For each field; the type code, as in newarray, or FieldReference.
+        std::vector<uint8_t> FieldTypes;
+        // The byte offset of every reference field in an instance, for the Collector.
+        std::vector<uint32_t> ReferenceOffsets;
+
+        // Field constants of this class that have already been resolved, by Constants Pool index.
+        struct ResolvedField {
+            Class* Owner;
+            uint16_t Field;
+        };
+        std::vector<ResolvedField> ResolvedFields;
+        // Method constants of this class that invokestatic has already resolved, by Constants Pool index.
+        std::vector<ResolvedMethod> ResolvedMethods;
+        // Class constants of this class that new has already resolved, by Constants Pool index.
+        // A Klass of 0 means it hasn't been resolved yet.
+        std::vector<AllocationTemplate> AllocationTemplates;
+        // String constants of this class that ldc has already interned, by Constants Pool index.
+        std::vector<Object> ResolvedStrings;
+        // Method constants of this class that name an intrinsic, by Constants Pool index. See Native#FindIntrinsic.
+        std::vector<intrinsic_t> ResolvedIntrinsics;
+
+        // Methods and fields by the Symbols of their name and descriptor. See BuildIndexes.
+        MemberIndex MethodIndex;
+        MemberIndex FieldIndex;
+
+        void BuildIndexes();
+
         bool ParseConstants(const char* &pCode);
+        Symbol* NameConstant(uint32_t index);
         uint32_t GetConstantsCount(const char* pCode);
 
-        std::string GetName(uint16_t ThisOrSuper);
+        const std::string& GetName(uint16_t ThisOrSuper);
 };
 
@@ -0,0 +1,56 @@
+/**************
+ * GEMWIRE    *
+ *    PURPURI *
+ **************/
+
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Class;
+class ClassHeap;
+
+/**
+ * The Class Loader reads and parses class files on a pool of worker threads, ahead of the interpreter needing them.
+ * See ClassLoader.cpp for how it fits in with the Class Heap.
+ */
+class ClassLoader {
+    public:
+        // How many worker threads read and parse class files (-Xloader-threads=N).
+        // 0 turns the workers off, and every class is read on the interpreter thread when it's needed.
+        static size_t Threads;
+
+        explicit ClassLoader(ClassHeap* Heap);
+        ~ClassLoader();
+
+        void Preload(const std::string& Name);
+        Class* Take(const std::string& Name);
+
+    private:
+        struct Job {
+            std::string Name;
+            std::promise<Class*> Result;
+        };
+
+        ClassHeap* Heap;
+
+        // Guards everything below.
+        std::mutex Lock;
+        std::condition_variable Ready;
+        bool Stopping = false;
+
+        // Classes waiting for a worker, oldest first.
+        std::deque<Job> Queue;
+        // Every class that has been asked for and not yet taken, whether it's waiting, being parsed or done.
+        std::map<std::string, std::future<Class*>> Results;
+
+        std::vector<std::thread> Workers;
+
+        void Work();
+};
@@ -0,0 +1,77 @@
+/**************
+ * GEMWIRE    *
+ *    PURPURI *
+ **************/
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A whole file, mapped read-only into memory.
+ * The mapping is private; pages that are written to are copied, and the file itself never changes.
+ * See ClassPath.cpp.
+ */
+class MappedFile {
+    public:
+        MappedFile() = default;
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool Open(const char* Filename);
+
+        const char* GetData() const { return Data; }
+        size_t GetSize() const { return Size; }
+
+    private:
+        const char* Data = nullptr;
+        size_t Size = 0;
+};
+
+/**
+ * A JAR (or any zip file) on the ClassPath.
+ * The Central Directory is read once, when the JAR is opened, into an index of every entry by name.
+ * See ClassPath.cpp.
+ */
+class JarFile {
+    public:
+        bool Open(const std::string& Filename);
+        const char* Find(const std::string& ClassName, size_t& Length);
+
+        const std::string& GetPath() const { return Path; }
+        // Whether something Find returned is in the mapping, rather than inflated into memory of its own.
+        bool IsMapped(const char* Bytes) const { return Bytes >= File.GetData() && Bytes < File.GetData() + File.GetSize(); }
+
+    private:
+        struct Entry {
+            uint16_t Compression;
+            uint32_t CompressedSize;
+            uint32_t Size;
+            uint32_t HeaderOffset;
+        };
+
+        std::string Path;
+        MappedFile File;
+        std::unordered_map<std::string, Entry> Entries;
+
+        // Guards Inflated. Classes are read from any of the Class Loader's threads.
+        std::mutex Lock;
+        // Every compressed class that has been read, kept for as long as the JAR; the Class points into it.
+        std::vector<std::unique_ptr<char[]>> Inflated;
+};
+
+/**
+ * A location on the ClassPath; either a directory of class files, or a JAR.
+ */
+struct ClassPathEntry {
+    // The directory, ending with a separator. Empty if this is a JAR.
+    std::string Directory;
+    std::unique_ptr<JarFile> Jar;
+};
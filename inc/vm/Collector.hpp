@@ -0,0 +1,150 @@
+/**************
+ * GEMWIRE    *
+ *    PURPURI *
+ **************/
+
+#pragma once
+#include "Common.hpp"
+#include "Objects.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Milliseconds since the given time point, for the GC log.
+#define ELAPSED_MS(Start) \
+    (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - (Start)).count())
+
+/**
+ * Handles reclaiming memory from the Object Heap.
+ * Only one Collector exists per VM, so like the Debugger, everything here is static.
+ *
+ * The Collector is a mostly-concurrent mark-sweep collector:
+ *  - Initial Mark; a short pause on the interpreter thread that greys the roots (the Member Stack and class statics)
+ *  - Concurrent Mark; the Collector thread traces the heap while the interpreter keeps running
+ *  - Remark; a short pause that drains whatever the write barrier logged since the Collector thread went idle
+ *  - Concurrent Sweep; the Collector thread frees everything that was not marked
+ *
+ * Marking is snapshot-at-the-beginning (SATB).
+ * Anything reachable when Initial Mark happened will be marked, and anything allocated after that is left alone.
+ * To keep the snapshot intact, every heap store that overwrites a reference must first log the old value.
+ * See ObjectHeap::StoreReference for the barrier itself.
+ *
+ * The interpreter only ever pauses at Safepoints - the top of the Engine loop, between instructions.
+ *
+ * Alternatively, the Collector can run as a parallel stop-the-world collector (-Xgc=parallel).
+ * The interpreter stops for the whole cycle, but marking and sweeping are split across several worker threads.
+ * See ParallelCollector.cpp for how that works.
+ */
+class Collector {
+    public:
+
+    enum Phase {
+        Idle,
+        Marking,
+        Sweeping
+    };
+
+    enum Mode {
+        Concurrent,
+        Parallel
+    };
+
+    // Which collector to run (-Xgc=concurrent or -Xgc=parallel).
+    static Mode Algorithm;
+
+    // How many threads the parallel collector may use (-Xgc-threads=N). 0 means one per core.
+    static size_t Threads;
+
+    // Print a line to stderr for every collection event (the -g flag).
+    static bool Logging;
+
+    // Allocate this many bytes between collections.
+    static size_t Trigger;
+
+    // Set when the interpreter should stop at the next Safepoint.
+    static std::atomic<bool> Requested;
+
+    // True while the SATB write barrier must log overwritten references.
+    static bool BarrierActive;
+
+    // True while the Collector thread may be touching the Object Heap.
+    static bool Active;
+
+    /** Interpreter thread **/
+
+    // Tell the Collector where to find class statics.
+    static void Attach(ClassHeap* Heap);
+
+    // Called by the Object Heap on every allocation.
+    static void NotifyAllocation(size_t Bytes);
+
+    // Advance the collection cycle, if one needs to advance. Only call this between instructions.
+    static void Safepoint();
+
+    // Log the old value of a heap slot that is about to be overwritten.
+    static void Remember(Variable Old);
+
+    // Collect everything possible before an allocation gives up. Can be called between Safepoints.
+    static void Reclaim();
+
+    // Stop the Collector thread.
+    static void Rejoin();
+
+    /** Collector thread **/
+
+    static void Run();
+
+    private:
+
+    static ClassHeap* Classes;
+    static Phase CurrentPhase;
+
+    static std::thread Thread;
+    static std::mutex Locker;
+    static std::condition_variable Notifier;
+    static std::atomic<bool> Stopping;
+    static bool ThreadDone;
+
+    static size_t AllocatedSinceCycle;
+
+    // The Top of the arena when marking finished. Everything above it was allocated during the sweep.
+    static size_t SweepLimit;
+
+    // Owned by whoever is currently marking.
+    static std::vector<size_t> Grey;
+    // The interpreter's SATB buffer, handed over to the Collector thread when it fills.
+    static std::vector<size_t> LocalLog;
+    // SATB buffers waiting for the Collector thread, guarded by Locker.
+    static std::vector<size_t> SharedLog;
+
+    static size_t MarkedObjects;
+    static size_t FreedObjects;
+    static size_t FreedBytes;
+    // How long the Collector thread spent on its last phase.
+    static double PhaseMillis;
+
+    static size_t ScanRoots(void (*Visit)(size_t));
+
+    /** Concurrent **/
+
+    static void InitialMark();
+    static void Remark();
+    static void FinishSweep();
+    static void FinishCycle();
+    static void WaitForThread();
+
+    static void Shade(size_t Candidate);
+    static size_t Drain(size_t Budget);
+    static void Sweep();
+
+    /** Parallel **/
+
+    static void Collect();
+    static bool Claim(size_t Candidate);
+    static void ShadeRoot(size_t Candidate);
+    static void MarkWorker(size_t Worker);
+    static void SweepWorker(size_t Worker);
+};
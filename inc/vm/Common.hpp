@@ -17,6 +17,7 @@
 
 class Class;
 class ClassHeap;
+class ClassLoader;
 class StackFrame;
 class ObjectHeap;
 
@@ -100,14 +101,24 @@ struct AttributeData {
     uint8_t* AttributeInfo;
 };
 
+/**
+ * A reference to something in the Object Heap.
+ * It's a single word; what the Object is (a class instance, or an array of some type) is kept in the Object itself.
+ */
 class Object {
     public:
         size_t Heap;
-        uint8_t Type;
 
         bool operator==(const Object& other) const { return other.Heap == this->Heap; }
 };
 
+/**
+ * A single slot of data - on the Member Stack, in a local, in a field, or in a reference array.
+ * Every member is at most one word wide, so every slot is 8 bytes.
+ *
+ * The constructors always write the whole word, so that the unused upper bytes of a small value are zero
+ *  rather than whatever the slot held before.
+ */
 union Variable {
     explicit Variable(size_t val) {
         pointerVal = val;
@@ -118,10 +129,12 @@ union Variable {
     }
 
     explicit Variable(const char i) {
+        pointerVal = 0;
         charVal = i;
     }
 
     Variable(int i) {
+        pointerVal = 0;
         intVal = i;
     }
 
@@ -138,6 +151,8 @@ union Variable {
     Object object;
 };
 
+static_assert(sizeof(Variable) == 8, "Variable must be a single word");
+
 struct NativeContext {
     int InvocationMethod;
 
@@ -422,7 +437,14 @@ class Instruction {
         goto_w, // 200
         jsr_w, // 201
 
-        breakpoint // 202
+        breakpoint, // 202
+
+        // Purpuri's own instructions, which an instruction above rewrites itself into once it's been resolved and
+        //  its class initialized. They do the same thing, minus the checks. See Engine#InitializeClass.
+        new_quick, // 203
+        getstatic_quick, // 204
+        putstatic_quick, // 205
+        invokestatic_quick // 206
     };
 
     private:
@@ -446,4 +468,19 @@ enum{
     TypeMethod,
     TypeInterfaceMethod,
     TypeNamed
-};
\ No newline at end of file
+};
+
+// The primitive array types, as given to the newarray instruction.
+enum {
+    ArrayBoolean = 4,
+    ArrayChar,
+    ArrayFloat,
+    ArrayDouble,
+    ArrayByte,
+    ArrayShort,
+    ArrayInt,
+    ArrayLong
+};
+
+// Instance fields are packed by type, using the same codes as newarray for primitives. References get their own.
+#define FieldReference 1
\ No newline at end of file
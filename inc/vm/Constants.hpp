@@ -5,7 +5,43 @@
 #pragma once
 #include <stdint.h>
 
+struct Symbol;
+
+// The two halves of a Named (NameAndType) constant, as indexes of UTF-8 constants.
+struct NamedReference {
+    uint16_t Name;
+    uint16_t Descriptor;
+};
+
+// A Field, Method or InterfaceMethod constant.
+// The name and descriptor are copied up from the Named constant, so that nothing has to look through it.
+struct MemberReference {
+    uint16_t Class;
+    uint16_t NameAndType;
+    uint16_t Name;
+    uint16_t Descriptor;
+};
+
+/**
+ * One constant from a class' Constants Pool, decoded out of the class file.
+ * Numbers are in the machine's own byte order, and every index has been read out, so using a constant is only ever
+ *  a matter of reading the field for its Tag. See Class#ParseConstants.
+ */
 struct ConstantPoolEntry {
     uint8_t Tag;
-    uint8_t* Info;
-};
\ No newline at end of file
+    // The Symbol, for every constant that can be read as a String. Null for numbers, and the empty half of a long.
+    Symbol* Text;
+
+    union {
+        // Integer and Float constants. Floats are kept as their bits, so Int is the bits of either.
+        int32_t Int;
+        float Float;
+        // Long and Double constants. As above, Long is the bits of either.
+        int64_t Long;
+        double Double;
+        // Class and String constants; the UTF-8 constant with the name or the text.
+        uint16_t Utf8;
+        NamedReference Named;
+        MemberReference Member;
+    };
+};
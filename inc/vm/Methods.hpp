@@ -47,3 +47,15 @@ struct Method : MethodData {
     struct MethodData* Data;
     struct CodePoint* Code;
 };
+
+/**
+ * Where a Method constant leads; the class that declares the method, and the method in it.
+ * See Class#ResolveMethod.
+ */
+struct ResolvedMethod {
+    class Class* Owner;
+    uint16_t Method;
+    // How many Variables the parameters take up on the stack, and whether anything is returned.
+    uint16_t Parameters;
+    bool Returns;
+};
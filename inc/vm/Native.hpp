@@ -9,7 +9,10 @@
 #include <map>
 #include <native/Native.hpp>
 
+struct Symbol;
+
 typedef long long (*function_t)();
+typedef void (*intrinsic_t)();
 
 class Native {
     public:
@@ -47,9 +50,21 @@ class Native {
      */
     static void CloseHandle(std::string LibraryName);
 
+    /**
+     * Given the class, name and descriptor of a method, find the VM's own implementation of it.
+     * Intrinsics are written just like PNI functions, but they're built into the VM so that they can work on the
+     *  Object Heap directly, and they're used whether or not the method is declared native.
+     * The list is in Intrinsics.cpp.
+     * Returns nullptr if the method isn't an intrinsic.
+     * This is only called as classes are linked; each Method constant is resolved once. See Class#GetIntrinsic.
+     */
+    static intrinsic_t FindIntrinsic(Symbol* ClassName, Symbol* MethodName, Symbol* Descriptor);
+
     static std::vector<Variable> Parameters;
+    static Object Instance;
     
     private:
     static std::map<std::string, void*> LibraryHandleMap;
+    static std::map<std::string, intrinsic_t> Intrinsics;
 };
 
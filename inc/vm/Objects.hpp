@@ -5,8 +5,127 @@
 
 #pragma once
 #include "Common.hpp"
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
 #include <map>
 
+// The arena is handed out in Granules; one Variable is exactly one Granule.
+#define HEAP_GRANULE sizeof(Variable)
+#define HEAP_GRANULE_SHIFT 3
+
+// With compressed references, a reference is a 32 bit Granule offset, so this is as big as the arena can be.
+#define HEAP_COMPRESSED_LIMIT ((size_t) 32 * 1024 * 1024 * 1024)
+
+// Free blocks smaller than this many Granules are kept in a list per exact size. Bigger ones share the last list.
+#define HEAP_FREE_CLASSES 32
+
+// The arena is split into Regions of this many Granules when the Collector sweeps it in parallel.
+// It must be a multiple of 64, so that no two Regions share a word of a bitmap.
+#define HEAP_REGION_GRANULES ((size_t) 1 << 17)
+
+// Objects at least this many bytes go in the large object space, which grows down from the end of the arena.
+#define HEAP_LARGE_OBJECT ((size_t) 256 * 1024)
+// Large objects start on, and are rounded up to, this many Granules (64KB), so they always cover whole pages.
+#define HEAP_LARGE_GRANULES ((size_t) 1 << 13)
+
+// Flags in a Block Header.
+#define BLOCK_ALLOCATED  0x01 // The block is an Object. Otherwise, it's free space.
+#define BLOCK_REFERENCES 0x02 // The Object may hold references, so the Collector has to scan it.
+#define BLOCK_COMPRESSED 0x04 // The Object is a reference array with 32 bit elements.
+#define BLOCK_ARRAY      0x08 // The Object is an array, so it has a length word after its class word.
+#define BLOCK_FLAGS      0x0F
+
+// Lock bits in a Block Header, for monitorenter and monitorexit.
+// The interpreter only has one thread, so nothing contends for them yet.
+#define LOCK_SHIFT 4
+#define LOCK_MASK  0x30
+#define LOCK_UNLOCKED 0
+#define LOCK_HELD     1
+
+// The identity hash lives in the top of the Flags word. 0 means it hasn't been given one yet.
+#define HASH_SHIFT 8
+#define HASH_MASK  0xFFFFFF00
+
+// How many Variables of an array's data come before its elements; the class word and the length.
+#define ARRAY_HEADER_SLOTS 2
+
+// The length of an array only needs the bottom 32 bits of its length word. The rest is its shape, which is what
+//  tells arrays of arrays apart, as they share the class word of their innermost elements; how many dimensions it
+//  has, and the Array Type at the bottom of it, or 0 if that's a class. See ObjectHeap#ArrayTemplate.
+#define ARRAY_LENGTH_MASK      0xFFFFFFFF
+#define ARRAY_DIMENSIONS_SHIFT 32
+#define ARRAY_INNERMOST_SHIFT  40
+
+// The coder field of a String says how its' value byte array is encoded.
+// Latin-1 is one byte per char; UTF-16 is two, low byte first.
+#define STRING_LATIN1 0
+#define STRING_UTF16  1
+
+/**
+ * The word in front of every block in the arena, whether it's an Object or free space.
+ * Granules is the size of the whole block, including this header.
+ * This is what lets the Collector walk the arena from one block to the next.
+ *
+ * For an Object, this is also where the identity hash and lock bits go:
+ * ┌──────────────────────┬──────────────────────────┬──────┬──────────┐
+ * │ Granules (32)        │ Identity Hash (24)       │ Lock │ Flags    │
+ * └──────────────────────┴──────────────────────────┴──────┴──────────┘
+ */
+struct BlockHeader {
+    uint32_t Granules;
+    uint32_t Flags;
+};
+
+static_assert(sizeof(BlockHeader) == HEAP_GRANULE, "Block Header must be one Granule");
+
+/**
+ * Everything needed to allocate an instance of a class, worked out ahead of time.
+ * The header is stored as-is, so it already has BLOCK_ALLOCATED set.
+ * See ObjectHeap::InstanceTemplate, and Class::ResolveAllocation for where these are cached.
+ */
+struct AllocationTemplate {
+    BlockHeader Header;
+    size_t Klass;
+    // For arrays, the length word without the length in it; the shape of the array. 0 for everything else.
+    size_t Shape;
+};
+
+/**
+ * Free blocks that a sweep found, chained up by size.
+ * Each thread that sweeps keeps its own, and they're spliced into the heap's free lists at the end.
+ */
+struct SweepState {
+    size_t Heads[HEAP_FREE_CLASSES];
+    size_t Tails[HEAP_FREE_CLASSES];
+
+    // The run of free Granules that the sweep is currently in the middle of.
+    size_t RunStart;
+    size_t RunGranules;
+
+    size_t Freed;
+    size_t FreedBytes;
+    // How many of the FreedBytes were arrays.
+    size_t FreedArrayBytes;
+};
+
+/**
+ * How many bytes are in use for one kind of thing, and the most there have ever been at once.
+ * Only the interpreter thread allocates, so it's the only one that moves the Peak.
+ * The Collector thread may be taking away at the same time, so the current count is atomic.
+ */
+struct MemoryUsage {
+    std::atomic<size_t> Current { 0 };
+    size_t Peak = 0;
+
+    void Add(size_t Bytes) {
+        size_t Now = Current.fetch_add(Bytes, std::memory_order_relaxed) + Bytes;
+        if(Now > Peak) Peak = Now;
+    }
+
+    void Remove(size_t Bytes) { Current.fetch_sub(Bytes, std::memory_order_relaxed); }
+};
+
 class ObjectHeap {
     public:
         ObjectHeap();
@@ -14,16 +133,170 @@ class ObjectHeap {
 
         static Object Null;
 
+        // Store references in reference arrays as 32 bit offsets (-Xcompressed-refs).
+        static bool CompressedReferences;
+        // How much address space to reserve for the arena (-Xmx). Running out of it is an OutOfMemoryError.
+        static size_t MaxHeapSize;
+        // How much can be allocated before the first collection (-Xms).
+        static size_t InitialHeapSize;
+        // Print how much memory was used for what when the VM exits (-Xmemory-summary).
+        static bool MemorySummary;
+        // Ask for transparent huge pages to back large objects (-Xhuge-pages).
+        static bool HugePages;
+
+        // What memory is being used for, as shown by PrintMemorySummary.
+        // Instances and Arrays are the Objects in the arena, and Used is the two together.
+        // Metadata is everything the Class Heap keeps for the classes it's loaded, which lives outside the arena.
+        MemoryUsage Instances;
+        MemoryUsage Arrays;
+        MemoryUsage Used;
+        MemoryUsage Metadata;
+
+        void PrintMemorySummary();
+        [[noreturn]] static void OutOfMemory(const char* Reason, size_t Bytes);
+
         virtual Variable* GetObjectPtr(Object obj);
         virtual size_t GetArraySize(Object obj);
+        uint8_t* GetArrayData(Object obj);
+
+        bool IsArray(Object obj);
+        Class* GetClass(Object obj);
+        uint8_t GetArrayType(Object obj);
+        uint8_t GetArrayDimensions(Object obj);
+        uint8_t GetInnermostType(Object obj);
+        uint32_t GetIdentityHash(Object obj);
+
+        static size_t ArrayElementSize(uint8_t Type);
+        static size_t ReferenceSize() { return CompressedReferences ? 4 : 8; }
+        static size_t FieldSize(uint8_t Type) { return Type == FieldReference ? ReferenceSize() : ArrayElementSize(Type); }
+
+        static AllocationTemplate InstanceTemplate(Class* Class);
+        static AllocationTemplate ArrayTemplate(uint8_t Type, size_t Klass, uint32_t Count, uint8_t Dimensions, uint8_t Innermost);
 
         Object CreateObject(Class* Class);
+        Object CreateObject(const AllocationTemplate& Template);
         Object CreateString(const std::string& String, ClassHeap* ClassHeap);
+        Object CreateString(const std::string& Value, uint8_t Coder, ClassHeap* ClassHeap);
+        Object InternString(const std::string& String, ClassHeap* ClassHeap);
+        Object Intern(Object String);
         Object CreateArray(uint8_t Type, uint32_t Count);
         Object CreateObjectArray(Class* Class, uint32_t Count);
+        Object CreateMultiArray(const std::vector<AllocationTemplate>& Levels, const std::vector<uint32_t>& Counts);
+
+        Object LoadElement(Object Array, uint32_t Index);
+        void StoreElement(Object Array, uint32_t Index, Object Value);
+        void CopyElements(Object Source, uint32_t SourcePos, Object Dest, uint32_t DestPos, uint32_t Length);
+        void FillElements(Object Array, uint32_t From, uint32_t To, Variable Value);
+        Variable LoadField(Object obj, uint32_t Offset, uint8_t Type);
+        void StoreField(Object obj, uint32_t Offset, uint8_t Type, Variable Value);
+        void StoreReference(Variable* Slot, Variable Value);
 
     private:
-        std::map<size_t, size_t> ObjectMap;
-        std::map<size_t, size_t> ArraySizeMap;
-        uint32_t NextObjectID;
-};
\ No newline at end of file
+        friend class Collector;
+
+        // The start of the arena. A reference is the Granule offset of an Object's Variable Data from here.
+        uint8_t* Base;
+        // The first Granule that has never been handed out.
+        size_t Top;
+        // The first Granule above the Top that hasn't been committed. See ObjectHeap#CommitArena.
+        size_t Committed;
+        // How many Granules were reserved.
+        size_t Limit;
+
+        // One bit per Granule; set where a Block Header is.
+        uint64_t* BlockStarts;
+        // One bit per Granule; set where the Block Header of a reachable Object is.
+        std::atomic<uint64_t>* Marks;
+
+        // The lowest Granule of the large object space. Everything from here to the Limit is large objects or free.
+        size_t LargeBottom;
+        // The header Granule of every large object.
+        std::vector<size_t> LargeObjects;
+        // Free ranges in the large object space, by first Granule. Neighbours are always joined.
+        std::map<size_t, size_t> LargeFree;
+
+        // Chains of free blocks, linked through the Granule after their header. 0 ends a chain.
+        size_t FreeLists[HEAP_FREE_CLASSES];
+        // Set by the Collector while new Objects have to be born marked.
+        bool AllocateBlack;
+        // The state of the identity hash generator.
+        uint32_t HashSeed;
+
+        // Held by whichever thread is touching the arena metadata while the Collector is running.
+        std::mutex Lock;
+
+        // Every interned String, by contents. These are never freed, so the Collector treats them as roots.
+        std::unordered_map<std::string, Object> InternTable;
+        // Objects that the VM is holding on to in between two allocations, where nothing else refers to them yet.
+        // An allocation can collect when the arena is full (see Collector#Reclaim), so these are roots too.
+        std::vector<size_t> Pinned;
+
+        void Reserve();
+        Variable* Allocate(const AllocationTemplate& Template, Object& Out);
+        size_t TakeArena(size_t Granules);
+        void CommitArena(size_t End);
+        void CommitBitmaps(size_t From, size_t To);
+        size_t TakeFree(size_t Granules);
+        size_t TakeLarge(size_t Granules);
+        void ReleaseLarge(size_t Block, size_t Span);
+        size_t SweepLarge(SweepState& State);
+        void StoreCompressed(uint32_t* Slot, Object Value);
+        void CountAllocation(uint32_t Flags, size_t Bytes);
+        void CountFree(size_t Bytes, size_t ArrayBytes);
+        size_t ElementWidth(Object Array);
+        void RememberElements(Object Array, uint32_t From, uint32_t Count);
+        size_t CarveTree(const std::vector<AllocationTemplate>& Levels, const std::vector<uint32_t>& Counts, size_t Level, size_t& Next);
+        size_t AllocateTree(const std::vector<AllocationTemplate>& Levels, const std::vector<uint32_t>& Counts, size_t Level);
+
+        static const std::vector<uint32_t>& InstanceReferences(Variable* Data);
+        static uint8_t EncodeString(const std::string& String, std::string& Value);
+        std::string StringKey(Object String);
+
+        BlockHeader* HeaderAt(size_t Granule) { return (BlockHeader*) (Base + (Granule << HEAP_GRANULE_SHIFT)); }
+        bool IsBlockStart(size_t Granule) { return (BlockStarts[Granule >> 6] >> (Granule & 63)) & 1; }
+        void SetBlockStart(size_t Granule) { BlockStarts[Granule >> 6] |= (uint64_t) 1 << (Granule & 63); }
+        void ClearBlockStart(size_t Granule) { BlockStarts[Granule >> 6] &= ~((uint64_t) 1 << (Granule & 63)); }
+
+        bool IsObject(size_t Candidate);
+        bool IsMarked(size_t Granule) { return (Marks[Granule >> 6].load(std::memory_order_relaxed) >> (Granule & 63)) & 1; }
+        bool TryMark(size_t Ref);
+        void ClearMarks();
+
+        size_t FirstBlock(size_t From, size_t To);
+        size_t Sweep(size_t From, size_t To, SweepState& State);
+        void FinishRun(SweepState& State);
+        void InstallFreeLists(SweepState& State);
+        void DropFreeLists();
+
+        /**
+         * Call Visit with every reference in an Object.
+         * Instances only have the fields that their class says are references scanned.
+         * Reference arrays only have their elements scanned.
+         * Compressed references are widened first.
+         */
+        template<typename Visitor>
+        void ForEachReference(size_t Ref, Visitor Visit) {
+            BlockHeader* Header = HeaderAt(Ref - 1);
+            if(!(Header->Flags & BLOCK_REFERENCES)) return;
+
+            auto* Data = (Variable*) (Header + 1);
+
+            if(!(Header->Flags & BLOCK_ARRAY)) {
+                for(uint32_t Offset : InstanceReferences(Data)) {
+                    uint8_t* Field = (uint8_t*) Data + Offset;
+                    Visit(CompressedReferences ? (size_t) *(uint32_t*) Field : *(size_t*) Field);
+                }
+                return;
+            }
+
+            size_t Slots = Header->Granules - 1;
+            if(Header->Flags & BLOCK_COMPRESSED) {
+                auto* Elements = (uint32_t*) (Data + ARRAY_HEADER_SLOTS);
+                for(size_t i = 0; i < (Slots - ARRAY_HEADER_SLOTS) * 2; i++)
+                    Visit((size_t) Elements[i]);
+            } else {
+                for(size_t i = ARRAY_HEADER_SLOTS; i < Slots; i++)
+                    Visit(Data[i].pointerVal);
+            }
+        }
+};
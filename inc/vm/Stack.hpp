@@ -9,6 +9,7 @@
 class StackFrame {
     public:
         static Variable* MemberStack;
+        static size_t MemberStackSize;
     [[maybe_unused]] static StackFrame* FrameBase;
         Class* _Class;
         Method* _Method;
@@ -21,8 +22,6 @@ class StackFrame {
             ProgramCounter = 0;
             _Class = nullptr;
             Stack = nullptr;
-            FrameBase = nullptr;
-            MemberStack = nullptr;
         }
 
         StackFrame(int16_t StackPointer) {
@@ -0,0 +1,69 @@
+/**************
+ * GEMWIRE    *
+ *    PURPURI *
+ **************/
+
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * One distinct string from a Constants Pool; a name, a descriptor, or a class name.
+ * Every Symbol is unique, so two Symbols are the same string exactly when they're the same Symbol.
+ */
+struct Symbol {
+    const std::string Text;
+};
+
+/**
+ * The Symbol Table holds every Symbol in the VM, shared between every class that uses it.
+ * See Symbols.cpp.
+ */
+class SymbolTable {
+    public:
+        static Symbol* Intern(std::string_view Text);
+        static Symbol* Find(std::string_view Text);
+
+        // How many bytes every Symbol takes up together, for the Class metadata. See ClassHeap#AddClass.
+        static size_t GetSize() { return Size.load(std::memory_order_relaxed); }
+
+    private:
+        static std::mutex Lock;
+        // Keyed by the Symbol's own Text, which never moves.
+        static std::unordered_map<std::string_view, Symbol*> Table;
+        static std::atomic<size_t> Size;
+};
+
+/**
+ * An index of a class' methods or fields, by the Symbols of their name and descriptor.
+ * It's a flat, open addressed hash table, so a lookup is a hash of two pointers and usually a single probe.
+ * See Symbols.cpp.
+ */
+class MemberIndex {
+    public:
+        static constexpr uint16_t None = 0xFFFF;
+
+        void Reserve(size_t Count);
+        void Add(Symbol* Name, Symbol* Descriptor, uint16_t Index);
+        uint16_t Find(Symbol* Name, Symbol* Descriptor) const;
+
+        size_t GetSize() const { return Slots.capacity() * sizeof(Slot); }
+
+    private:
+        struct Slot {
+            Symbol* Name;
+            Symbol* Descriptor;
+            uint16_t Index;
+        };
+
+        // Always a power of two, and never more than half full. A null Name is an empty slot.
+        std::vector<Slot> Slots;
+
+        size_t Hash(Symbol* Name, Symbol* Descriptor) const;
+};
@@ -1,30 +1,57 @@
 package java.lang;
 
 public class String {
-	private final char[] chars;
-	
+	// The contents of the String.
+	// If every char fits in Latin-1, it's one byte per char. Otherwise, it's UTF-16; two bytes per char, low byte first.
+	private final byte[] value;
+	// Which of the two the value is; 0 for Latin-1, 1 for UTF-16.
+	// The length in chars is always value.length >> coder.
+	private final byte coder;
+
 	public String() {
-		this.chars = new char[0];
+		this.value = new byte[0];
+		this.coder = 0;
 	}
-	
+
 	public String(char[] str) {
-		this.chars = new char[str.length];
-		for (int i = 0; i < str.length; i++) this.chars[i] = str[i];
+		byte coder = 0;
+		for (int i = 0; i < str.length; i++)
+			if (str[i] > 0xFF) coder = 1;
+
+		this.coder = coder;
+		this.value = new byte[str.length << coder];
+		for (int i = 0; i < str.length; i++) {
+			if (coder == 0) {
+				this.value[i] = (byte) str[i];
+			} else {
+				this.value[i << 1] = (byte) str[i];
+				this.value[(i << 1) + 1] = (byte) (str[i] >> 8);
+			}
+		}
+	}
+
+	public int length() {
+		return this.value.length >> this.coder;
 	}
 
-    public int length() {
-        return this.chars.length;
-    }
+	public char charAt(int index) {
+		if (this.coder == 0)
+			return (char) (this.value[index] & 0xFF);
 
-    public byte[] getBytes() {
-		byte[] bytes = new byte[this.chars.length];
-		for (int i = 0; i < this.chars.length; i++) bytes[i] = (byte) this.chars[i];
+		return (char) ((this.value[index << 1] & 0xFF) | (this.value[(index << 1) + 1] << 8));
+	}
+
+	public byte[] getBytes() {
+		byte[] bytes = new byte[this.length()];
+		for (int i = 0; i < bytes.length; i++) bytes[i] = (byte) this.charAt(i);
 		return bytes;
 	}
-	
+
 	public char[] toCharArray() {
-		char[] newArray = new char[this.chars.length];
-		for (int i = 0; i < newArray.length; i++) newArray[i] = this.chars[i];
+		char[] newArray = new char[this.length()];
+		for (int i = 0; i < newArray.length; i++) newArray[i] = this.charAt(i);
 		return newArray;
 	}
-}
\ No newline at end of file
+
+	public native String intern();
+}
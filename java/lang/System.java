@@ -6,4 +6,7 @@ public class System {
     static {
         out = new java.vm.Printer();
     };
-}
\ No newline at end of file
+
+    // Implemented inside the VM; see Intrinsics.cpp.
+    public static native void arraycopy(Object src, int srcPos, Object dest, int destPos, int length);
+}
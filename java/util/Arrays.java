@@ -0,0 +1,27 @@
+package java.util;
+
+// Every method here is implemented inside the VM; see Intrinsics.cpp.
+public class Arrays {
+    private Arrays() {}
+
+    public static native void fill(boolean[] a, boolean val);
+    public static native void fill(boolean[] a, int fromIndex, int toIndex, boolean val);
+
+    public static native void fill(byte[] a, byte val);
+    public static native void fill(byte[] a, int fromIndex, int toIndex, byte val);
+
+    public static native void fill(char[] a, char val);
+    public static native void fill(char[] a, int fromIndex, int toIndex, char val);
+
+    public static native void fill(short[] a, short val);
+    public static native void fill(short[] a, int fromIndex, int toIndex, short val);
+
+    public static native void fill(int[] a, int val);
+    public static native void fill(int[] a, int fromIndex, int toIndex, int val);
+
+    public static native void fill(float[] a, float val);
+    public static native void fill(float[] a, int fromIndex, int toIndex, float val);
+
+    public static native void fill(Object[] a, Object val);
+    public static native void fill(Object[] a, int fromIndex, int toIndex, Object val);
+}
@@ -3,6 +3,7 @@
  *    PURPURI *
  **************/
 #include <iostream>
+#include <cstdio>
 #include <native/Native.hpp>
 
 extern "C" void Java_Native_doStuff_V_I_() {
@@ -19,26 +20,64 @@ extern "C" void Java_java_vm_Printer_println_Ljava_lang_StringE_V_() {
     auto Params = VM::GetParameters();
 
     auto String = Params.at(0).object;
-    Variable* ClassObj = VM::GetObject(String);
 
-    Object charArray = ClassObj[1].object;
-    Variable* data = VM::GetObject(charArray);
-    data++; // Skip the char marker
+    // Strings keep their contents in a byte array, along with a coder saying whether it's Latin-1 (0) or UTF-16 (1).
+    Object Value = VM::GetField(String, "value", "[B").object;
+    uint8_t Coder = VM::GetField(String, "coder", "B").charVal;
 
-    size_t datalen = VM::GetArrayLength(charArray);
+    auto* data = VM::GetArrayData(Value);
+    size_t datalen = VM::GetArrayLength(Value);
 
-    char* text = (char*) alloca(datalen + 1);
+    // ASCII is already UTF-8, so it can be written out as-is.
+    bool ascii = Coder == 0;
+    for(size_t i = 0; ascii && i < datalen; i++)
+        ascii = data[i] < 0x80;
 
-    for(size_t i = 0; i < datalen; i++)
-        text[i] = data[i].charVal;
-    text[datalen] = '\0';
+    if(ascii) {
+        fwrite(data, 1, datalen, stdout);
+    } else {
+        std::string text;
+        size_t length = Coder == 0 ? datalen : datalen / 2;
+        for(size_t i = 0; i < length; i++) {
+            uint32_t c = Coder == 0 ? data[i] : (uint32_t) (data[i * 2] | (data[i * 2 + 1] << 8));
 
-    printf("%s\n", text);
+            // Join surrogate pairs back up.
+            if(Coder != 0 && c >= 0xD800 && c < 0xDC00 && i + 1 < length) {
+                uint32_t low = data[i * 2 + 2] | (data[i * 2 + 3] << 8);
+                if(low >= 0xDC00 && low < 0xE000) {
+                    c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                    i++;
+                }
+            }
+
+            if(c < 0x80) {
+                text.push_back((char) c);
+            } else if(c < 0x800) {
+                text.push_back((char) (0xC0 | (c >> 6)));
+                text.push_back((char) (0x80 | (c & 0x3F)));
+            } else if(c < 0x10000) {
+                text.push_back((char) (0xE0 | (c >> 12)));
+                text.push_back((char) (0x80 | ((c >> 6) & 0x3F)));
+                text.push_back((char) (0x80 | (c & 0x3F)));
+            } else {
+                text.push_back((char) (0xF0 | (c >> 18)));
+                text.push_back((char) (0x80 | ((c >> 12) & 0x3F)));
+                text.push_back((char) (0x80 | ((c >> 6) & 0x3F)));
+                text.push_back((char) (0x80 | (c & 0x3F)));
+            }
+        }
+        fwrite(text.data(), 1, text.length(), stdout);
+    }
+    fputc('\n', stdout);
     
     VM::Return(10);
 }
 
 
+extern "C" void Java_java_lang_String_intern_V_Ljava_lang_StringE_() {
+    VM::Return(Variable(VM::Intern(VM::GetInstance())));
+}
+
 extern "C" void Java_java_vm_Printer_printint_I_V_() {
     auto Parameters = VM::GetParameters();
 
@@ -0,0 +1,548 @@
+/**************
+ * GEMWIRE    *
+ *    PURPURI *
+ **************/
+
+#include <vm/Archive.hpp>
+#include <vm/Class.hpp>
+
+#include <filesystem>
+#include <fstream>
+
+/**
+ * This file implements the SharedArchive class declared in Archive.hpp.
+ *
+ * Every run of the VM parses the same classes; java/lang/Object, java/lang/String, and whatever the program itself
+ *  uses. Parsing a class means decoding its Constants Pool, interning every string in it, building the
+ *  field and method tables, and then laying out its fields when it's linked.
+ * None of that changes from one run to the next, as long as the class files don't.
+ *
+ * With -Xshare:dump, the VM runs the program as usual, and then writes every class that it loaded into the archive;
+ *  the class file itself, and everything that parsing and linking worked out from it.
+ * With -Xshare:on, the archive is mapped, and a class that's in it is put back together straight from the mapping.
+ *  Nothing is parsed. The tables that the rest of the VM only ever reads (fields, exceptions, and the class file,
+ *  which the constants and the code point into) are used where they are in the archive; the rest are copied out.
+ *
+ * The archive is relocatable; everything in it refers to everything else by its offset from the start of the
+ *  archive, so it works wherever it's mapped. Numbers are stored in the machine's own byte order and layout, so an
+ *  archive only works with the build of the VM that wrote it.
+ *
+ * An archive is only used if it's still accurate:
+ *  - The ClassPath has to be the same as when it was written, or a class could be found somewhere else now.
+ *  - References have to be the same size (-Xcompressed-refs), as the field layouts depend on it.
+ *  - Every class file (or the JAR it came from) has to have the same size and modification time.
+ * If anything has changed, the whole archive is ignored, rather than just the classes that changed; a class that's
+ *  still in the archive could have been laid out on top of a super class that isn't any more.
+ *
+ * Method code is run straight out of the archive, so quickening writes to it; see Class#RewriteCode. The archive is
+ *  mapped privately, so the archive itself is never changed.
+ * For the same reason, the archive is never written from the classes as they are in memory, which have been
+ *  quickened. The class files are read again when the archive is written, so that it holds them as they were.
+ */
+
+SharedArchive::Mode SharedArchive::Sharing = SharedArchive::Off;
+std::string SharedArchive::Path = "purpuri.jsa";
+
+static const char Magic[8] = { 'P', 'U', 'R', 'P', 'C', 'D', 'S', 0 };
+static const uint32_t Version = 2;
+
+struct SharedArchive::Header {
+    char Magic[8];
+    uint32_t Version;
+    uint32_t ReferenceSize;
+    // Where the ClassPath it was written with is.
+    uint32_t ClassPath;
+    uint32_t ClassCount;
+    // Where the array of ClassCount ArchivedClasses is.
+    uint32_t Classes;
+};
+
+struct SharedArchive::ArchivedMethod {
+    uint16_t Access;
+    uint16_t Name;
+    uint16_t Descriptor;
+    uint16_t AttributeCount;
+    // The method's entry in the class file, as an offset from the start of it.
+    uint32_t Data;
+
+    uint8_t HasCode;
+    uint16_t CodeName;
+    uint32_t Length;
+    uint16_t StackSize;
+    uint16_t LocalsSize;
+    uint32_t CodeLength;
+    // The bytecode, as an offset from the start of the class file. 0 if there is none.
+    uint32_t Code;
+    uint16_t ExceptionCount;
+    // Where the array of ExceptionCount Exceptions is.
+    uint32_t Exceptions;
+};
+
+/**
+ * Everything about a class that ParseFullClass and Link work out, by offset into the archive.
+ * Offsets that say they're "into the class file" are from the start of the class file, not the archive.
+ */
+struct SharedArchive::ArchivedClass {
+    uint32_t Name;
+    // The class file, or the JAR it came from, with its size and modification time when the archive was written.
+    uint32_t Source;
+    int64_t SourceTime;
+    uint64_t SourceSize;
+
+    uint32_t Bytes;
+    uint32_t BytesLength;
+
+    uint32_t MagicNumber;
+    uint16_t BytecodeVersionMajor;
+    uint16_t BytecodeVersionMinor;
+    uint16_t ConstantCount;
+    uint16_t ClassAccess;
+    uint16_t This;
+    uint16_t Super;
+    uint16_t InterfaceCount;
+    uint16_t FieldsCount;
+    uint16_t MethodCount;
+    uint16_t AttributeCount;
+
+    // ConstantCount + 1 decoded ConstantPoolEntries, without their Symbols.
+    uint32_t Constants;
+    // ConstantCount + 1 strings, one for each of the class' Symbols, 0 for an empty string or none.
+    uint32_t Strings;
+    // InterfaceCount uint16_ts.
+    uint32_t Interfaces;
+    // FieldsCount FieldDatas.
+    uint32_t Fields;
+    // StaticFieldCount uint32_ts.
+    uint32_t StaticFields;
+    uint32_t StaticFieldCount;
+    // MethodCount ArchivedMethods.
+    uint32_t Methods;
+    // AttributeCount offsets into the class file.
+    uint32_t Attributes;
+
+    // The results of Link.
+    uint32_t InstanceFieldCount;
+    uint32_t InstanceSize;
+    // FieldsCount uint32_ts.
+    uint32_t FieldOffsets;
+    // FieldsCount uint8_ts.
+    uint32_t FieldTypes;
+    // ReferenceCount uint32_ts.
+    uint32_t ReferenceOffsets;
+    uint32_t ReferenceCount;
+};
+
+/**
+ * The size and modification time of a file, for checking whether it's changed since the archive was written.
+ * @return false if the file doesn't exist.
+ */
+static bool Stamp(const std::string& Filename, int64_t& Time, uint64_t& Size) {
+    std::error_code Error;
+    auto Modified = std::filesystem::last_write_time(Filename, Error);
+    if(Error) return false;
+
+    Size = std::filesystem::file_size(Filename, Error);
+    if(Error) return false;
+
+    Time = (int64_t) Modified.time_since_epoch().count();
+    return true;
+}
+
+std::string SharedArchive::GetString(uint32_t Offset) const {
+    return std::string(GetStringView(Offset));
+}
+
+std::string_view SharedArchive::GetStringView(uint32_t Offset) const {
+    if(Offset == 0) return {};
+
+    uint32_t Length;
+    memcpy(&Length, At(Offset), sizeof(uint32_t));
+    return std::string_view(At(Offset + sizeof(uint32_t)), Length);
+}
+
+/**
+ * Map an archive, and check that it's still accurate.
+ * @param Filename the archive
+ * @param ClassPath the ClassPath of this run; see ClassHeap#DescribeClassPath
+ * @return the archive, or null if it doesn't exist or is out of date.
+ */
+std::unique_ptr<SharedArchive> SharedArchive::Open(const std::string& Filename, const std::string& ClassPath) {
+    std::unique_ptr<SharedArchive> Archive(new SharedArchive());
+
+    if(!Archive->File.Open(Filename.c_str()) || Archive->File.GetSize() < sizeof(Header)) {
+        fprintf(stderr, "Unable to open shared archive %s; classes will be loaded from the ClassPath.\n", Filename.c_str());
+        return nullptr;
+    }
+
+    Header Top;
+    memcpy(&Top, Archive->At(0), sizeof(Header));
+
+    const char* Reason = nullptr;
+    if(memcmp(Top.Magic, Magic, sizeof(Magic)) != 0 || Top.Version != Version)
+        Reason = "it was written by a different version of Purpuri";
+    else if(Top.ReferenceSize != ObjectHeap::ReferenceSize())
+        Reason = "it was written with a different reference size";
+    else if(Archive->GetString(Top.ClassPath) != ClassPath)
+        Reason = "the ClassPath has changed";
+
+    auto* Classes = (const ArchivedClass*) Archive->At(Top.Classes);
+    for(size_t i = 0; Reason == nullptr && i < Top.ClassCount; i++) {
+        int64_t Time;
+        uint64_t Size;
+        if(!Stamp(Archive->GetString(Classes[i].Source), Time, Size) || Time != Classes[i].SourceTime || Size != Classes[i].SourceSize)
+            Reason = "a class file has changed";
+        else {
+            Archive->Classes.emplace(Archive->GetString(Classes[i].Name), &Classes[i]);
+            // Classes from a JAR all share its path, so only loose class files can be found this way.
+            std::string Source = Archive->GetString(Classes[i].Source);
+            if(std::filesystem::path(Source).extension() == ".class")
+                Archive->Sources.emplace(Source, &Classes[i]);
+        }
+    }
+
+    if(Reason != nullptr) {
+        fprintf(stderr, "Shared archive %s is out of date, as %s; classes will be loaded from the ClassPath.\n", Filename.c_str(), Reason);
+        return nullptr;
+    }
+
+    printf("Mapped " PrtSizeT " classes from shared archive %s\n", Archive->Classes.size(), Filename.c_str());
+    return Archive;
+}
+
+/**
+ * Load a class from the archive by its name.
+ * @param Name the class to load, as the Java Language names it
+ * @param Into the Class to load it into, which already knows its Class Heap
+ * @return false if the class isn't in the archive.
+ */
+bool SharedArchive::Load(const std::string& Name, Class* Into) {
+    auto Found = Classes.find(Name);
+    if(Found == Classes.end())
+        return false;
+
+    Restore(*Found->second, Into);
+    return true;
+}
+
+/**
+ * Load a class from the archive by the class file it was read from.
+ *
+ * The main class is asked for by its path (test/share/Shared), not by the name inside it (Shared), so a lookup by
+ *  name never finds it. The class file is the same either way, and the archive already knows where that is.
+ *
+ * @param Source the class file, as it appears on the ClassPath
+ * @param Into the Class to load it into, which already knows its Class Heap
+ * @return false if no class in the archive was read from that file.
+ */
+bool SharedArchive::LoadSource(const std::string& Source, Class* Into) {
+    auto Found = Sources.find(Source);
+    if(Found == Sources.end())
+        return false;
+
+    Restore(*Found->second, Into);
+    return true;
+}
+
+/**
+ * Put a class back together from the archive, in place of ParseFullClass and the layout half of Link.
+ *
+ * The class file, the field table, and the exception tables are used where they are in the archive.
+ * The Constants Pool, the method and attribute tables, and the strings are rebuilt from offsets; there's no parsing
+ *  involved, but they hold pointers, so they can't be stored as they are.
+ *
+ * @param From the class's record in the archive
+ * @param Into the Class to load it into
+ */
+void SharedArchive::Restore(const ArchivedClass& From, Class* Into) {
+    const char* Bytes = At(From.Bytes);
+
+    Into->Source = GetString(From.Source);
+    Into->Bytes = Bytes;
+    Into->Code = Bytes + From.BytesLength;
+    Into->BytecodeLength = From.BytesLength;
+    Into->Archived = true;
+    Into->ReadOnly = true;
+
+    Into->MagicNumber = From.MagicNumber;
+    Into->BytecodeVersionMajor = From.BytecodeVersionMajor;
+    Into->BytecodeVersionMinor = From.BytecodeVersionMinor;
+    Into->ConstantCount = From.ConstantCount;
+    Into->ClassAccess = From.ClassAccess;
+    Into->This = From.This;
+    Into->Super = From.Super;
+    Into->InterfaceCount = From.InterfaceCount;
+    Into->FieldsCount = From.FieldsCount;
+    Into->MethodCount = From.MethodCount;
+    Into->AttributeCount = From.AttributeCount;
+
+    // The Constants Pool is copied out, as the Symbols in it are different every run.
+    auto* Strings = (const uint32_t*) At(From.Strings);
+    Into->Constants = new ConstantPoolEntry[From.ConstantCount + 1];
+    memcpy((void*) Into->Constants, At(From.Constants), (From.ConstantCount + 1) * sizeof(ConstantPoolEntry));
+    for(size_t i = 0; i <= From.ConstantCount; i++) {
+        ConstantPoolEntry& Entry = Into->Constants[i];
+        Entry.Text = nullptr;
+
+        // The strings are interned straight out of the mapping. An empty UTF-8 constant still needs its Symbol.
+        if(Strings[i] != 0)
+            Entry.Text = SymbolTable::Intern(GetStringView(Strings[i]));
+        else if(Entry.Tag == TypeUtf8)
+            Entry.Text = SymbolTable::Intern("");
+    }
+
+    Into->Interfaces = new uint16_t[From.InterfaceCount];
+    memcpy(Into->Interfaces, At(From.Interfaces), From.InterfaceCount * sizeof(uint16_t));
+
+    auto* Fields = (FieldData*) At(From.Fields);
+    Into->Fields = new FieldData*[From.FieldsCount];
+    for(size_t i = 0; i < From.FieldsCount; i++)
+        Into->Fields[i] = &Fields[i];
+
+    auto* Statics = (const uint32_t*) At(From.StaticFields);
+    Into->ClassStatics = new Variable[From.FieldsCount];
+    Into->StaticFieldIndexes.assign(Statics, Statics + From.StaticFieldCount);
+    Into->StaticFieldCount = From.StaticFieldCount;
+    for(size_t Index : Into->StaticFieldIndexes)
+        Into->ClassStatics[Index] = Variable(ObjectHeap::Null);
+
+    auto* Methods = (const ArchivedMethod*) At(From.Methods);
+    Into->Methods = new Method[From.MethodCount];
+    for(size_t i = 0; i < From.MethodCount; i++) {
+        Method& To = Into->Methods[i];
+        To.Access = Methods[i].Access;
+        To.Name = Methods[i].Name;
+        To.Descriptor = Methods[i].Descriptor;
+        To.AttributeCount = Methods[i].AttributeCount;
+        To.Data = (MethodData*) (Bytes + Methods[i].Data);
+        To.Code = nullptr;
+
+        if(!Methods[i].HasCode) continue;
+
+        To.Code = new CodePoint;
+        To.Code->Name = Methods[i].CodeName;
+        To.Code->Length = Methods[i].Length;
+        To.Code->StackSize = Methods[i].StackSize;
+        To.Code->LocalsSize = Methods[i].LocalsSize;
+        To.Code->CodeLength = Methods[i].CodeLength;
+        To.Code->Code = Methods[i].Code == 0 ? nullptr : (uint8_t*) (Bytes + Methods[i].Code);
+        To.Code->ExceptionCount = Methods[i].ExceptionCount;
+        To.Code->Exceptions = Methods[i].ExceptionCount == 0 ? nullptr : (Exception*) At(Methods[i].Exceptions);
+    }
+
+    auto* Attributes = (const uint32_t*) At(From.Attributes);
+    Into->Attributes = new AttributeData*[From.AttributeCount];
+    for(size_t i = 0; i < From.AttributeCount; i++)
+        Into->Attributes[i] = (AttributeData*) (Bytes + Attributes[i]);
+
+    auto* FieldOffsets = (const uint32_t*) At(From.FieldOffsets);
+    auto* FieldTypes = (const uint8_t*) At(From.FieldTypes);
+    auto* ReferenceOffsets = (const uint32_t*) At(From.ReferenceOffsets);
+    Into->InstanceFieldCount = From.InstanceFieldCount;
+    Into->InstanceSize = From.InstanceSize;
+    Into->FieldOffsets.assign(FieldOffsets, FieldOffsets + From.FieldsCount);
+    Into->FieldTypes.assign(FieldTypes, FieldTypes + From.FieldsCount);
+    Into->ReferenceOffsets.assign(ReferenceOffsets, ReferenceOffsets + From.ReferenceCount);
+
+    // The indexes are keyed on Symbols, which are different every run, so they're built again.
+    Into->BuildIndexes();
+
+    printf("Loaded class %s from the shared archive\n", GetString(From.Name).c_str());
+}
+
+namespace {
+
+    /**
+     * Builds the archive in memory, a piece at a time.
+     * Every piece is aligned to 8 bytes, so that anything in the archive can be read in place once it's mapped.
+     */
+    class ArchiveWriter {
+        public:
+            std::vector<char> Buffer;
+
+            uint32_t Append(const void* Data, size_t Size) {
+                Buffer.resize((Buffer.size() + 7) & ~(size_t) 7);
+                auto Offset = (uint32_t) Buffer.size();
+                Buffer.insert(Buffer.end(), (const char*) Data, (const char*) Data + Size);
+                return Offset;
+            }
+
+            uint32_t Reserve(size_t Size) {
+                std::vector<char> Zero(Size);
+                return Append(Zero.data(), Size);
+            }
+
+            uint32_t String(const std::string& Text) {
+                if(Text.empty()) return 0;
+
+                auto Length = (uint32_t) Text.size();
+                uint32_t Offset = Append(&Length, sizeof(uint32_t));
+                Buffer.insert(Buffer.end(), Text.begin(), Text.end());
+                return Offset;
+            }
+
+            template<typename T>
+            uint32_t Array(const std::vector<T>& Items) {
+                return Append(Items.data(), Items.size() * sizeof(T));
+            }
+
+            template<typename T>
+            T* Get(uint32_t Offset) { return (T*) (Buffer.data() + Offset); }
+    };
+}
+
+/**
+ * Write every class in the Class Heap to an archive.
+ *
+ * Classes that weren't loaded from a file can't be checked for changes later, so they're left out, as are classes
+ *  that didn't load properly.
+ *
+ * @param Filename where to write the archive
+ * @param ClassPath the ClassPath of this run; see ClassHeap#DescribeClassPath
+ * @param Heap the classes to write
+ * @return whether the archive was written.
+ */
+bool SharedArchive::Write(const std::string& Filename, const std::string& ClassPath, ClassHeap& Heap) {
+    ArchiveWriter Out;
+
+    uint32_t TopOffset = Out.Reserve(sizeof(Header));
+    uint32_t PathOffset = Out.String(ClassPath);
+
+    std::vector<ArchivedClass> Records;
+    // JARs are only opened once each, however many classes come from them.
+    std::unordered_map<std::string, std::unique_ptr<JarFile>> Jars;
+
+    for(Class* Klass : Heap.GetAllClasses()) {
+        if(Klass->Source.empty() || Klass->Bytes == nullptr) continue;
+
+        ArchivedClass Record {};
+        if(!Stamp(Klass->Source, Record.SourceTime, Record.SourceSize)) continue;
+
+        // Read the class file again, as it was before the VM quickened anything in it.
+        const char* Original = nullptr;
+        size_t Length = 0;
+        MappedFile Loose;
+        std::string Name = Klass->GetClassName();
+        std::filesystem::path Source(Klass->Source);
+
+        if(Source.extension() == ".class") {
+            if(Loose.Open(Klass->Source.c_str())) {
+                Original = Loose.GetData();
+                Length = Loose.GetSize();
+            }
+        } else {
+            auto& Jar = Jars[Klass->Source];
+            if(Jar == nullptr) {
+                Jar.reset(new JarFile());
+                if(!Jar->Open(Klass->Source)) continue;
+            }
+
+            Original = Jar->Find(Name, Length);
+        }
+
+        if(Original == nullptr || Length != Klass->BytecodeLength) continue;
+
+        const char* Bytes = Klass->Bytes;
+        auto OffsetOf = [Bytes](const void* Pointer) { return (uint32_t) ((const char*) Pointer - Bytes); };
+
+        Record.Name = Out.String(Name);
+        Record.Source = Out.String(Klass->Source);
+        Record.Bytes = Out.Append(Original, Length);
+        Record.BytesLength = (uint32_t) Length;
+
+        Record.MagicNumber = Klass->MagicNumber;
+        Record.BytecodeVersionMajor = Klass->BytecodeVersionMajor;
+        Record.BytecodeVersionMinor = Klass->BytecodeVersionMinor;
+        Record.ConstantCount = Klass->ConstantCount;
+        Record.ClassAccess = Klass->ClassAccess;
+        Record.This = Klass->This;
+        Record.Super = Klass->Super;
+        Record.InterfaceCount = Klass->InterfaceCount;
+        Record.FieldsCount = Klass->FieldsCount;
+        Record.MethodCount = Klass->MethodCount;
+        Record.AttributeCount = Klass->AttributeCount;
+
+        // Constant 0 doesn't exist, and neither does the one past the end; they're kept so the arrays line up.
+        // Symbols are only pointers, so their text goes in Strings instead.
+        std::vector<ConstantPoolEntry> Constants(Klass->Constants, Klass->Constants + Klass->ConstantCount + 1);
+        std::vector<uint32_t> Strings(Klass->ConstantCount + 1, 0);
+        for(size_t i = 0; i < Constants.size(); i++) {
+            if(Constants[i].Text != nullptr)
+                Strings[i] = Out.String(Constants[i].Text->Text);
+            Constants[i].Text = nullptr;
+        }
+
+        Record.Constants = Out.Array(Constants);
+        Record.Strings = Out.Array(Strings);
+        Record.Interfaces = Out.Append(Klass->Interfaces, Klass->InterfaceCount * sizeof(uint16_t));
+
+        std::vector<FieldData> Fields;
+        for(size_t i = 0; i < Klass->FieldsCount; i++) {
+            Fields.emplace_back(*Klass->Fields[i]);
+            Fields.back().Attributes = nullptr;
+        }
+        Record.Fields = Out.Array(Fields);
+
+        std::vector<uint32_t> Statics(Klass->StaticFieldIndexes.begin(), Klass->StaticFieldIndexes.end());
+        Record.StaticFields = Out.Array(Statics);
+        Record.StaticFieldCount = (uint32_t) Statics.size();
+
+        std::vector<ArchivedMethod> Methods(Klass->MethodCount);
+        for(size_t i = 0; i < Klass->MethodCount; i++) {
+            Method& From = Klass->Methods[i];
+            ArchivedMethod& To = Methods[i];
+            To.Access = From.Access;
+            To.Name = From.Name;
+            To.Descriptor = From.Descriptor;
+            To.AttributeCount = From.AttributeCount;
+            To.Data = OffsetOf(From.Data);
+
+            if(From.Code == nullptr) continue;
+
+            To.HasCode = 1;
+            To.CodeName = From.Code->Name;
+            To.Length = From.Code->Length;
+            To.StackSize = From.Code->StackSize;
+            To.LocalsSize = From.Code->LocalsSize;
+            To.CodeLength = From.Code->CodeLength;
+            To.Code = From.Code->Code == nullptr ? 0 : OffsetOf(From.Code->Code);
+            To.ExceptionCount = From.Code->ExceptionCount;
+            if(To.ExceptionCount > 0)
+                To.Exceptions = Out.Append(From.Code->Exceptions, To.ExceptionCount * sizeof(Exception));
+        }
+        Record.Methods = Out.Array(Methods);
+
+        std::vector<uint32_t> Attributes;
+        for(size_t i = 0; i < Klass->AttributeCount; i++)
+            Attributes.emplace_back(OffsetOf(Klass->Attributes[i]));
+        Record.Attributes = Out.Array(Attributes);
+
+        Record.InstanceFieldCount = Klass->InstanceFieldCount;
+        Record.InstanceSize = Klass->InstanceSize;
+        Record.FieldOffsets = Out.Array(Klass->FieldOffsets);
+        Record.FieldTypes = Out.Array(Klass->FieldTypes);
+        Record.ReferenceOffsets = Out.Array(Klass->ReferenceOffsets);
+        Record.ReferenceCount = (uint32_t) Klass->ReferenceOffsets.size();
+
+        Records.emplace_back(Record);
+    }
+
+    Header* Top = Out.Get<Header>(TopOffset);
+    memcpy(Top->Magic, Magic, sizeof(Magic));
+    Top->Version = Version;
+    Top->ReferenceSize = (uint32_t) ObjectHeap::ReferenceSize();
+    Top->ClassPath = PathOffset;
+    Top->ClassCount = (uint32_t) Records.size();
+    // Appending the classes may move the buffer, so Top can't be used after this.
+    uint32_t ClassesOffset = Out.Array(Records);
+    Out.Get<Header>(TopOffset)->Classes = ClassesOffset;
+
+    std::ofstream File(Filename, std::ios::binary | std::ios::trunc);
+    File.write(Out.Buffer.data(), (std::streamsize) Out.Buffer.size());
+    if(!File.good()) {
+        fprintf(stderr, "Unable to write shared archive %s.\n", Filename.c_str());
+        return false;
+    }
+
+    fprintf(stderr, "Wrote " PrtSizeT " classes to shared archive %s.\n", Records.size(), Filename.c_str());
+    return true;
+}
@@ -12,6 +12,16 @@
 #include <string>
 #include <limits>
 
+#if defined WIN32
+    #include <windows.h>
+    #undef GetClassName
+    #undef LoadLibrary
+    #undef GetObject
+#elif defined linux || defined __APPLE__
+    #include <sys/mman.h>
+    #include <unistd.h>
+#endif
+
 /**
  * This file implements the Class class, declared in Common.hpp.
  *
@@ -50,62 +60,98 @@ Class::Class() : ClassFile(), BytecodeLength(0), Code(nullptr), _ClassHeap(nullp
 Class::~Class() = default;
 
 /**
- * A simple wrapper that reads all the bytes in a file and loads it as a Java class.
+ * Map a class file into memory and load it as a Java class.
  *
  * If the file does not exist, false is returned to indicate an error.
  *
- * Once the file is read correctly, SetCode is called to parse the bytecode.
+ * The file is mapped read-only rather than read into a buffer. Nothing is copied out of it; the parsed structures
+ *  live on their own, and point into the mapping for everything else - constants, attributes, and the bytecode of
+ *  every method, which runs straight out of the file.
+ * The mapping is private, so pages that are never written stay shared with the page cache, and with every other
+ *  process that has the same class file open. Only the pages that quickening rewrites get a copy of their own;
+ *  see Class#RewriteCode.
+ *
+ * Once the file is mapped, LoadFromMemory is called to parse the bytecode.
  * @param Filename the name of the Class file to load.
  * @return true if the file was loaded successfully, false otherwise.
  */
 
 bool Class::LoadFromFile(const char* Filename) {
-    char* LocalCode;
-
-    // Start the file at-the-end (ate) so that we can skip a stat
-    std::ifstream File(Filename, std::ios::binary | std::ios::ate);
-
-    // Make sure the file exists.
-    if(!File.is_open()) {
-        printf("Unable to open class file: %s\n", Filename);
+    // An empty file can't be mapped, and wouldn't be a class if it could.
+    if(!File.Open(Filename)) {
+        printf("Unable to open class file, or class file is empty: %s\n", Filename);
         return false;
     }
 
-    // Read the size of the file.
-    std::streamsize FileSize = File.tellg();
-    // Return to the start so that we can actually read the data.
-    File.seekg(0);
-
-    // tellg returns -1 if something went wrong reading the file data, so we need to handle that.
-    if(FileSize == -1) {
-        puts("Class file is empty or corrupt");
-        return false;
-    }
-
-    // The bytecode is stored on-heap. Allocate it, and read from the file.
-    LocalCode = (char*) new char[FileSize + 2];
-    File.read(&LocalCode[0], FileSize);
-
-    File.close();
-
-    // If the data was read correctly, we need to call out and parse the bytecode.
-    LocalCode[FileSize] = 0;
-    BytecodeLength = FileSize;
-    SetCode(LocalCode);
+    // The mapping lasts as long as the class does.
+    return LoadFromMemory(File.GetData(), File.GetSize(), true);
+}
 
-    return true;
+/**
+ * Load a Java class from a class file that's already in memory; ie. inside a JAR. See JarFile#Find.
+ * The bytes aren't copied, so they have to last as long as the class does.
+ * @param Bytes the class file
+ * @param Length the size of the class file
+ * @param p_ReadOnly whether the class file is in a read-only mapping; see RewriteCode
+ * @return true if the class was loaded successfully.
+ */
+bool Class::LoadFromMemory(const char* Bytes, size_t Length, bool p_ReadOnly) {
+    BytecodeLength = Length;
+    ReadOnly = p_ReadOnly;
+    return SetCode(Bytes);
 }
 
 /**
  * A simple wrapper that overrides the bytecode stored in the current class.
+ * The class doesn't take ownership of the bytecode; the parsed class points into it, so it has to outlive the class.
  * @param p_Code the new bytecode to read
+ * @return whether the class was parsed properly. If not, the class is only partly filled in, and must not be used.
  */
-void Class::SetCode(const char* p_Code) {
-    // Code is stored on-heap, so make sure to free the old array when we load a new one
-    delete Code;
+bool Class::SetCode(const char* p_Code) {
+    Bytes = p_Code;
     Code = p_Code;
 
-    if(Code) ParseFullClass();
+    return Code != nullptr && ParseFullClass();
+}
+
+/**
+ * Overwrite one byte of a method's code in this class, for quickening an instruction in place.
+ *
+ * Code usually runs straight out of a mapping; the class file, the JAR it's stored in, or the Shared Archive.
+ * Those are read-only, so the page holding the byte is made writable for the write, and read-only again after it;
+ *  anything else that writes to the class file still faults. Since the mapping is private, the first write gives
+ *  this process its own copy of that page, and the file and every other process's view of it are left alone.
+ * A class that was inflated out of a JAR is in ordinary memory, and is written as it is.
+ *
+ * The VM can't carry on with code it can't quicken, so failing to change the protection is fatal.
+ *
+ * @param At the byte to overwrite, inside the Code of one of this class' methods.
+ * @param Value the new byte.
+ */
+void Class::RewriteCode(uint8_t* At, uint8_t Value) {
+    if(!ReadOnly) {
+        *At = Value;
+        return;
+    }
+
+    #ifdef WIN32
+        DWORD Old;
+        bool Writable = VirtualProtect(At, 1, PAGE_WRITECOPY, &Old);
+        if(Writable) *At = Value;
+        bool Restored = Writable && VirtualProtect(At, 1, Old, &Old);
+    #elif defined linux || defined __APPLE__
+        static const uintptr_t PageSize = (uintptr_t) sysconf(_SC_PAGESIZE);
+        void* Page = (void*) ((uintptr_t) At & ~(PageSize - 1));
+        bool Writable = mprotect(Page, PageSize, PROT_READ | PROT_WRITE) == 0;
+        if(Writable) *At = Value;
+        bool Restored = Writable && mprotect(Page, PageSize, PROT_READ) == 0;
+    #endif
+
+    if(!Restored) {
+        fprintf(stderr, "Unable to %s the code of class %s to quicken it. Fatal error.\n",
+                Writable ? "protect" : "unprotect", GetClassName().c_str());
+        exit(6);
+    }
 }
 
 /**
@@ -256,8 +302,10 @@ bool Class::ParseFullClass() {
 
     ConstantCount = ReadShortFromStream(Code); Code += 2;
 
-    if(ConstantCount > 0)
-        ParseConstants(Code);
+    if(ConstantCount > 0 && !ParseConstants(Code)) {
+        puts("Unable to parse the Constants Pool.");
+        return false;
+    }
 
     ClassAccess = ReadShortFromStream(Code); Code += 2;
 
@@ -267,106 +315,54 @@ bool Class::ParseFullClass() {
 
     InterfaceCount = ReadShortFromStream(Code); Code += 2;
 
-    if(InterfaceCount > 0)
-        ParseInterfaces(Code);
+    if(InterfaceCount > 0 && !ParseInterfaces(Code)) {
+        puts("Unable to parse the Interfaces.");
+        return false;
+    }
 
     FieldsCount = ReadShortFromStream(Code); Code += 2;
 
     ClassStatics = new Variable[FieldsCount];
 
-    if(FieldsCount > 0) {
-        ParseFields(Code);
+    if(FieldsCount > 0 && !ParseFields(Code)) {
+        puts("Unable to parse the Fields.");
+        return false;
     }
 
     MethodCount = ReadShortFromStream(Code); Code += 2;
 
-    if(MethodCount > 0)
-        ParseMethods(Code);
+    if(MethodCount > 0 && !ParseMethods(Code)) {
+        puts("Unable to parse the Methods.");
+        return false;
+    }
 
     AttributeCount = ReadShortFromStream(Code); Code += 2;
 
-    if(AttributeCount > 0)
-        ParseAttribs(Code);
-
-    // This is a big no-no!
-    // Java's classloader normally only attempts to load a class when it is actually required.
-    // This way, it saves on class heap space in large programs.
+    if(AttributeCount > 0 && !ParseAttribs(Code)) {
+        puts("Unable to parse the class Attributes.");
+        return false;
+    }
 
-    // Purpuri chooses to search through all classes in this class' Constants Pool, and load them all.
-    // This is extremely expensive, and wasteful!
-    // However, I'm still unsure how to do it the "proper" way, so this remains as a permanently temporary hack.
+    BuildIndexes();
 
-    ClassloadReferents();
+    // Nothing this class refers to is loaded here; each class is loaded the first time it's used.
+    // See ClassHeap#GetClass.
 
     return true;
 }
 
 /**
- * As mentioned directly above, we go against Java Specification here.
- * We should only be classloading as soon as they're referenced.
- * There's no easy way to do that, primarily because of interfaces.
- *
- * Instead, I iterate the constants pool and search for all references to another Class.
- * This is, as mentioned, extremely wasteful.
- *
- * This whole section should be refactored, ideally removed.
+ * Fill in the Member Indexes, so that methods and fields can be found by the Symbols of their name and descriptor.
+ * See Symbols.cpp.
  */
-void Class::ClassloadReferents() {
-
-    printf("Searching for unloaded classes referenced by the current.\n");
-
-    // We need to make sure we load String if there are any interned strings stored in this class.
-    bool NeedsString = false;
-
-    // For each constant stored..
-    for(int i = 1; i < ConstantCount; i++) {
-        if(Constants == nullptr) return;
-        if(Constants[i] == nullptr) continue;
-
-        // Check if it's a string. If so, we need to classload the String class so that we can use it later.
-        if(Constants[i]->Tag == TypeString)
-            NeedsString = true;
-
-        // Check if it's a Class. If so, we need to check if it's loaded, and load it if it isn't already.
-        else if(Constants[i]->Tag == TypeClass) {
-            // There's no good way to read an int from a char*, so we need to temporarily store it and ReadShort.
-            auto ClassInd = ReadShortFromStream((char*)Constants[i] + 1);
-
-            // GetStringConstant is implemented in Constants.cpp.
-            std::string ClassName = GetStringConstant(ClassInd);
-
-            // We need to NOT try to classload, if we're looking at an array type.
-            if(ClassName.find_first_of('[') == 0) continue;
-
-            printf("\tName %s", ClassName.c_str());
-
-            // We can guarantee that the Super Class and This Class are already loaded.
-            // We also don't want to try to load classes twice, so we check the Class Cache in the Class Heap.
-            // The Class Cache isn't set while a class is loading, so if we find ourself in a dependency loop,
-            //  we need to also check the ClassHeap itself for nullptr values.
-            // If it's nullptr, we're in the process of loading it (through that class' ClassloadReferents) so skip it.
-            if(i != Super && i != This && (!this->_ClassHeap->ClassExists(ClassName) && this->_ClassHeap->GetClass(ClassName) == nullptr)) {
-                printf("\tClass is not loaded - invoking the classloader\n");
-                auto* Class = new class Class();
-
-                // Note that this is potentially re-entrant; LoadClass calls LoadFromFile, which eventually calls ClassloadReferents.
-                if(!this->_ClassHeap->LoadClass(ClassName.c_str(), Class)) {
-                    printf("Classloading referenced class %s failed. Fatal error.\n", ClassName.c_str());
-                    exit(6);
-                }
-            } else {
-                printf(" - clear\n");
-            }
-        }
-    }
-
-    
-    if(NeedsString) {
-        if(!this->_ClassHeap->LoadClass("java/lang/String", new Class)) {
-            printf("Classloading referenced class %s failed. Fatal error.\n", "java/lang/String");
-            exit(6);
-        }
-    }
+void Class::BuildIndexes() {
+    MethodIndex.Reserve(MethodCount);
+    for(uint16_t i = 0; i < MethodCount; i++)
+        MethodIndex.Add(GetSymbol(Methods[i].Name), GetSymbol(Methods[i].Descriptor), i);
+
+    FieldIndex.Reserve(FieldsCount);
+    for(uint16_t i = 0; i < FieldsCount; i++)
+        FieldIndex.Add(GetSymbol(Fields[i]->Name), GetSymbol(Fields[i]->Descriptor), i);
 }
 
 /**
@@ -444,11 +440,8 @@ bool Class::ParseInterfaces(const char* &ClassCode) {
         Interfaces[i] = ReadShortFromStream(ClassCode);
         ClassCode += 2; // We're now ready for the next iteration, but let's log something.
 
-        // Read the name from the Class data.
-        auto NameInd = ReadShortFromStream((char*) Constants[Interfaces[i]] + 1);
-
         // Print out the name of the interface.
-        printf("\tThis class implements interface %s\n", GetStringConstant(NameInd).c_str());
+        printf("\tThis class implements interface %s\n", GetStringConstant(Interfaces[i]).c_str());
     }
 
     return true;
@@ -536,23 +529,23 @@ bool Class::ParseMethods(const char *&ClassCode) {
         // Declarations (with no annotations, at least) have no attributes.
         // Safeguard everything behind a check.
         if(Methods[i].AttributeCount > 0) {
-            // We don't need any of this, it's just good for debug printing.
-            // So, we can skip it all if we're in quiet mode.
-            if (!Engine::QuietMode)
-                for(int j = 0; j < Methods[i].AttributeCount; j++) {
-                    printf("\tParsing attribute %d\n", j);
-                    auto AttrNameInd = ReadShortFromStream(ClassCode); ClassCode += 2;
-                    size_t AttrLength = ReadIntFromStream(ClassCode); ClassCode += 4;
-                    ClassCode += AttrLength; // Skip to the next Attribute for the next loop
-
-                    std::string AttrName = GetStringConstant(AttrNameInd);
-                    printf("\tAttribute has name %s, length " PrtSizeT "\n", AttrName.c_str(), AttrLength);
-                }
+            // The attributes are parsed properly below, but we still have to step over them here,
+            //  even in quiet mode, or the next method would be read out of the middle of this one.
+            for(int j = 0; j < Methods[i].AttributeCount; j++) {
+                printf("\tParsing attribute %d\n", j);
+                auto AttrNameInd = ReadShortFromStream(ClassCode); ClassCode += 2;
+                size_t AttrLength = ReadIntFromStream(ClassCode); ClassCode += 4;
+                ClassCode += AttrLength; // Skip to the next Attribute for the next loop
+
+                printf("\tAttribute has name %s, length " PrtSizeT "\n", GetStringConstant(AttrNameInd).c_str(), AttrLength);
+                SHUTUPUNUSED(AttrNameInd);
+            }
 
             // We need to spin out to another method to parse the Code Point,
             // in the sake of code cleanliness and linearity.
             Methods[i].Code = new CodePoint;
-            ParseMethodCodePoints(i, Methods[i].Code);
+            if(!ParseMethodCodePoints(i, Methods[i].Code))
+                return false;
         }
     }
 
@@ -654,14 +647,10 @@ bool Class::ParseMethodCodePoints(int Method, CodePoint *MethodCode) {
             // This is technically malformed classes, but the spec changed with Java 8 to make this
             // javac bug part of the specification.
             // Oracle.
-            if((AttribName == "MethodCode" && MethodCode->CodeLength > 0)) {
-                // Allocate and copy the data out of the class file so that we can use it later.
-                MethodCode->Code = new uint8_t[MethodCode->CodeLength];
-                memcpy(MethodCode->Code, AttribCode, MethodCode->CodeLength);
-            } else if ((AttribName == "Code" && MethodCode->Length > 0)) {
-                // Allocate and copy the data out of the class file so that we can use it later.
-                MethodCode->Code = new uint8_t[MethodCode->Length];
-                memcpy(MethodCode->Code, AttribCode, MethodCode->Length);
+            if((AttribName == "MethodCode" && MethodCode->CodeLength > 0) || (AttribName == "Code" && MethodCode->Length > 0)) {
+                // The bytecode is run where it sits in the class file. Nothing writes to it except quickening,
+                //  which goes through RewriteCode.
+                MethodCode->Code = (uint8_t*) AttribCode;
             } else {
                 MethodCode->Code = nullptr;
             }
@@ -728,10 +717,12 @@ bool Class::ParseFields(const char* &ClassCode) {
     Fields = new FieldData*[FieldsCount];
     if(Fields == nullptr) return false;
 
+    // The class file is mapped read-only, so the fields are decoded into a table of their own.
+    FieldData* FieldTable = new FieldData[FieldsCount];
+
     // For each Field..
     for(size_t i = 0; i < FieldsCount; i++) {
-        // Store an index to the data - it's guaranteed to be valid.
-        Fields[i] = (FieldData*) ClassCode;
+        Fields[i] = &FieldTable[i];
 
         // Populate some member variables so we have an excuse to increase the code pointer
         Fields[i]->Access = ReadShortFromStream(ClassCode); ClassCode += 2;
@@ -745,7 +736,9 @@ bool Class::ParseFields(const char* &ClassCode) {
             // Store that we have a static field here.
             StaticFieldIndexes.emplace_back(i);
             // Initialize the field to Null - it's the default.
-            PutStatic(i, Variable(ObjectHeap::Null));
+            // This is written directly rather than through PutStatic; the class may be parsed on a loader thread,
+            //  before the Class Heap knows about it.
+            ClassStatics[i] = Variable(ObjectHeap::Null);
         }
 
         // Handle attributes too, even though we don't use them.
@@ -782,6 +775,30 @@ bool Class::ParseFields(const char* &ClassCode) {
  */
 
 uint32_t Class::GetMethodFromDescriptor(const char *MethodName, const char *Descriptor, const char* ClassName, Class *&pClass) {
+    // If any of these were never interned, then no class loaded so far could possibly have the method.
+    Symbol* Name = SymbolTable::Find(MethodName);
+    Symbol* Desc = SymbolTable::Find(Descriptor);
+    Symbol* Owner = SymbolTable::Find(ClassName);
+
+    if(Name == nullptr || Desc == nullptr || Owner == nullptr) {
+        printf("No loaded class has a method %s%s in class %s.\n", MethodName, Descriptor, ClassName);
+        return std::numeric_limits<uint32_t>::max();
+    }
+
+    return GetMethodFromDescriptor(Name, Desc, Owner, pClass);
+}
+
+/**
+ * The same search as above, for Symbols that are already at hand; such as those from a Constants Pool.
+ * Each class is searched through its Method Index, so nothing here compares strings. See Symbols.cpp.
+ *
+ * @param MethodName the name of the Method to search for
+ * @param Descriptor the descriptor (parameters, return value) of the Method to search for
+ * @param ClassName the name of the Class we expect to find it in
+ * @param pClass the Class to search for the method in
+ * @return the index of the method, invokable
+ */
+uint32_t Class::GetMethodFromDescriptor(Symbol* MethodName, Symbol* Descriptor, Symbol* ClassName, Class *&pClass) {
     // Some code paths call this method early.
     // Notably, where errors occured during classloading and we try to find <clinit> or EntryPoint.
     // This block should be removed once the VM stabilizes.
@@ -790,55 +807,39 @@ uint32_t Class::GetMethodFromDescriptor(const char *MethodName, const char *Desc
         return std::numeric_limits<uint32_t>::max();
     }
 
+    if(MethodName == nullptr || Descriptor == nullptr || ClassName == nullptr)
+        return std::numeric_limits<uint32_t>::max();
+
     // We need to recursively search up the class hierarchy to see where the method we want exists.
     // The simplest way to do that is to store a reference and update it each time we move up a class.
     class Class* CurrentClass = pClass;
-    std::string ClassNameStr(ClassName);
 
     while(CurrentClass) {
-        std::string MethodClass = CurrentClass->GetClassName();
-        printf("Searching class %s for %s%s\n", MethodClass.c_str(), MethodName, Descriptor);
+        printf("Searching class %s for %s%s\n", CurrentClass->GetClassName().c_str(), MethodName->Text.c_str(), Descriptor->Text.c_str());
+
+        // The Class constant holds the same Symbol as the name it points to.
+        bool ClassMatches = CurrentClass->GetSymbol(CurrentClass->This) == ClassName;
 
         // We also need to make sure we check the interfaces that each class implements - we can find default
         // implementations there.
-        // Therefore, we quickly round up every interface that is implemented.
-        std::list<std::string> InterfaceNames;
-        if(CurrentClass->InterfaceCount > 0) {
-            for(size_t iface = 0; iface < CurrentClass->InterfaceCount; iface++) {
-                uint16_t interface = CurrentClass->Interfaces[iface];
-
-                auto NameInd = ReadShortFromStream((char*) CurrentClass->Constants[interface] + 1);
-
-                std::string IfaceName = GetStringConstant(NameInd);
-                InterfaceNames.emplace_back(IfaceName);
-            }
-        }
+        for(size_t iface = 0; iface < CurrentClass->InterfaceCount && !ClassMatches; iface++) {
+            Symbol* Interface = CurrentClass->GetSymbol(CurrentClass->Interfaces[iface]);
+            printf("Class implements interface %s\n", Interface == nullptr ? ClassHeap::UnknownClass.c_str() : Interface->Text.c_str());
 
-        if(!InterfaceNames.empty()) {
-            printf("Class implements interfaces ");
-            PrintList(InterfaceNames);
-            printf("\n");
+            ClassMatches = Interface == ClassName;
         }
 
         // We can now search the methods in the class.
-        for(int i = 0; i < CurrentClass->MethodCount; i++) {
-            // Some quick debug printing
-            std::string CurrentName = CurrentClass->GetStringConstant(CurrentClass->Methods[i].Name);
-            std::string CurrentDescriptor = CurrentClass->GetStringConstant(CurrentClass->Methods[i].Descriptor);
-            printf("\t\tExamining class %s for %s%s, access %d\r\n", MethodClass.c_str(), CurrentName.c_str(), CurrentDescriptor.c_str(), CurrentClass->ClassAccess);
-
-            // We have the method implementation if:
-            //  - the method name and method descriptor match, in the class we expected to search
-            //  - the method name and method descriptor match, and the class we expected to search was an interface
-            // This handles the case where the implementation is in ThingImpl, but we wanted the method from IThing.
-
-            if(((CurrentName == MethodName) && (CurrentDescriptor == Descriptor)) &&
-                ((MethodClass == ClassName) || (std::find(InterfaceNames.begin(), InterfaceNames.end(), ClassNameStr) != InterfaceNames.end()) )) {
-                if(pClass) pClass = CurrentClass;
-
-                printf("Found at index %d\n", i);
-                return i;
-            }
+        // We have the method implementation if:
+        //  - the method name and method descriptor match, in the class we expected to search
+        //  - the method name and method descriptor match, and the class we expected to search was an interface
+        // This handles the case where the implementation is in ThingImpl, but we wanted the method from IThing.
+        uint16_t Found = ClassMatches ? CurrentClass->MethodIndex.Find(MethodName, Descriptor) : MemberIndex::None;
+        if(Found != MemberIndex::None) {
+            if(pClass) pClass = CurrentClass;
+
+            printf("Found at index %d\n", Found);
+            return Found;
         }
 
         // If all of that searching showed nothing, we need to try again with the method's super.
@@ -853,33 +854,282 @@ uint32_t Class::GetMethodFromDescriptor(const char *MethodName, const char *Desc
     return std::numeric_limits<uint32_t>::max();
 }
 
+/**
+ * Find the class that declares a method, starting from this class and working up through its super classes.
+ * This is the lookup for static methods, which are inherited but never overridden.
+ *
+ * @param Name the name of the method
+ * @param Descriptor the descriptor of the method
+ * @param Method set to the index of the method in the class that declares it
+ * @return the class that declares the method, or nullptr if none does.
+ */
+Class* Class::FindMethod(Symbol* Name, Symbol* Descriptor, uint16_t& Method) {
+    for(Class* Current = this; Current != nullptr; Current = Current->GetSuper()) {
+        uint16_t Found = Current->MethodIndex.Find(Name, Descriptor);
+        if(Found != MemberIndex::None) {
+            Method = Found;
+            return Current;
+        }
+    }
+
+    return nullptr;
+}
+
+/**
+ * Resolve a Method constant in this class' Constants Pool to the class that declares the method, and the method.
+ *
+ * As with fields, the constant names the class to start searching from, which may not be the class that declares it.
+ * ie. for class B extends A, B.m() may call a static method m that is declared in A. It's A that has to be
+ *  initialized for the call, not B.
+ *
+ * The result never changes, so it's cached by Constants Pool index and only worked out on first use.
+ * invokestatic_quick reads it straight from the cache.
+ *
+ * A method that can't be found is fatal, as with ResolveField.
+ *
+ * @param Index the index of a Method constant
+ * @return where the constant leads.
+ */
+const ResolvedMethod& Class::ResolveMethod(uint16_t Index) {
+    if(!Linked) Link();
+
+    ResolvedMethod& Cached = ResolvedMethods.at(Index);
+    if(Cached.Owner != nullptr)
+        return Cached;
+
+    const MemberReference& Member = Constants[Index].Member;
+    const std::string& ClassName = GetStringConstant(Member.Class);
+    Symbol* Name = GetSymbol(Member.Name);
+    Symbol* Descriptor = GetSymbol(Member.Descriptor);
+
+    Class* Start = _ClassHeap->GetClass(ClassName);
+    if(Start == nullptr) {
+        fprintf(stderr, "Unable to load class %s to invoke %s%s. Fatal error.\n", ClassName.c_str(),
+                Name->Text.c_str(), Descriptor->Text.c_str());
+        exit(6);
+    }
+
+    uint16_t Method;
+    Class* Owner = Start->FindMethod(Name, Descriptor, Method);
+    if(Owner == nullptr) {
+        fprintf(stderr, "Unable to find method %s%s in class %s. Fatal error.\n", Name->Text.c_str(),
+                Descriptor->Text.c_str(), ClassName.c_str());
+        exit(7);
+    }
+
+    Cached.Owner = Owner;
+    Cached.Method = Method;
+    Cached.Parameters = Engine::GetParameters(Descriptor->Text.c_str());
+    Cached.Returns = Descriptor->Text.back() != 'V';
+    return Cached;
+}
+
+/**
+ * Linking is the step between loading a class and using it.
+ * Everything that would otherwise be worked out by name on every allocation or field access is worked out once here:
+ *  - The super class and interfaces are looked up in the Class Heap, and kept as pointers
+ *  - The super class is linked first, since our layout continues on from its'
+ *  - Every instance field is given a byte offset in the Variable Data of an Object, after those of the super class
+ *
+ * Fields are packed at the width of their type, rather than taking a whole Variable each.
+ * References come first, so that the Collector finds them close together, and then the primitives from widest to
+ *  narrowest. That way, only the first field of each group can ever need padding to line up.
+ *
+ * So, for class B extends A, where A has fields int x and Object y, and B has field boolean z:
+ *  Bytes 0-7 are the class pointer, as always. y is at byte 8, x at byte 16, and z at byte 20.
+ *  That's 21 bytes, so an A takes three Variables and a B takes three Variables too.
+ * An A and a B agree on where x and y are, so a field never needs to be looked up in the Object's own class.
+ *
+ * Static fields don't live in Objects, so they keep their index into the statics.
+ *
+ * Classes are linked as soon as ClassHeap#GetClass loads them, which is what loads the super class and interfaces.
+ * The few classes that StartVM loads itself are linked together before anything runs.
+ * @return whether the class linked properly.
+ */
+bool Class::Link() {
+    if(Linked) return true;
+
+    // Set this first; a broken hierarchy could otherwise have us recurse forever.
+    Linked = true;
+    size_t UnlinkedSize = GetMetadataSize();
+    ResolvedFields.assign(ConstantCount, ResolvedField { nullptr, 0 });
+    ResolvedMethods.assign(ConstantCount, ResolvedMethod { nullptr, 0, 0, false });
+    AllocationTemplates.assign(ConstantCount, AllocationTemplate { { 0, 0 }, 0, 0 });
+    ResolvedStrings.assign(ConstantCount, ObjectHeap::Null);
+
+    // Intrinsics are picked out by the Method constant alone, so they're found once here rather than on every call.
+    ResolvedIntrinsics.assign(ConstantCount, nullptr);
+    for(uint16_t i = 1; i < ConstantCount; i++) {
+        const ConstantPoolEntry& Constant = Constants[i];
+        if(Constant.Tag == TypeMethod)
+            ResolvedIntrinsics[i] = Native::FindIntrinsic(GetSymbol(Constant.Member.Class),
+                                                          GetSymbol(Constant.Member.Name), GetSymbol(Constant.Member.Descriptor));
+    }
+
+    // Only java/lang/Object has no super class.
+    // If the super class is missing, we still lay out our own fields so that nothing reads past the end.
+    bool Success = true;
+    uint32_t Offset = sizeof(Variable);
+    if(!Archived) InstanceFieldCount = 0;
+    if(Super != 0) {
+        SuperClass = _ClassHeap->GetClass(GetSuperName());
+
+        if(SuperClass != nullptr) {
+            SuperClass->Link();
+            if(!Archived) {
+                Offset = SuperClass->InstanceSize;
+                InstanceFieldCount = SuperClass->InstanceFieldCount;
+                ReferenceOffsets = SuperClass->ReferenceOffsets;
+            }
+        } else {
+            printf("Unable to link class %s; super class %s is not loaded.\n", GetClassName().c_str(), GetSuperName().c_str());
+            Success = false;
+        }
+    }
+
+    for(size_t i = 0; i < InterfaceCount; i++) {
+        Class* Interface = _ClassHeap->GetClass(GetStringConstant(Interfaces[i]));
+
+        if(Interface != nullptr) {
+            Interface->Link();
+            InterfaceClasses.emplace_back(Interface);
+        }
+    }
+
+    // A class from the Shared Archive has already been laid out, and its super class with it.
+    if(Archived) {
+        Engine::_ObjectHeap.Metadata.Add(GetMetadataSize() - UnlinkedSize);
+        return Success;
+    }
+
+    // Work out the type of each field from the first character of its descriptor.
+    FieldOffsets.resize(FieldsCount);
+    FieldTypes.resize(FieldsCount);
+    for(size_t i = 0; i < FieldsCount; i++) {
+        switch(GetStringConstant(Fields[i]->Descriptor)[0]) {
+            case 'Z': FieldTypes[i] = ArrayBoolean; break;
+            case 'B': FieldTypes[i] = ArrayByte; break;
+            case 'C': FieldTypes[i] = ArrayChar; break;
+            case 'S': FieldTypes[i] = ArrayShort; break;
+            case 'I': FieldTypes[i] = ArrayInt; break;
+            case 'F': FieldTypes[i] = ArrayFloat; break;
+            case 'J': FieldTypes[i] = ArrayLong; break;
+            case 'D': FieldTypes[i] = ArrayDouble; break;
+            default:  FieldTypes[i] = FieldReference; break;
+        }
+
+        // 0x8 is ACCESS_STATIC.
+        if(Fields[i]->Access & 0x8)
+            FieldOffsets[i] = i;
+    }
+
+    // Lay out the instance fields; references, then 8, 4, 2 and 1 byte primitives.
+    for(size_t Group = 0; Group < 5; Group++) {
+        size_t Size = Group == 0 ? ObjectHeap::ReferenceSize() : (size_t) 8 >> (Group - 1);
+
+        for(size_t i = 0; i < FieldsCount; i++) {
+            if(Fields[i]->Access & 0x8) continue;
+            if((FieldTypes[i] == FieldReference) != (Group == 0)) continue;
+            if(Group != 0 && ObjectHeap::ArrayElementSize(FieldTypes[i]) != Size) continue;
+
+            Offset = (Offset + Size - 1) & ~(Size - 1);
+            FieldOffsets[i] = Offset;
+            Offset += Size;
+            InstanceFieldCount++;
+
+            if(Group == 0)
+                ReferenceOffsets.emplace_back(FieldOffsets[i]);
+        }
+    }
+
+    InstanceSize = Offset;
+
+    // Everything Link builds counts towards the class' metadata, on top of what was counted when it was loaded.
+    Engine::_ObjectHeap.Metadata.Add(GetMetadataSize() - UnlinkedSize);
+
+    printf("Linked class %s: " PrtSizeT " instance fields in %d bytes, " PrtSizeT " interfaces.\n", GetClassName().c_str(), (size_t) InstanceFieldCount, InstanceSize, InterfaceClasses.size());
+    return Success;
+}
+
+/**
+ * Work out roughly how much memory this class takes up outside of the Object Heap.
+ * That's the mapped class file itself, which most of the parsed structures and all of the code point straight into,
+ *  plus everything that was built from it; the tables of constants, fields and methods, the statics, and the caches
+ *  made by Link.
+ * The class file is counted even though it's shared with the page cache, as it stays mapped for as long as the class.
+ * @return the size in bytes
+ */
+size_t Class::GetMetadataSize() {
+    size_t Size = sizeof(Class) + BytecodeLength;
+
+    // The Symbols in the Constants Pool are shared, so they're counted once for the whole VM. See ClassHeap#AddClass.
+    Size += (ConstantCount + 1) * sizeof(ConstantPoolEntry);
+    Size += InterfaceCount * sizeof(uint16_t);
+    Size += FieldsCount * (sizeof(FieldData*) + sizeof(FieldData) + sizeof(Variable));
+    Size += AttributeCount * sizeof(AttributeData*);
+    Size += MethodCount * sizeof(Method);
+    Size += MethodIndex.GetSize() + FieldIndex.GetSize();
+
+    for(size_t i = 0; i < MethodCount; i++) {
+        if(Methods[i].Code == nullptr) continue;
+        Size += sizeof(CodePoint) + Methods[i].Code->ExceptionCount * sizeof(Exception);
+    }
+
+    Size += StaticFieldIndexes.capacity() * sizeof(size_t);
+    Size += InterfaceClasses.capacity() * sizeof(Class*);
+    Size += FieldOffsets.capacity() * sizeof(uint32_t);
+    Size += FieldTypes.capacity() * sizeof(uint8_t);
+    Size += ReferenceOffsets.capacity() * sizeof(uint32_t);
+    Size += ResolvedFields.capacity() * sizeof(ResolvedField);
+    Size += ResolvedMethods.capacity() * sizeof(ResolvedMethod);
+    Size += AllocationTemplates.capacity() * sizeof(AllocationTemplate);
+    Size += ResolvedStrings.capacity() * sizeof(Object);
+    Size += ResolvedIntrinsics.capacity() * sizeof(intrinsic_t);
+
+    return Size;
+}
+
 /**
  * A simple wrapper to determine how many bytes it will take to store all the data in this class.
- * The bytes required = the number of fields in the hierarchy * the size of a single Variable
- * Note that if you wish to use this to allocate a class, you must add one Variable for the class pointer.
+ * Fields are packed, so this is worked out when the class is linked.
+ * Note that if you wish to use this to allocate a class, you want GetInstanceSize instead.
  * @return the size in bytes of all the fields this Class can store
  */
 uint32_t Class::GetClassSize() {
-    return GetClassFieldCount() * sizeof(Variable);
+    return GetInstanceSize() - sizeof(Variable);
 }
 
 /**
- * A simple wrapper to determine how many fields are in this class and all of its supers.
- * This is recursive, so carefulness is recommended.
- * Issues have been encountered with incorrect classloader behavior leading to an infinite recursion depth.
- * @return the number of fields in the class
+ * The size of the Variable Data of an instance of this class, including the class pointer.
+ * This is not rounded up; the Object Heap does that.
+ * @return the size in bytes of an instance
  */
-uint32_t Class::GetClassFieldCount() {
-    uint32_t Count = FieldsCount;
+uint32_t Class::GetInstanceSize() {
+    if(!Linked) Link();
+
+    return InstanceSize;
+}
 
-    Class* Super = GetSuper();
+/**
+ * Where the references are in an instance of this class, including those of the super classes.
+ * This is what the Collector uses to scan instances.
+ * @return the byte offset of every reference field
+ */
+const std::vector<uint32_t>& Class::GetReferenceOffsets() {
+    if(!Linked) Link();
 
-    uint32_t SuperSize = 0;
-    if(Super)
-        SuperSize = Super->GetClassFieldCount();
-    
-    Count += SuperSize;
-    return Count;
+    return ReferenceOffsets;
+}
+
+/**
+ * A simple wrapper to determine how many instance fields are in this class and all of its supers.
+ * This is worked out once, when the class is linked.
+ * @return the number of instance fields in the class
+ */
+uint32_t Class::GetClassFieldCount() {
+    if(!Linked) Link();
+
+    return InstanceFieldCount;
 }
 
 /**
@@ -887,21 +1137,50 @@ uint32_t Class::GetClassFieldCount() {
  * If this class is not java/lang/Object, there is guaranteed to be a Super.
  * If this class is java/lang/Object, there is guaranteed to not be a Super.
  *
- * With these axioms, it's simple.
+ * The pointer is found when the class is linked.
  * @return a pointer to the super class
  */
 Class* Class::GetSuper() {
-    if(this->GetStringConstant(This) == "java/lang/Object")
-        return nullptr;
+    if(!Linked) Link();
+
+    return SuperClass;
+}
+
+/**
+ * Return the interfaces this class implements directly.
+ * Like the super class, they're found when the class is linked.
+ * @return the list of interfaces
+ */
+const std::vector<Class*>& Class::GetInterfaces() {
+    if(!Linked) Link();
+
+    return InterfaceClasses;
+}
+
+/**
+ * Check whether an instance of this class can be stored where the given class is expected.
+ * That's true of the class itself, anything it extends, and any interface it or its supers implement.
+ * @param Other the class that's expected
+ * @return true if this class is, or inherits from, Other.
+ */
+bool Class::IsAssignableTo(Class* Other) {
+    for(Class* Current = this; Current != nullptr; Current = Current->GetSuper()) {
+        if(Current == Other)
+            return true;
+
+        for(Class* Interface : Current->GetInterfaces())
+            if(Interface->IsAssignableTo(Other))
+                return true;
+    }
 
-    return _ClassHeap->GetClass(GetSuperName());
+    return false;
 }
 
 /**
  * A simple wrapper to fetch the name of the Super class
  * @return the name of the class that this class extends
  */
-std::string Class::GetSuperName() {
+const std::string& Class::GetSuperName() {
     return this->GetName(Super);
 }
 
@@ -911,7 +1190,7 @@ std::string Class::GetSuperName() {
  *
  * @return the name of this class, including the package
  */
-std::string Class::GetClassName() {
+const std::string& Class::GetClassName() {
     return this->GetName(This);
 }
 
@@ -920,12 +1199,10 @@ std::string Class::GetClassName() {
  * @param Obj a Constants Pool index, pointing to a Class type
  * @return the name of the Class type pointed, or UnknownClass if Obj is not a Class.
  */
-std::string Class::GetName(uint16_t Obj) {
+const std::string& Class::GetName(uint16_t Obj) {
     if(Obj < 1 || (Obj != Super && Obj != This)) return ClassHeap::UnknownClass;
 
-    auto NameInd = ReadShortFromStream((char*)Constants[Obj] + 1);
-
-    return GetStringConstant(NameInd);
+    return GetStringConstant(Obj);
 }
 
 /**
@@ -937,19 +1214,53 @@ std::string Class::GetName(uint16_t Obj) {
  * @return the new Object Reference of the given Class
  */
 Object Class::CreateObject(uint16_t Index, ObjectHeap* ObjectHeap) {
-    auto* ConstantType = (uint8_t*) this->Constants[Index];
+    const AllocationTemplate& Template = ResolveAllocation(Index);
+    if(Template.Klass == 0) return ObjectHeap::Null;
+
+    printf("Creating new object from class %s\n", ((Class*) Template.Klass)->GetClassName().c_str());
+    return ObjectHeap->CreateObject(Template);
+}
+
+/**
+ * Resolve a Class constant to the Allocation Template for an instance of that class.
+ * The lookup by name only happens the first time; after that, the template is cached by Constants Pool index.
+ *
+ * @param Index the Index into the Constants Pool referencing the class to be instantiated
+ * @return the template, with a Klass of 0 if the class could not be found.
+ */
+const AllocationTemplate& Class::ResolveAllocation(uint16_t Index) {
+    if(!Linked) Link();
+
+    AllocationTemplate& Cached = AllocationTemplates.at(Index);
+    if(Cached.Klass != 0) return Cached;
+
+    if(Constants[Index].Tag != TypeClass)
+        return Cached;
 
-    if(ConstantType[0] != TypeClass)
-        return ObjectHeap::Null;
+    Class* NewClass = this->_ClassHeap->GetClass(GetStringConstant(Index));
+    if(NewClass == nullptr) return Cached;
 
-    auto NameInd = ReadShortFromStream(&ConstantType[1]);
-    std::string Name = GetStringConstant(NameInd);
+    Cached = ObjectHeap::InstanceTemplate(NewClass);
+    return Cached;
+}
+
+/**
+ * Resolve a String constant to its' interned String Object.
+ * The String is only created the first time the constant is loaded; after that, it's cached by Constants Pool index.
+ * Interned Strings are never freed, so the cached reference stays valid.
+ *
+ * @param Index the Index into the Constants Pool of the String constant
+ * @param ObjectHeap the Object Heap to intern the String in
+ * @return the interned String, or Null if the String class isn't available.
+ */
+Object Class::ResolveString(uint16_t Index, ObjectHeap* ObjectHeap) {
+    if(!Linked) Link();
 
-    Class* NewClass = this->_ClassHeap->GetClass(Name);
-    if(NewClass == nullptr) return ObjectHeap::Null;
+    Object& Cached = ResolvedStrings.at(Index);
+    if(Cached == ObjectHeap::Null)
+        Cached = ObjectHeap->InternString(GetStringConstant(Index), _ClassHeap);
 
-    printf("Creating new object from class %s\n", Name.c_str());
-    return ObjectHeap->CreateObject(NewClass);
+    return Cached;
 }
 
 /**
@@ -960,7 +1271,7 @@ Object Class::CreateObject(uint16_t Index, ObjectHeap* ObjectHeap) {
  * @param ObjectHeap the Object Heap to store the new Object Reference Array in
  * @return the new Array of Object References of the given Class
  */
-bool Class::CreateObjectArray(uint16_t Index, uint32_t Count, ObjectHeap ObjectHeap, Object &pObject) {
+bool Class::CreateObjectArray(uint16_t Index, uint32_t Count, ObjectHeap* ObjectHeap, Object &pObject) {
     std::string ClassName = GetStringConstant(Index);
 
     printf("Creating array of objects from class %s\n", ClassName.c_str());
@@ -968,7 +1279,66 @@ bool Class::CreateObjectArray(uint16_t Index, uint32_t Count, ObjectHeap ObjectH
     Class* newClass = this->_ClassHeap->GetClass(ClassName);
     if(newClass == nullptr) return false;
 
-    pObject = ObjectHeap.CreateObjectArray(newClass, Count);
+    pObject = ObjectHeap->CreateObjectArray(newClass, Count);
+
+    return true;
+}
+
+/**
+ * Create a multi-dimensional array of the type given in the Constants Pool, for multinewarray.
+ * The constant is the class of the whole array, ie. [[I for an int[][].
+ *
+ * Arrays of arrays don't have a Class of their own, so every level that holds arrays has the class word of the
+ *  innermost element type instead; the Class pointer if it's a class, or nothing if it's a primitive.
+ * Each level's shape records how many dimensions are left under it, and the primitive type at the bottom, if any.
+ *
+ * @param Index the Index into the Constants Pool referencing the array class
+ * @param Counts the length of each dimension to create, from the outermost in
+ * @param ObjectHeap the Object Heap to store the new array in
+ * @param pObject the new array
+ * @return false if the element class couldn't be found.
+ */
+bool Class::CreateMultiArray(uint16_t Index, const std::vector<uint32_t>& Counts, ObjectHeap* ObjectHeap, Object &pObject) {
+    std::string Descriptor = GetStringConstant(Index);
+
+    printf("Creating " PrtSizeT "-dimensional array %s\n", Counts.size(), Descriptor.c_str());
+
+    size_t Innermost = 0;
+    size_t Depth = Descriptor.find_first_not_of('[');
+    if(Depth == std::string::npos || Depth < Counts.size())
+        return false;
+
+    if(Descriptor[Depth] == 'L') {
+        Class* ElementClass = this->_ClassHeap->GetClass(Descriptor.substr(Depth + 1, Descriptor.size() - Depth - 2));
+        if(ElementClass == nullptr) return false;
+        Innermost = (size_t) ElementClass;
+    }
+
+    uint8_t InnermostType = 0;
+    switch(Descriptor[Depth]) {
+        case 'Z': InnermostType = ArrayBoolean; break;
+        case 'B': InnermostType = ArrayByte; break;
+        case 'C': InnermostType = ArrayChar; break;
+        case 'S': InnermostType = ArrayShort; break;
+        case 'I': InnermostType = ArrayInt; break;
+        case 'F': InnermostType = ArrayFloat; break;
+        case 'J': InnermostType = ArrayLong; break;
+        case 'D': InnermostType = ArrayDouble; break;
+        default: break;
+    }
+
+    std::vector<AllocationTemplate> Levels;
+    for(size_t Level = 0; Level < Counts.size(); Level++) {
+        // Only the innermost level can hold anything but references, and only if it's the last dimension of the type.
+        uint8_t Type = FieldReference;
+        if(Level + 1 == Depth && InnermostType != 0)
+            Type = InnermostType;
+
+        Levels.push_back(ObjectHeap::ArrayTemplate(Type, Type == FieldReference ? Innermost : Type, Counts[Level],
+                                                   (uint8_t) (Depth - Level), InnermostType));
+    }
+
+    pObject = ObjectHeap->CreateMultiArray(Levels, Counts);
 
     return true;
 }
@@ -4,6 +4,7 @@
  **************/
 
 #include <vm/Class.hpp>
+#include <vm/ClassLoader.hpp>
 
 #include <fstream>
 #include <iterator>
@@ -16,27 +17,38 @@
  * This file implements the ClassHeap class declared in Class.hpp.
  *
  * It is what handles class management.
- * It does this with two primary data structures; the class cache and the class map.
+ * Every class is kept in the Class Map, a hash map by name. Checking whether a class is loaded, and fetching it,
+ *  is one lookup, and never touches the filesystem.
+ * A class is in the Map once it has been parsed, whether or not it has been linked yet.
  *
- * The Class Cache keeps a list of all class names that are currently loaded into the VM.
- * It may be used as a (very) quick reference to check whether a specific class is available.
- *
- * The Class Map is what allows you to access a specific class by name.
- * It throws out_of_range if you attempt to access a class that does not exist, so check with the Class Cache first.
- * They are always synchronized.
+ * Classes are loaded lazily, the first time GetClass is asked for them.
  *
  *
  * This class also handles the ClassPath, searching for class implementations, and jar handling.
+ * The JARs themselves are read in ClassPath.cpp.
  * For an explanation on class prefixes, see EntryPoint.cpp.
  *
  * @author Curle
  */
 
-ClassHeap::ClassHeap() = default;
+ClassHeap::ClassHeap() : Loader(new ClassLoader(this)) {}
+
+ClassHeap::~ClassHeap() = default;
+
+/**
+ * Load classes from the given Shared Archive, where it has them, instead of reading them from the ClassPath.
+ * See Archive.cpp.
+ */
+void ClassHeap::SetArchive(std::unique_ptr<SharedArchive> p_Archive) {
+    Archive = std::move(p_Archive);
+}
 
 /**
- * A simple wrapper to add a Class to the heap.
- * It is intended to be called only from LoadClass, so it does not touch the Cache.
+ * A simple wrapper to add a parsed Class to the heap, which makes it visible to everything else.
+ * This is also where the memory the class takes up is counted; see ObjectHeap::PrintMemorySummary.
+ *
+ * Whatever this class refers to is likely to be needed soon, so the Class Loader is asked to start reading it.
+ * See ClassLoader.cpp.
  * @param Class the Class to add.
  * @return whether the class was added successfully.
  */
@@ -45,38 +57,70 @@ bool ClassHeap::AddClass(Class *Class) {
 
     std::string Name = Class->GetClassName();
     ClassMap.emplace(Name, Class);
+    Classes.emplace_back(Class);
+    Engine::_ObjectHeap.Metadata.Add(Class->GetMetadataSize());
+
+    // Symbols are shared between classes, so only those that are new since the last class are counted.
+    size_t Symbols = SymbolTable::GetSize();
+    Engine::_ObjectHeap.Metadata.Add(Symbols - SymbolsCounted);
+    SymbolsCounted = Symbols;
+
+    for(size_t i = 1; i < Class->ConstantCount; i++) {
+        if(Class->Constants[i].Tag != TypeClass) continue;
+
+        const std::string& Referent = Class->GetStringConstant(i);
+        // Classes in the Shared Archive don't need reading or parsing, so there's nothing for the workers to do.
+        if(Referent[0] != '[' && ClassMap.find(Referent) == ClassMap.end() && !(Archive && Archive->Contains(Referent)))
+            Loader->Preload(Referent);
+    }
 
     return true;
 }
 
 /**
  * A simple wrapper to check whether a class is currently loaded.
- * The Class Cache makes this extremely simple.
+ * The Class Map makes this extremely simple.
  * @param Name the name of the class to check
  * @return whether the class is loaded.
  */
 bool ClassHeap::ClassExists(const std::string& Name) {
-    return std::find(ClassCache.begin(), ClassCache.end(), Name) != ClassCache.end();
+    return ClassMap.find(Name) != ClassMap.end();
 }
 
 /**
- * A simple wrapper to fetch a class from the Class Map.
- * If the name is invalid, or the class is not in the Cache, null is returned.
+ * Fetch a class by name, loading it if this is the first time it's been asked for.
+ *
+ * Classes are only loaded when something actually uses them; a new, a static field access, an invoke, or a subclass
+ *  being linked. Until then, a reference to a class is just a name in somebody's Constants Pool.
+ * A class loaded here is linked straight away, which loads its super class and interfaces in turn.
+ * It isn't initialized until it's actively used, though; see Engine#InitializeClass.
+ *
+ * Array classes have no class file, so they're never loaded.
+ *
  * @param Name the Class to retrieve.
- * @return the class, or null if the above conditions are met.
+ * @return the class, or null if it doesn't exist or couldn't be loaded.
  */
 Class* ClassHeap::GetClass(const std::string& Name) {
-    if (Name.empty()) return nullptr;
-    if (!ClassExists(Name)) return nullptr;
+    if (Name.empty() || Name[0] == '[') return nullptr;
 
-    // Because the ClassExists call passed, and we can guarantee the Cache is synced to the Map, this is safe.
     auto classIter = ClassMap.find(Name);
-    Class* Class = classIter->second;
+    if (classIter != ClassMap.end())
+        return classIter->second;
+
+    printf("Class %s is not loaded - invoking the classloader\n", Name.c_str());
+
+    // It's usually been read already, on one of the Class Loader's threads. If not, it's read here and now.
+    Class* Class = Loader->Take(Name);
+    if (Class == nullptr)
+        Class = ReadClass(Name);
 
-    // TODO: Why do we check the file?
-    std::ifstream File(Name.c_str(), std::ios::binary);
-    File.close();
+    if (Class == nullptr) {
+        printf("Unable to load class %s.\n", Name.c_str());
+        return nullptr;
+    }
 
+    AddClass(Class);
+    Class->Link();
     return Class;
 }
 
@@ -85,34 +129,36 @@ Class* ClassHeap::GetClass(const std::string& Name) {
  * By default, the classpath contains:
  *  - The root folder of the Purpuri executable
  *  - The working directory
- *  - Every JAR file added via the -classpath argument
+ *  - Every directory and JAR file added via the -cp argument
  * These locations are searched in that order when trying to load classes.
+ *
+ * A JAR is opened and indexed here, once; see ClassPath.cpp. One that can't be read is left off the ClassPath.
+ * @param path the directory or JAR to add.
  */
 void ClassHeap::AddToClassPath(std::string path) {
-    ClassPath.emplace_back(path + std::filesystem::path::preferred_separator);
+    std::filesystem::path Location(path);
+    std::string Extension = Location.extension().string();
+
+    if(std::filesystem::is_regular_file(Location) && (Extension == ".jar" || Extension == ".zip")) {
+        std::unique_ptr<JarFile> Jar(new JarFile());
+        if(Jar->Open(path))
+            ClassPath.emplace_back(ClassPathEntry { "", std::move(Jar) });
+        return;
+    }
+
+    ClassPath.emplace_back(ClassPathEntry { path + std::filesystem::path::preferred_separator, nullptr });
 }
 
 /**
- * The ClassPath is a list of locations we can expect to find classes.
- * By default, the classpath contains:
- *  - The root folder of the Purpuri executable
- *  - The working directory
- *  - Every JAR file added via the -classpath argument
- *
- * This function searches <classpath>/<classFile> for a valid file, and returns the first valid match.
- *
- * @param classFile the class file to search for, with packages.
- * @return the filesystem location of the class file.
+ * Every location on the ClassPath, in order, one per line.
+ * The Shared Archive is only valid for the ClassPath it was written with; this is how it tells. See Archive.cpp.
  */
-std::string ClassHeap::SearchClassPath(std::string& classFile) {
-    for (std::string path : ClassPath) {
-        std::string newPath = path.append(classFile).append(".class");
-        printf("Searching %s\r\n", newPath.c_str());
-        if (std::filesystem::exists(newPath))
-            return newPath;
-    }
+std::string ClassHeap::DescribeClassPath() {
+    std::string Description;
+    for (ClassPathEntry& Entry : ClassPath)
+        Description.append(Entry.Jar != nullptr ? Entry.Jar->GetPath() : Entry.Directory).append("\n");
 
-    return "INVALID";
+    return Description;
 }
 
 /**
@@ -120,7 +166,7 @@ std::string ClassHeap::SearchClassPath(std::string& classFile) {
  * This is where the Class Prefix is handled.
  * See EntryPoint.cpp for what the Class Prefix is, and why we need it.
  *
- * This calls out to Class#LoadFromFile to perform the actual classloading.
+ * This calls out to ReadClass to find the class and perform the actual classloading.
  * @param ClassName the name of the class to load, from the Java Language's perspective.
  * @param Class the class instance to laod it into
  * @return whether the class was successfully loaded.
@@ -128,32 +174,105 @@ std::string ClassHeap::SearchClassPath(std::string& classFile) {
 bool ClassHeap::LoadClass(const char *ClassName, Class *Class) {
     if(!Class) return false;
 
-    const char* RelativePath;
+    // Now spin out to do the actual classloading.
+    // If it fails, it'll return here, so we check it.
+    if(!ReadClass(ClassName, Class))
+        return false;
+
+    // With the class loaded properly, we can add it to the Map and continue with what we were doing.
+    return AddClass(Class);
+}
 
+/**
+ * Find a class on the ClassPath, and read and parse it into the given Class.
+ * Directories are searched for <directory>/<ClassName>.class, and JARs are looked up in their index.
+ * The class isn't added to the heap, so nothing else can see it yet; that's up to the caller.
+ *
+ * This only reads the ClassPath, which doesn't change once the VM has started, so it is safe to call from any thread.
+ * The Class Loader's workers call it for every class they preload.
+ *
+ * @param ClassName the name of the class to load, from the Java Language's perspective.
+ * @param Class the class instance to load it into
+ * @return whether the class was successfully read and parsed.
+ */
+bool ClassHeap::ReadClass(const std::string& ClassName, Class* Class) {
     // The ClassName is given to us by the Java Language.
     // Ergo, we're going to be given something like "OtherClass", or "java/lang/OtherClass".
 
-    std::string ClassNameStr(ClassName);
-    std::string ClassLoc = SearchClassPath(ClassNameStr);
-    if (ClassLoc == "INVALID")
-        return false;
-
-    // We need to transform it to a char* so that it can be read properly, so we do that here.
-    RelativePath = ClassLoc.c_str();
-
     // Since we're preparing the class for being loaded, we need to tell it which class heap it belongs to.
     // That's this one.
     Class->SetClassHeap(this);
 
-    // The class is being loaded anew, so it can be added to the Cache.
-    // This also prevents recursive classloading when the class evaluates all of its' references.
-    ClassCache.emplace_back(ClassName);
+    // A class in the Shared Archive is already parsed, and was checked against its class file when the archive was opened.
+    if (Archive && Archive->Load(ClassName, Class))
+        return true;
 
-    // Now spin out to do the actual classloading.
-    // If it fails, it'll return here, so we check it.
-    if(!Class->LoadFromFile(RelativePath))
-        return false;
+    // The first location that has the class wins.
+    for (ClassPathEntry& Entry : ClassPath) {
+        bool Parsed;
+        if (Entry.Jar != nullptr) {
+            size_t Length;
+            const char* Bytes = Entry.Jar->Find(ClassName, Length);
+            if (Bytes == nullptr) continue;
 
-    // With the class in the cache and loaded properly, we can add it to the Map and continue with what we were doing.
-    return AddClass(Class);
+            Class->SetSource(Entry.Jar->GetPath());
+            Parsed = Class->LoadFromMemory(Bytes, Length, Entry.Jar->IsMapped(Bytes));
+        } else {
+            std::string Path = Entry.Directory + ClassName + ".class";
+            // The main class is asked for by its path rather than its name, so the lookup above misses it.
+            if (Archive && Archive->LoadSource(Path, Class))
+                return true;
+            if (!ProbeClassPath(Path)) continue;
+
+            Class->SetSource(Path);
+            Parsed = Class->LoadFromFile(Path.c_str());
+        }
+
+        // A class that doesn't parse is only partly filled in. It's up to the caller to throw it away rather than
+        //  add it to the heap; see LoadClass and GetClass.
+        if (!Parsed)
+            printf("Unable to parse class %s. It is malformed, or uses something the VM doesn't support.\n", ClassName.c_str());
+        return Parsed;
+    }
+
+    return false;
+}
+
+/**
+ * Check whether a class file exists on the ClassPath.
+ *
+ * The answer is remembered, whether it's yes or no. A class that isn't found is looked for again every time
+ *  something asks for it, and in every directory before the one it's in; once each is enough.
+ * The ClassPath isn't expected to change while the VM is running.
+ *
+ * This is called from the Class Loader's threads as well as the interpreter's.
+ *
+ * @param Path the full path of the class file
+ * @return whether it exists.
+ */
+bool ClassHeap::ProbeClassPath(const std::string& Path) {
+    std::lock_guard<std::mutex> lock(ProbeLock);
+
+    auto Found = Probes.find(Path);
+    if (Found != Probes.end())
+        return Found->second;
+
+    printf("Searching %s\r\n", Path.c_str());
+    bool Exists = std::filesystem::exists(Path);
+    Probes.emplace(Path, Exists);
+    return Exists;
+}
+
+/**
+ * Read a class into a new Class, as above.
+ * @param ClassName the name of the class to load
+ * @return the parsed Class, or null if it couldn't be read.
+ */
+Class* ClassHeap::ReadClass(const std::string& ClassName) {
+    auto* Class = new class Class();
+    if (ReadClass(ClassName, Class))
+        return Class;
+
+    delete Class;
+    return nullptr;
 }
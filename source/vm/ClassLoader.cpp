@@ -0,0 +1,126 @@
+/**************
+ * GEMWIRE    *
+ *    PURPURI *
+ **************/
+
+#include <vm/ClassLoader.hpp>
+#include <vm/Class.hpp>
+
+/**
+ * This file implements the ClassLoader class declared in ClassLoader.hpp.
+ *
+ * Classes are loaded the first time they're used (see ClassHeap#GetClass), and reading and parsing the class file
+ *  is most of the work in that. Done on the interpreter thread, every class a program uses is parsed one after the
+ *  other, while the program waits.
+ *
+ * The Class Loader moves that work onto a pool of worker threads, ahead of time.
+ * When a class is added to the Class Heap, every class named in its Constants Pool is queued up with Preload.
+ * A worker picks it up, finds it on the ClassPath, reads it and parses it, and leaves the result for whoever wants it.
+ * When the class is actually used, ClassHeap#GetClass calls Take, which hands over the parsed Class; waiting for the
+ *  worker to finish if it's still going.
+ *
+ * Only reading and parsing happens on the workers. A parsed Class doesn't touch anything outside of itself, so any
+ *  number of them can be parsed at once. Everything else - adding the class to the Class Heap, linking it, and
+ *  initializing it - still happens on the interpreter thread, in the same order as it would without the workers.
+ * A class that is preloaded and never used is parsed for nothing, but never becomes visible to the program.
+ *
+ * The workers are only started once there's something for them to do, and wait for more work when there isn't.
+ */
+
+size_t ClassLoader::Threads = std::thread::hardware_concurrency();
+
+ClassLoader::ClassLoader(ClassHeap* Heap) : Heap(Heap) {}
+
+/**
+ * Stop all of the workers.
+ * Anything that was still waiting to be read is dropped.
+ */
+ClassLoader::~ClassLoader() {
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        Stopping = true;
+    }
+    Ready.notify_all();
+
+    for(std::thread& Worker : Workers)
+        Worker.join();
+}
+
+/**
+ * Queue a class up to be read and parsed by a worker.
+ * Nothing happens if the class has already been queued, or if there are no workers.
+ * @param Name the name of the class, as it appears in the Constants Pool.
+ */
+void ClassLoader::Preload(const std::string& Name) {
+    if(Threads == 0) return;
+
+    std::lock_guard<std::mutex> lock(Lock);
+    if(Results.find(Name) != Results.end()) return;
+
+    Job New { Name, {} };
+    Results.emplace(Name, New.Result.get_future());
+    Queue.push_back(std::move(New));
+
+    if(Workers.size() < Threads)
+        Workers.emplace_back(&ClassLoader::Work, this);
+
+    Ready.notify_one();
+}
+
+/**
+ * Take the parsed Class for the given name, if it was preloaded.
+ *
+ * If a worker is parsing it right now, this waits for it to finish.
+ * If no worker has got to it yet, there's no point waiting; it's taken out of the queue and parsed here instead.
+ *
+ * @param Name the name of the class
+ * @return the parsed Class, ready to be added to the Class Heap, or null if it wasn't preloaded or couldn't be read.
+ */
+Class* ClassLoader::Take(const std::string& Name) {
+    std::future<Class*> Result;
+    Job Mine;
+    bool Waiting = false;
+
+    {
+        std::lock_guard<std::mutex> lock(Lock);
+        auto Found = Results.find(Name);
+        if(Found == Results.end()) return nullptr;
+
+        Result = std::move(Found->second);
+        Results.erase(Found);
+
+        for(auto Queued = Queue.begin(); Queued != Queue.end(); Queued++) {
+            if(Queued->Name == Name) {
+                Mine = std::move(*Queued);
+                Queue.erase(Queued);
+                Waiting = true;
+                break;
+            }
+        }
+    }
+
+    if(Waiting)
+        Mine.Result.set_value(Heap->ReadClass(Name));
+
+    return Result.get();
+}
+
+/**
+ * The body of a worker.
+ * Reads classes from the front of the queue until the Class Loader is destroyed.
+ */
+void ClassLoader::Work() {
+    std::unique_lock<std::mutex> lock(Lock);
+
+    while(true) {
+        Ready.wait(lock, [this] { return Stopping || !Queue.empty(); });
+        if(Stopping) return;
+
+        Job Next = std::move(Queue.front());
+        Queue.pop_front();
+
+        lock.unlock();
+        Next.Result.set_value(Heap->ReadClass(Next.Name));
+        lock.lock();
+    }
+}
@@ -0,0 +1,541 @@
+/**************
+ * GEMWIRE    *
+ *    PURPURI *
+ **************/
+
+#include <vm/ClassPath.hpp>
+#include <vm/Class.hpp>
+
+#if defined WIN32
+    #include <windows.h>
+    #undef GetClassName
+    #undef LoadLibrary
+    #undef GetObject
+#elif defined linux || defined __APPLE__
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+/**
+ * This file implements the MappedFile and JarFile classes declared in ClassPath.hpp.
+ *
+ * Classes come from two kinds of place on the ClassPath; directories full of class files, and JARs.
+ * Either way, the file is mapped into memory rather than read, so that the class can be parsed right where it is.
+ * See Class#LoadFromFile.
+ *
+ * A JAR is a zip file. The end of it has a Central Directory, which lists every file in the archive; its name,
+ *  where its data starts, how big it is, and how it's compressed.
+ * The whole Central Directory is read once, when the JAR is added to the ClassPath, and every entry goes into a hash
+ *  map by name. After that, finding a class is one lookup, no matter how many entries the JAR has.
+ *
+ * Entries are either stored, which means the class file sits in the JAR as-is and can be parsed straight out of the
+ *  mapping, or deflated. Deflated entries are inflated into a buffer of their own, which the JAR keeps.
+ *
+ * Zip files are little-endian, unlike class files.
+ * Zip64, encryption, and compression methods other than deflate aren't supported; classes stored like that can't
+ *  be found.
+ */
+
+/**
+ * Map a file into memory, read-only.
+ * Empty files can't be mapped, so they count as failing to open.
+ * @param Filename the file to map
+ * @return whether the file was mapped.
+ */
+bool MappedFile::Open(const char* Filename) {
+    #ifdef WIN32
+        HANDLE File = CreateFileA(Filename, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if(File == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER FileSize;
+        if(GetFileSizeEx(File, &FileSize) && FileSize.QuadPart > 0) {
+            HANDLE Mapping = CreateFileMappingA(File, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+            if(Mapping != nullptr) {
+                Data = (const char*) MapViewOfFile(Mapping, FILE_MAP_COPY, 0, 0, 0);
+                Size = (size_t) FileSize.QuadPart;
+                // The view keeps the file mapped after both handles are gone.
+                CloseHandle(Mapping);
+            }
+        }
+
+        CloseHandle(File);
+    #elif defined linux || defined __APPLE__
+        int File = open(Filename, O_RDONLY);
+        if(File == -1)
+            return false;
+
+        struct stat Info;
+        if(fstat(File, &Info) == 0 && Info.st_size > 0) {
+            void* Mapping = mmap(nullptr, (size_t) Info.st_size, PROT_READ, MAP_PRIVATE, File, 0);
+            if(Mapping != MAP_FAILED) {
+                Data = (const char*) Mapping;
+                Size = (size_t) Info.st_size;
+            }
+        }
+
+        // The mapping keeps the file open after the descriptor is closed.
+        close(File);
+    #endif
+
+    return Data != nullptr;
+}
+
+MappedFile::~MappedFile() {
+    if(Data == nullptr) return;
+
+    #ifdef WIN32
+        UnmapViewOfFile(Data);
+    #elif defined linux || defined __APPLE__
+        munmap((void*) Data, Size);
+    #endif
+}
+
+static uint16_t ReadLittleShort(const char* Stream) {
+    auto* Bytes = (const uint8_t*) Stream;
+    return (uint16_t) (Bytes[0] | Bytes[1] << 8);
+}
+
+static uint32_t ReadLittleInt(const char* Stream) {
+    auto* Bytes = (const uint8_t*) Stream;
+    return (uint32_t) Bytes[0] | (uint32_t) Bytes[1] << 8 | (uint32_t) Bytes[2] << 16 | (uint32_t) Bytes[3] << 24;
+}
+
+/**
+ * Map a JAR and index its Central Directory.
+ *
+ * The Central Directory is found through the End Of Central Directory record, which is the last thing in the file;
+ *  unless the zip has a comment, which comes after it, so the end of the file is searched backwards for it.
+ *
+ * @param Filename the JAR to open
+ * @return whether the JAR could be read.
+ */
+bool JarFile::Open(const std::string& Filename) {
+    Path = Filename;
+
+    if(!File.Open(Filename.c_str())) {
+        printf("Unable to open JAR file: %s\n", Filename.c_str());
+        return false;
+    }
+
+    const char* Data = File.GetData();
+    size_t Size = File.GetSize();
+
+    // The record is 22 bytes, followed by up to 65535 bytes of comment.
+    const size_t RecordSize = 22;
+    if(Size < RecordSize) {
+        printf("%s is not a zip file.\n", Filename.c_str());
+        return false;
+    }
+
+    const char* End = nullptr;
+    size_t Lowest = Size > RecordSize + 0xFFFF ? Size - RecordSize - 0xFFFF : 0;
+    for(size_t i = Size - RecordSize + 1; i-- > Lowest;) {
+        if(ReadLittleInt(Data + i) == 0x06054B50) {
+            End = Data + i;
+            break;
+        }
+    }
+
+    if(End == nullptr) {
+        printf("%s is not a zip file.\n", Filename.c_str());
+        return false;
+    }
+
+    uint16_t EntryCount = ReadLittleShort(End + 10);
+    uint32_t DirectorySize = ReadLittleInt(End + 12);
+    uint32_t DirectoryOffset = ReadLittleInt(End + 16);
+
+    if((size_t) DirectoryOffset + DirectorySize > Size) {
+        printf("%s has a corrupt Central Directory.\n", Filename.c_str());
+        return false;
+    }
+
+    Entries.reserve(EntryCount);
+
+    // Each header is 46 bytes, followed by the name, the extra field and the comment.
+    const char* Header = Data + DirectoryOffset;
+    const char* DirectoryEnd = Header + DirectorySize;
+    for(size_t i = 0; i < EntryCount; i++) {
+        if(Header + 46 > DirectoryEnd || ReadLittleInt(Header) != 0x02014B50) {
+            printf("%s has a corrupt Central Directory.\n", Filename.c_str());
+            return false;
+        }
+
+        uint16_t NameLength = ReadLittleShort(Header + 28);
+        uint16_t ExtraLength = ReadLittleShort(Header + 30);
+        uint16_t CommentLength = ReadLittleShort(Header + 32);
+
+        if(Header + 46 + NameLength > DirectoryEnd) {
+            printf("%s has a corrupt Central Directory.\n", Filename.c_str());
+            return false;
+        }
+
+        Entry New {};
+        New.Compression = ReadLittleShort(Header + 10);
+        New.CompressedSize = ReadLittleInt(Header + 20);
+        New.Size = ReadLittleInt(Header + 24);
+        New.HeaderOffset = ReadLittleInt(Header + 42);
+        Entries.emplace(std::string(Header + 46, NameLength), New);
+
+        Header += 46 + NameLength + ExtraLength + CommentLength;
+    }
+
+    printf("Indexed " PrtSizeT " entries of %s\n", Entries.size(), Filename.c_str());
+    return true;
+}
+
+namespace {
+
+    /**
+     * Decompresses a raw deflate stream, as described in RFC 1951.
+     * This is what almost every entry in a JAR is compressed with.
+     *
+     * The output size is always known up front from the Central Directory, so everything is inflated straight into
+     *  a buffer of that size. A stream that tries to write past the end of it, or that stops short of filling it,
+     *  is corrupt.
+     *
+     * Huffman codes are decoded a bit at a time, with a table of how many codes there are of each length; it's
+     *  slower than a lookup table, but class files are small, and each one is only inflated once.
+     */
+    class Inflater {
+        public:
+            Inflater(const uint8_t* In, size_t InSize, uint8_t* Out, size_t OutSize)
+                : In(In), InSize(InSize), Out(Out), OutSize(OutSize) {}
+
+            bool Run();
+
+        private:
+            struct Huffman {
+                // How many codes there are of each length.
+                uint16_t Counts[16];
+                // The symbols, ordered by their codes.
+                uint16_t Symbols[288];
+            };
+
+            const uint8_t* In;
+            size_t InSize;
+            size_t InPos = 0;
+
+            uint8_t* Out;
+            size_t OutSize;
+            size_t OutPos = 0;
+
+            uint32_t Bits = 0;
+            int BitCount = 0;
+            bool Failed = false;
+
+            uint32_t Take(int Count);
+            int Decode(const Huffman& Code);
+            static bool Build(Huffman& Code, const uint8_t* Lengths, int Count);
+
+            bool Stored();
+            bool Fixed();
+            bool Dynamic();
+            bool Codes(const Huffman& Lengths, const Huffman& Distances);
+    };
+
+    /**
+     * Read the next Count bits from the stream, least significant first.
+     * Running out of input marks the stream as failed.
+     */
+    uint32_t Inflater::Take(int Count) {
+        while(BitCount < Count) {
+            if(InPos == InSize) {
+                Failed = true;
+                return 0;
+            }
+
+            Bits |= (uint32_t) In[InPos++] << BitCount;
+            BitCount += 8;
+        }
+
+        uint32_t Value = Bits & ((1u << Count) - 1);
+        Bits >>= Count;
+        BitCount -= Count;
+        return Value;
+    }
+
+    /**
+     * Read one symbol with the given code.
+     * Codes are canonical, so all the codes of one length are consecutive, and come after every shorter code.
+     */
+    int Inflater::Decode(const Huffman& Code) {
+        int Value = 0, First = 0, Index = 0;
+
+        for(int Length = 1; Length < 16; Length++) {
+            Value |= (int) Take(1);
+            int Count = Code.Counts[Length];
+            if(Value - Count < First)
+                return Code.Symbols[Index + (Value - First)];
+
+            Index += Count;
+            First = (First + Count) << 1;
+            Value <<= 1;
+        }
+
+        Failed = true;
+        return -1;
+    }
+
+    /**
+     * Build a code from the length of the code for each symbol. Symbols with a length of 0 aren't used.
+     * @return false if there are more codes of some length than can exist.
+     */
+    bool Inflater::Build(Huffman& Code, const uint8_t* Lengths, int Count) {
+        memset(Code.Counts, 0, sizeof(Code.Counts));
+        for(int Symbol = 0; Symbol < Count; Symbol++)
+            Code.Counts[Lengths[Symbol]]++;
+
+        int Left = 1;
+        for(int Length = 1; Length < 16; Length++) {
+            Left = (Left << 1) - Code.Counts[Length];
+            if(Left < 0) return false;
+        }
+
+        uint16_t Offsets[16];
+        Offsets[1] = 0;
+        for(int Length = 1; Length < 15; Length++)
+            Offsets[Length + 1] = Offsets[Length] + Code.Counts[Length];
+
+        for(int Symbol = 0; Symbol < Count; Symbol++) {
+            if(Lengths[Symbol] != 0)
+                Code.Symbols[Offsets[Lengths[Symbol]]++] = (uint16_t) Symbol;
+        }
+
+        return true;
+    }
+
+    /**
+     * A block that isn't compressed. It starts on a byte boundary, with its length and the inverse of its length.
+     */
+    bool Inflater::Stored() {
+        // Take never holds a whole byte back, so dropping what's left moves on to the next byte.
+        Bits = 0;
+        BitCount = 0;
+
+        if(InSize - InPos < 4) return false;
+        uint16_t Length = (uint16_t) (In[InPos] | In[InPos + 1] << 8);
+        uint16_t Inverse = (uint16_t) (In[InPos + 2] | In[InPos + 3] << 8);
+        InPos += 4;
+
+        if(Length != (uint16_t) ~Inverse || InSize - InPos < Length || OutSize - OutPos < Length)
+            return false;
+
+        memcpy(Out + OutPos, In + InPos, Length);
+        InPos += Length;
+        OutPos += Length;
+        return true;
+    }
+
+    /**
+     * Decode the literals and back references of a compressed block, until the end of the block.
+     */
+    bool Inflater::Codes(const Huffman& Lengths, const Huffman& Distances) {
+        static const uint16_t LengthBase[29] = {
+            3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+        };
+        static const uint8_t LengthExtra[29] = {
+            0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+        };
+        static const uint16_t DistanceBase[30] = {
+            1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+            4097, 6145, 8193, 12289, 16385, 24577
+        };
+        static const uint8_t DistanceExtra[30] = {
+            0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+        };
+
+        while(true) {
+            int Symbol = Decode(Lengths);
+            if(Failed) return false;
+
+            // A literal byte.
+            if(Symbol < 256) {
+                if(OutPos == OutSize) return false;
+                Out[OutPos++] = (uint8_t) Symbol;
+                continue;
+            }
+
+            // The end of the block.
+            if(Symbol == 256)
+                return true;
+
+            // A copy of something already written.
+            Symbol -= 257;
+            if(Symbol >= 29) return false;
+            size_t Length = LengthBase[Symbol] + Take(LengthExtra[Symbol]);
+
+            Symbol = Decode(Distances);
+            if(Failed || Symbol >= 30) return false;
+            size_t Distance = DistanceBase[Symbol] + Take(DistanceExtra[Symbol]);
+
+            if(Failed || Distance > OutPos || OutSize - OutPos < Length) return false;
+
+            // The copy can overlap what it's writing, so it goes a byte at a time.
+            for(size_t i = 0; i < Length; i++, OutPos++)
+                Out[OutPos] = Out[OutPos - Distance];
+        }
+    }
+
+    /**
+     * A block compressed with the fixed codes that the format defines.
+     */
+    bool Inflater::Fixed() {
+        static Huffman Lengths, Distances;
+        static bool Built = [] {
+            uint8_t Sizes[288];
+            for(int i = 0; i < 144; i++) Sizes[i] = 8;
+            for(int i = 144; i < 256; i++) Sizes[i] = 9;
+            for(int i = 256; i < 280; i++) Sizes[i] = 7;
+            for(int i = 280; i < 288; i++) Sizes[i] = 8;
+            Build(Lengths, Sizes, 288);
+
+            for(int i = 0; i < 30; i++) Sizes[i] = 5;
+            Build(Distances, Sizes, 30);
+            return true;
+        }();
+        SHUTUPUNUSED(Built);
+
+        return Codes(Lengths, Distances);
+    }
+
+    /**
+     * A block compressed with codes of its own, which come first; themselves compressed with another code.
+     */
+    bool Inflater::Dynamic() {
+        static const uint8_t Order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+        int LengthCount = (int) Take(5) + 257;
+        int DistanceCount = (int) Take(5) + 1;
+        int CodeCount = (int) Take(4) + 4;
+        if(Failed || LengthCount > 286 || DistanceCount > 30) return false;
+
+        uint8_t Sizes[320] = {};
+        for(int i = 0; i < CodeCount; i++)
+            Sizes[Order[i]] = (uint8_t) Take(3);
+
+        Huffman Lengths, Distances;
+        if(Failed || !Build(Lengths, Sizes, 19)) return false;
+
+        // The lengths of both codes are read as one run, so that repeats can cross from one to the other.
+        for(int i = 0; i < LengthCount + DistanceCount;) {
+            int Symbol = Decode(Lengths);
+            if(Failed) return false;
+
+            if(Symbol < 16) {
+                Sizes[i++] = (uint8_t) Symbol;
+                continue;
+            }
+
+            uint8_t Size = 0;
+            int Repeat;
+            if(Symbol == 16) {
+                if(i == 0) return false;
+                Size = Sizes[i - 1];
+                Repeat = 3 + (int) Take(2);
+            } else if(Symbol == 17) {
+                Repeat = 3 + (int) Take(3);
+            } else {
+                Repeat = 11 + (int) Take(7);
+            }
+
+            if(Failed || i + Repeat > LengthCount + DistanceCount) return false;
+            while(Repeat--)
+                Sizes[i++] = Size;
+        }
+
+        // A block with no end can't be decoded.
+        if(Sizes[256] == 0) return false;
+
+        if(!Build(Lengths, Sizes, LengthCount) || !Build(Distances, Sizes + LengthCount, DistanceCount))
+            return false;
+
+        return Codes(Lengths, Distances);
+    }
+
+    /**
+     * Inflate the whole stream, block by block.
+     * @return whether the stream was valid, and filled the output exactly.
+     */
+    bool Inflater::Run() {
+        bool Last;
+
+        do {
+            Last = Take(1) == 1;
+            uint32_t Type = Take(2);
+            if(Failed) return false;
+
+            bool Valid;
+            switch(Type) {
+                case 0: Valid = Stored(); break;
+                case 1: Valid = Fixed(); break;
+                case 2: Valid = Dynamic(); break;
+                default: Valid = false; break;
+            }
+
+            if(!Valid) return false;
+        } while(!Last);
+
+        return OutPos == OutSize;
+    }
+}
+
+/**
+ * Find a class in the JAR.
+ *
+ * Stored classes are handed back where they are in the mapping. Deflated ones are inflated the first time they're
+ *  read, and kept by the JAR; classes are only read once each, so nothing is cached beyond that.
+ *
+ * @param ClassName the name of the class, from the Java Language's perspective; ie. java/lang/Object
+ * @param Length where to put the size of the class file
+ * @return the class file, or null if the JAR doesn't have it or it couldn't be read.
+ */
+const char* JarFile::Find(const std::string& ClassName, size_t& Length) {
+    auto Found = Entries.find(ClassName + ".class");
+    if(Found == Entries.end())
+        return nullptr;
+
+    const Entry& Class = Found->second;
+    const char* Data = File.GetData();
+    size_t Size = File.GetSize();
+
+    // The local header repeats most of the Central Directory, but its name and extra field can be different lengths.
+    if((size_t) Class.HeaderOffset + 30 > Size || ReadLittleInt(Data + Class.HeaderOffset) != 0x04034B50)
+        return nullptr;
+
+    size_t Start = (size_t) Class.HeaderOffset + 30 + ReadLittleShort(Data + Class.HeaderOffset + 26)
+                 + ReadLittleShort(Data + Class.HeaderOffset + 28);
+    if(Start > Size || Size - Start < Class.CompressedSize)
+        return nullptr;
+
+    switch(Class.Compression) {
+        case 0:
+            if(Class.Size != Class.CompressedSize) return nullptr;
+
+            Length = Class.Size;
+            return Data + Start;
+
+        case 8: {
+            std::unique_ptr<char[]> Buffer(new char[Class.Size == 0 ? 1 : Class.Size]);
+            Inflater Stream((const uint8_t*) Data + Start, Class.CompressedSize, (uint8_t*) Buffer.get(), Class.Size);
+            if(!Stream.Run()) {
+                printf("Unable to inflate %s.class\n", ClassName.c_str());
+                return nullptr;
+            }
+
+            Length = Class.Size;
+            const char* Result = Buffer.get();
+
+            std::lock_guard<std::mutex> lock(Lock);
+            Inflated.emplace_back(std::move(Buffer));
+            return Result;
+        }
+
+        default:
+            printf("%s.class uses unsupported compression method %d\n", ClassName.c_str(), Class.Compression);
+            return nullptr;
+    }
+}
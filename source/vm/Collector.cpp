@@ -0,0 +1,498 @@
+/**************
+ * GEMWIRE    *
+ *    PURPURI *
+ **************/
+
+#include <vm/Collector.hpp>
+#include <vm/Stack.hpp>
+
+#include <cstdio>
+#include <cstdlib>
+
+/**
+ * This file implements the Collector class, declared in Collector.hpp.
+ *
+ * Until this existed, nothing allocated in the Object Heap was ever given back.
+ * The Collector is designed so that the interpreter only stops for as long as it takes to look at the roots;
+ *  the expensive parts (tracing the heap, and freeing what's dead) run on a separate thread.
+ *
+ * A cycle looks like this:
+ *
+ *  Interpreter thread         │  Collector thread
+ *  ───────────────────────────┼──────────────────────────
+ *  allocates past Trigger     │  (waiting)
+ *  Safepoint: Initial Mark    │
+ *    grey the roots           │
+ *    enable the barrier       │
+ *  keeps executing,           │  Concurrent Mark
+ *   logging overwritten refs  │    trace from the grey set
+ *                             │    drain logged refs
+ *  Safepoint: Remark          │  (waiting)
+ *    drain the last logs      │
+ *    disable the barrier      │
+ *  keeps executing            │  Concurrent Sweep
+ *                             │    free unmarked Objects
+ *  Safepoint: finish          │  (waiting)
+ *
+ * Roots are the whole Member Stack, the static fields of every loaded class, every interned String, and anything the
+ *  VM has Pinned.
+ * Variables are untyped unions, so the Collector is conservative about the Member Stack and the static fields:
+ *  anything in them that looks like a reference to an Object in the arena is treated as one. The Block Start bitmap
+ *  is what tells us whether a value really lands on the start of an Object.
+ * This can keep some garbage alive for a cycle, but it will never free something that is still in use.
+ *
+ * Everything in the heap is scanned precisely. An instance's references are at the offsets its class worked out when
+ *  it was linked (see Class#GetReferenceOffsets), and arrays of primitives aren't scanned at all.
+ *
+ * Objects created after Initial Mark are born marked, so they're never swept in that cycle.
+ * This is the "allocate black" half of snapshot-at-the-beginning; the other half is the barrier.
+ *
+ * The sweep only looks at the arena below where the Top was at Remark. The free lists are dropped for the duration,
+ *  so the interpreter allocates from above that line and the two threads never meet.
+ *
+ * The Object Heap's metadata is only protected by its lock while the Collector is Active.
+ * Outside of a cycle, only the interpreter thread touches them, so it doesn't pay for the lock.
+ */
+
+bool Collector::Logging = false;
+Collector::Mode Collector::Algorithm = Collector::Concurrent;
+size_t Collector::Threads = 0;
+size_t Collector::Trigger = 8 * 1024 * 1024;
+std::atomic<bool> Collector::Requested(false);
+bool Collector::BarrierActive = false;
+bool Collector::Active = false;
+
+ClassHeap* Collector::Classes = nullptr;
+Collector::Phase Collector::CurrentPhase = Collector::Idle;
+
+std::thread Collector::Thread;
+std::mutex Collector::Locker;
+std::condition_variable Collector::Notifier;
+std::atomic<bool> Collector::Stopping(false);
+bool Collector::ThreadDone = false;
+
+size_t Collector::AllocatedSinceCycle = 0;
+size_t Collector::SweepLimit = 0;
+
+std::vector<size_t> Collector::Grey;
+std::vector<size_t> Collector::LocalLog;
+std::vector<size_t> Collector::SharedLog;
+
+size_t Collector::MarkedObjects = 0;
+size_t Collector::FreedObjects = 0;
+size_t Collector::FreedBytes = 0;
+double Collector::PhaseMillis = 0;
+
+// How many Objects the Collector thread marks before it lets go of the heap lock.
+#define COLLECTOR_BATCH 256
+
+// How many Granules the Collector thread sweeps before it lets go of the heap lock.
+#define SWEEP_BATCH 4096
+
+// The interpreter hands its SATB log over once it is this long.
+#define SATB_BUFFER 256
+
+void Collector::Attach(ClassHeap* Heap) {
+    Classes = Heap;
+}
+
+/**
+ * Keep track of how much has been allocated since the last cycle.
+ * Once it passes the Trigger, the interpreter is asked to stop at the next Safepoint to start a new one.
+ * @param Bytes the size of the new allocation
+ */
+void Collector::NotifyAllocation(size_t Bytes) {
+    AllocatedSinceCycle += Bytes;
+
+    if(CurrentPhase == Idle && AllocatedSinceCycle >= Trigger)
+        Requested.store(true, std::memory_order_relaxed);
+}
+
+/**
+ * The interpreter stops here between instructions whenever Requested is set.
+ * At this point, every live reference is either in the heap, on the Member Stack, or in a static field.
+ *
+ * Depending on the phase, this either starts a cycle, finishes marking, or finishes sweeping.
+ */
+void Collector::Safepoint() {
+    Requested.store(false, std::memory_order_relaxed);
+
+    switch(CurrentPhase) {
+        case Idle:
+            if(AllocatedSinceCycle < Trigger)
+                break;
+
+            if(Algorithm == Parallel)
+                Collect();
+            else
+                InitialMark();
+            break;
+
+        case Marking: {
+            std::unique_lock<std::mutex> lock(Locker);
+            if(!ThreadDone) return;
+            lock.unlock();
+
+            Remark();
+            break;
+        }
+
+        case Sweeping: {
+            std::unique_lock<std::mutex> lock(Locker);
+            if(!ThreadDone) return;
+            lock.unlock();
+
+            FinishSweep();
+            break;
+        }
+
+        default: break;
+    }
+}
+
+/**
+ * Free everything that can be freed, right now, for an allocation that didn't fit.
+ *
+ * This is called by the Object Heap from the middle of an instruction, rather than at a Safepoint, so it has to be
+ *  careful about what it assumes:
+ *  - The Member Stack is scanned whole, not just up to the Stack Pointer, so a value that an instruction has popped
+ *     but not finished with is still a root.
+ *  - Anything that the VM is holding on to between two allocations is Pinned. See ObjectHeap::Pinned.
+ *
+ * A concurrent cycle that's already running is finished first, as it can't be abandoned halfway. That alone isn't
+ *  enough, though; the cycle kept everything allocated while it ran, which is likely what filled the arena.
+ * So another whole cycle follows, from a fresh snapshot, with the interpreter waiting on it the entire time.
+ *
+ * The heap lock must not be held.
+ */
+void Collector::Reclaim() {
+    auto Start = std::chrono::steady_clock::now();
+
+    if(Logging)
+        fprintf(stderr, "[GC] Allocation failed, collecting before giving up\n");
+
+    FinishCycle();
+
+    if(Algorithm == Parallel) {
+        Collect();
+    } else {
+        InitialMark();
+        FinishCycle();
+    }
+
+    if(Logging)
+        fprintf(stderr, "[GC] Collection for allocation finished, %.3fms pause\n", ELAPSED_MS(Start));
+}
+
+/**
+ * Run whatever is left of the current concurrent cycle, waiting on the Collector thread for each phase.
+ * Nothing happens if there's no cycle running.
+ */
+void Collector::FinishCycle() {
+    if(CurrentPhase == Marking) {
+        WaitForThread();
+        Remark();
+    }
+
+    if(CurrentPhase == Sweeping) {
+        WaitForThread();
+        FinishSweep();
+    }
+}
+
+/**
+ * Wait until the Collector thread is done with its current phase.
+ */
+void Collector::WaitForThread() {
+    std::unique_lock<std::mutex> lock(Locker);
+    Notifier.wait(lock, [] { return ThreadDone || Stopping.load(); });
+}
+
+/**
+ * The SATB write barrier.
+ * When a reference in the heap is about to be overwritten during marking, the old value is logged here so that it
+ *  is still marked - it was reachable at the start of the cycle, so it must survive it.
+ *
+ * The log is kept local to the interpreter until it fills, so that most stores don't need the Collector's lock.
+ * @param Old the value being overwritten
+ */
+void Collector::Remember(Variable Old) {
+    if(Old.pointerVal == 0) return;
+
+    LocalLog.push_back(Old.pointerVal);
+
+    if(LocalLog.size() >= SATB_BUFFER) {
+        std::lock_guard<std::mutex> lock(Locker);
+        SharedLog.insert(SharedLog.end(), LocalLog.begin(), LocalLog.end());
+        LocalLog.clear();
+    }
+}
+
+/**
+ * Pass every root to the given function.
+ * Only call this while the interpreter is stopped at a Safepoint.
+ * @param Visit called with the value of every root slot
+ * @return how many root slots there were
+ */
+size_t Collector::ScanRoots(void (*Visit)(size_t)) {
+    // The Member Stack holds the locals and operands of every frame that is currently executing.
+    for(size_t i = 0; i < StackFrame::MemberStackSize; i++)
+        Visit(StackFrame::MemberStack[i].pointerVal);
+
+    // Static fields live outside of the heap, so they're roots too.
+    size_t Roots = StackFrame::MemberStackSize;
+    if(Classes != nullptr) {
+        for(Class* Class : Classes->GetAllClasses()) {
+            Variable* Statics = Class->GetStatics();
+            if(Statics == nullptr) continue;
+
+            for(size_t i = 0; i < Class->GetStaticsCount(); i++)
+                Visit(Statics[i].pointerVal);
+            Roots += Class->GetStaticsCount();
+        }
+    }
+
+    // Interned Strings are never freed, whether or not anything else still refers to them.
+    for(auto& Entry : Engine::_ObjectHeap.InternTable)
+        Visit(Entry.second.Heap);
+    Roots += Engine::_ObjectHeap.InternTable.size();
+
+    // Objects the VM is still putting together, if an allocation collected in the middle of it.
+    for(size_t Ref : Engine::_ObjectHeap.Pinned)
+        Visit(Ref);
+    Roots += Engine::_ObjectHeap.Pinned.size();
+
+    return Roots;
+}
+
+/**
+ * Start a cycle.
+ *
+ * This is the first of the two pauses, and it only looks at the roots - never at the rest of the heap.
+ * The Collector thread is idle at this point, so the heap lock isn't needed.
+ */
+void Collector::InitialMark() {
+    auto Start = std::chrono::steady_clock::now();
+
+    ObjectHeap& Heap = Engine::_ObjectHeap;
+
+    Heap.ClearMarks();
+    Heap.AllocateBlack = true;
+    AllocatedSinceCycle = 0;
+    MarkedObjects = 0;
+    FreedObjects = 0;
+    FreedBytes = 0;
+
+    size_t Roots = ScanRoots(Shade);
+    size_t GreyCount = Grey.size();
+
+    BarrierActive = true;
+    Active = true;
+
+    {
+        std::lock_guard<std::mutex> lock(Locker);
+        CurrentPhase = Marking;
+        ThreadDone = false;
+    }
+
+    // The Collector thread is only spun up once there is something for it to do.
+    if(!Thread.joinable()) {
+        Thread = std::thread(Run);
+        std::atexit(Rejoin);
+    }
+
+    Notifier.notify_all();
+
+    if(Logging)
+        fprintf(stderr, "[GC] Initial mark: " PrtSizeT " roots, " PrtSizeT " objects grey, %.3fms pause\n", Roots, GreyCount, ELAPSED_MS(Start));
+}
+
+/**
+ * The second pause.
+ * The Collector thread has run out of grey Objects, but the interpreter may have logged more since.
+ * They're drained here, and then the barrier is switched off and sweeping can start.
+ */
+void Collector::Remark() {
+    auto Start = std::chrono::steady_clock::now();
+
+    ObjectHeap& Heap = Engine::_ObjectHeap;
+    size_t Logged;
+
+    {
+        std::lock_guard<std::mutex> heapLock(Heap.Lock);
+        std::lock_guard<std::mutex> lock(Locker);
+
+        Logged = SharedLog.size() + LocalLog.size();
+        for(size_t ID : SharedLog) Shade(ID);
+        for(size_t ID : LocalLog) Shade(ID);
+        SharedLog.clear();
+        LocalLog.clear();
+
+        Drain(SIZE_MAX);
+
+        // Large objects are swept right now, so the sweep thread never has to look at them.
+        SweepState Large {};
+        Heap.SweepLarge(Large);
+        FreedObjects += Large.Freed;
+        FreedBytes += Large.FreedBytes;
+
+        // Everything below the Top is either marked or garbage now. The sweep has it all to itself.
+        Heap.AllocateBlack = false;
+        Heap.DropFreeLists();
+        SweepLimit = Heap.Top;
+
+        BarrierActive = false;
+        CurrentPhase = Sweeping;
+        ThreadDone = false;
+    }
+
+    Notifier.notify_all();
+
+    if(Logging)
+        fprintf(stderr, "[GC] Remark: " PrtSizeT " logged references, " PrtSizeT " objects marked, %.3fms concurrent mark, %.3fms pause\n", Logged, MarkedObjects, PhaseMillis, ELAPSED_MS(Start));
+}
+
+/**
+ * The end of a cycle.
+ * The Collector thread is done with the heap, so the interpreter can stop locking it.
+ */
+void Collector::FinishSweep() {
+    Active = false;
+    CurrentPhase = Idle;
+
+    if(Logging)
+        fprintf(stderr, "[GC] Sweep: freed " PrtSizeT " objects (" PrtSizeT " bytes), %.3fms concurrent sweep\n", FreedObjects, FreedBytes, PhaseMillis);
+}
+
+/**
+ * Mark a single value, if it refers to an unmarked Object.
+ * If the Object could contain references, it goes into the grey set to be scanned later.
+ * Everything allocated since the snapshot is already marked, so it's skipped here.
+ *
+ * The heap lock must be held, unless the Collector thread is known to be idle.
+ * @param Candidate a value that may be a reference to an Object
+ */
+void Collector::Shade(size_t Candidate) {
+    ObjectHeap& Heap = Engine::_ObjectHeap;
+
+    if(!Heap.IsObject(Candidate) || !Heap.TryMark(Candidate)) return;
+
+    MarkedObjects++;
+
+    if(Heap.HeaderAt(Candidate - 1)->Flags & BLOCK_REFERENCES)
+        Grey.push_back(Candidate);
+}
+
+/**
+ * Scan grey Objects until either they run out or the budget does.
+ *
+ * The heap lock must be held.
+ * @param Budget the maximum number of Objects to scan
+ * @return how many Objects were scanned
+ */
+size_t Collector::Drain(size_t Budget) {
+    size_t Scanned = 0;
+
+    while(!Grey.empty() && Scanned < Budget) {
+        size_t Ref = Grey.back();
+        Grey.pop_back();
+
+        Engine::_ObjectHeap.ForEachReference(Ref, Shade);
+
+        Scanned++;
+    }
+
+    return Scanned;
+}
+
+/**
+ * Free every Object below the Sweep Limit that was not marked, and rebuild the free lists from the gaps.
+ * The heap lock is taken in batches, so the interpreter is never blocked for long.
+ * The interpreter only allocates above the Sweep Limit until we're done, so it's safe to keep our place in between.
+ */
+void Collector::Sweep() {
+    ObjectHeap& Heap = Engine::_ObjectHeap;
+    SweepState State {};
+    size_t Cursor = 1;
+
+    while(Cursor < SweepLimit && !Stopping.load()) {
+        std::lock_guard<std::mutex> heapLock(Heap.Lock);
+        Cursor = Heap.Sweep(Cursor, std::min(SweepLimit, Cursor + SWEEP_BATCH), State);
+    }
+
+    std::lock_guard<std::mutex> heapLock(Heap.Lock);
+    Heap.FinishRun(State);
+    Heap.InstallFreeLists(State);
+
+    FreedObjects += State.Freed;
+    FreedBytes += State.FreedBytes;
+}
+
+/**
+ * The body of the Collector thread.
+ * It sleeps until the interpreter starts a phase, runs that phase to completion, and then asks the interpreter to
+ *  come back to a Safepoint so that the next phase can start.
+ */
+void Collector::Run() {
+    ObjectHeap& Heap = Engine::_ObjectHeap;
+
+    while(true) {
+        Phase Current;
+        {
+            std::unique_lock<std::mutex> lock(Locker);
+            Notifier.wait(lock, [] { return Stopping.load() || (!ThreadDone && (CurrentPhase == Marking || CurrentPhase == Sweeping)); });
+            if(Stopping.load()) return;
+            Current = CurrentPhase;
+        }
+
+        auto Start = std::chrono::steady_clock::now();
+
+        if(Current == Marking) {
+            std::vector<size_t> Logged;
+
+            while(!Stopping.load()) {
+                {
+                    std::lock_guard<std::mutex> lock(Locker);
+                    Logged.swap(SharedLog);
+                }
+
+                std::lock_guard<std::mutex> heapLock(Heap.Lock);
+                for(size_t ID : Logged) Shade(ID);
+                Logged.clear();
+
+                Drain(COLLECTOR_BATCH);
+
+                if(Grey.empty()) {
+                    std::lock_guard<std::mutex> lock(Locker);
+                    if(SharedLog.empty()) break;
+                }
+            }
+        } else {
+            Sweep();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(Locker);
+            PhaseMillis = ELAPSED_MS(Start);
+            ThreadDone = true;
+        }
+        // Reclaim may be waiting on this, rather than the next Safepoint.
+        Notifier.notify_all();
+        Requested.store(true, std::memory_order_relaxed);
+    }
+}
+
+/**
+ * Stop the Collector thread, wherever it is.
+ * This is registered with atexit, since the VM has a habit of calling exit() when something goes wrong.
+ */
+void Collector::Rejoin() {
+    {
+        std::lock_guard<std::mutex> lock(Locker);
+        Stopping.store(true);
+    }
+    Notifier.notify_all();
+
+    if(Thread.joinable())
+        Thread.join();
+}
@@ -6,6 +6,7 @@
 #include <vm/Stack.hpp>
 #include <vm/Class.hpp>
 #include <vm/Native.hpp>
+#include <vm/Collector.hpp>
 
 #include <vm/debug/Debug.hpp>
 
@@ -69,6 +70,9 @@
 // Thus, this needs to be carefully managed to ensure there is no underflow.
 Variable* StackFrame::MemberStack;
 
+// How many Variables are in the Member Stack. The Collector scans all of them for roots.
+size_t StackFrame::MemberStackSize = 0;
+
 // Originally intended to hold the root execution frame, but seems unused in recent refactors.
 [[maybe_unused]] StackFrame* StackFrame::FrameBase;
 
@@ -76,7 +80,7 @@ Variable* StackFrame::MemberStack;
 ObjectHeap Engine::_ObjectHeap;
 
 // The static boolean flag that controls the print output level. If true, printf and puts across the code base will be passed to stdout.
-bool Engine::QuietMode = false;
+std::atomic<bool> Engine::QuietMode(false);
 
 Engine::Engine() {
     _ClassHeap = nullptr;
@@ -100,6 +104,7 @@ void Engine::InvokeNative(const NativeContext& Context) {
     // We then set the static field for the parameters of the current native call.
     // TODO: static field usage
     Native::Parameters = Context.Parameters;
+    Native::Instance = Context.ClassInstance != nullptr ? *Context.ClassInstance : ObjectHeap::Null;
 
     // The libnative library was loaded in EntryPoint.cpp, so we can just ask the Native module to search for the function for us.
     auto func = Native::LoadSymbol(NATIVES_FILE, FunctionName);
@@ -138,7 +143,7 @@ uint32_t Engine::Ignite(StackFrame* Stack) {
 
     // Some metadata for debug printing.
     Class* Class = CurrentFrame->_Class;
-    std::string Name = Class->GetStringConstant(CurrentFrame->_Method->Name);
+    const std::string& Name = Class->GetStringConstant(CurrentFrame->_Method->Name);
 
     printf("Executing %s::%s\n", Class->GetClassName().c_str(), Name.c_str());
 
@@ -149,6 +154,11 @@ uint32_t Engine::Ignite(StackFrame* Stack) {
     // This loop can only be broken by a method return.
     while(true) {
 
+        // Between instructions is the only time the Collector is allowed to pause us.
+        // Every live reference is either in the heap, on the Member Stack or in a static field here.
+        if(Collector::Requested.load(std::memory_order_relaxed))
+            Collector::Safepoint();
+
         // Before every instruction, we should notify the debugger what's happening.
         // The DEBUG macro only executes the containing code if the Visual Debugger is selected for compilation.
         DEBUG({
@@ -191,6 +201,12 @@ uint32_t Engine::Ignite(StackFrame* Stack) {
                 printf("Initialized new object\n");
                 break;
 
+            // Purpuri: new, once the class is known to be initialized.
+            case Instruction::new_quick:
+                NewQuick(CurrentFrame);
+                PCPLUS 3;
+                break;
+
             // arraylength: push the size in entries of the array currently on the stack
             // Purpuri: push(pop().size())
             case Instruction::arraylength:
@@ -213,10 +229,18 @@ uint32_t Engine::Ignite(StackFrame* Stack) {
             // Purpuri: see the ANewArray function in this file for more details.
             case Instruction::anewarray:
                 ANewArray(CurrentFrame);
-                PCPLUS 2;
+                PCPLUS 3;
                 printf("Initialized new a-array\n");
                 break;
 
+            // multinewarray: allocate and push a new array of arrays, with the given number of dimensions.
+            // Purpuri: see the MultiNewArray function in this file for more details.
+            case Instruction::multinewarray:
+                MultiNewArray(CurrentFrame);
+                PCPLUS 4;
+                printf("Initialized new multi-array\n");
+                break;
+
             // bcdup: duplicate the reference on the stack.
             // Purpuri: push(peek())
             case Instruction::bcdup:
@@ -253,6 +277,12 @@ uint32_t Engine::Ignite(StackFrame* Stack) {
                 PCPLUS 3;
                 break;
 
+            // Purpuri: invokestatic, once the method is resolved and its class is initialized.
+            case Instruction::invokestatic_quick:
+                InvokeStaticQuick(CurrentFrame);
+                PCPLUS 3;
+                break;
+
             // putstatic: place data into a static field.
             case Instruction::putstatic:
                 PutStatic(CurrentFrame);
@@ -260,6 +290,13 @@ uint32_t Engine::Ignite(StackFrame* Stack) {
                 PCPLUS 3;
                 break;
 
+            // Purpuri: putstatic, once the field is resolved and its class is initialized.
+            case Instruction::putstatic_quick:
+                PutStaticQuick(CurrentFrame);
+                CurrentFrame->StackPointer--;
+                PCPLUS 3;
+                break;
+
             // putfield: place data into an instance field.
             case Instruction::putfield:
                 PutField(CurrentFrame);
@@ -275,6 +312,13 @@ uint32_t Engine::Ignite(StackFrame* Stack) {
                 printf("Got value " PrtSizeT ".\n", Stack->Stack[Stack->StackPointer].pointerVal);
                 break;
 
+            // Purpuri: getstatic, once the field is resolved and its class is initialized.
+            case Instruction::getstatic_quick:
+                GetStaticQuick(CurrentFrame);
+                CurrentFrame->StackPointer++;
+                PCPLUS 3;
+                break;
+
             // getfield: read data from an instance field
             case Instruction::getfield:
                 GetField(CurrentFrame);
@@ -309,9 +353,9 @@ uint32_t Engine::Ignite(StackFrame* Stack) {
             case Instruction::iconst_4:
             case Instruction::iconst_5:
                 CurrentFrame->StackPointer++;
-                PEEK.intVal = (uint8_t) Code[CurrentFrame->ProgramCounter] - Instruction::iconst_0;
+                PEEK = Variable((int) Code[CurrentFrame->ProgramCounter] - Instruction::iconst_0);
                 CurrentFrame->ProgramCounter++;
-                printf("Pushed int constant %d to the stack\n", PEEK.intVal);
+                printf("Pushed int constant %d to the stack\n", (int32_t) PEEK.intVal);
                 break;
 
             // istore_x: store the int on the top of the stack into local x.
@@ -340,21 +384,42 @@ uint32_t Engine::Ignite(StackFrame* Stack) {
             // xaload: read the index and array from the stack in that order, and interpret the value of the array at that index as the type x.
             // Purpuri: int idx = pop(); push(pop()[idx])
             // Purpuri: a = object b = byte c = char s = short i = int l = long f = float d = double
+            // References may be stored compressed, so the Object Heap does the reading.
             case Instruction::aaload:
+                UNDER = Variable(_ObjectHeap.LoadElement(UNDER.object, PEEK.intVal));
+                printf("Pulled reference " PrtSizeT " out of the " PrtSizeT "th entry of array object " PrtSizeT "\n", UNDER.pointerVal, (size_t) PEEK.intVal + 1, UNDER.object.Heap);
+			    CurrentFrame->StackPointer--;
+                PCPLUS 1;
+			    break;
+
+            // Primitive arrays are packed at the natural width of their type, so the instruction decides how much to read.
+            // byte, short and char are widened to int as they're pushed; the first two are signed, char is not.
             case Instruction::baload:
             case Instruction::caload:
             case Instruction::saload:
             case Instruction::iaload:
             case Instruction::laload:
             case Instruction::faload:
-            case Instruction::daload:
-                UNDER =
-                    _ObjectHeap.GetObjectPtr(UNDER.object)
-                        [PEEK.intVal + 1];
-                printf("Pulled value " PrtSizeT " (%.6f) out of the " PrtSizeT "th entry of array object " PrtSizeT "\n", UNDER.pointerVal, UNDER.floatVal, (size_t) PEEK.intVal + 1, UNDER.object.Heap);
+            case Instruction::daload: {
+                uint8_t* Elements = _ObjectHeap.GetArrayData(UNDER.object);
+                Index = PEEK.intVal;
+                Variable Loaded;
+
+                switch(Code[CurrentFrame->ProgramCounter]) {
+                    case Instruction::baload: Loaded.intVal = (int32_t) ((int8_t*) Elements)[Index]; break;
+                    case Instruction::caload: Loaded.intVal = ((uint16_t*) Elements)[Index]; break;
+                    case Instruction::saload: Loaded.intVal = (int32_t) ((int16_t*) Elements)[Index]; break;
+                    case Instruction::iaload:
+                    case Instruction::faload: Loaded.intVal = ((uint32_t*) Elements)[Index]; break;
+                    default:                  Loaded.pointerVal = ((uint64_t*) Elements)[Index]; break;
+                }
+
+                UNDER = Loaded;
+                printf("Pulled value " PrtSizeT " (%.6f) out of entry %d of a primitive array\n", UNDER.pointerVal, UNDER.floatVal, Index);
 			    CurrentFrame->StackPointer--;
                 PCPLUS 1;
 			    break;
+            }
 
             // fload_x: store the float in local x on the stack.
             // Purpuri: push((float) locals[x])
@@ -416,13 +481,67 @@ uint32_t Engine::Ignite(StackFrame* Stack) {
                     PEEK.intVal);
                 break;
 
+            // iand: bitwise and the two integers on the stack
+            // Purpuri: push(pop() & pop())
+            case Instruction::iand:
+                UNDER = Variable((int) (UNDER.intVal & PEEK.intVal));
+                CurrentFrame->StackPointer--;
+                PCPLUS 1;
+                printf("And'd the last two integers on the stack (result %d)\r\n", PEEK.intVal);
+                break;
+
+            // ior: bitwise or the two integers on the stack
+            // Purpuri: push(pop() | pop())
+            case Instruction::ior:
+                UNDER = Variable((int) (UNDER.intVal | PEEK.intVal));
+                CurrentFrame->StackPointer--;
+                PCPLUS 1;
+                printf("Or'd the last two integers on the stack (result %d)\r\n", PEEK.intVal);
+                break;
+
+            // ishl: shift the integer under the top of the stack left, by the low 5 bits of the top
+            // Purpuri: push(under << (pop() & 31))
+            case Instruction::ishl:
+                UNDER = Variable((int) (UNDER.intVal << (PEEK.intVal & 31)));
+                CurrentFrame->StackPointer--;
+                PCPLUS 1;
+                printf("Shifted an integer left (result %d)\r\n", PEEK.intVal);
+                break;
+
+            // ishr: shift the integer under the top of the stack right, keeping the sign
+            // Purpuri: push(under >> (pop() & 31))
+            case Instruction::ishr:
+                UNDER = Variable((int) ((int32_t) UNDER.intVal >> (PEEK.intVal & 31)));
+                CurrentFrame->StackPointer--;
+                PCPLUS 1;
+                printf("Shifted an integer right (result %d)\r\n", PEEK.intVal);
+                break;
+
+            // iushr: shift the integer under the top of the stack right, filling with zeroes
+            // Purpuri: push(under >>> (pop() & 31))
+            case Instruction::iushr:
+                UNDER = Variable((int) (UNDER.intVal >> (PEEK.intVal & 31)));
+                CurrentFrame->StackPointer--;
+                PCPLUS 1;
+                printf("Shifted an integer right, unsigned (result %d)\r\n", PEEK.intVal);
+                break;
+
             // i2c: convert int to char
             // Purpuri: (char) pop()
             case Instruction::i2c:
+                PEEK = Variable((int) (uint16_t) PEEK.intVal);
                 PCPLUS 1;
                 printf("Int " PrtSizeT " converted to char.\n", PEEK.pointerVal);
                 break;
 
+            // i2b: convert int to byte, keeping the sign
+            // Purpuri: (byte) pop()
+            case Instruction::i2b:
+                PEEK = Variable((int) (int8_t) PEEK.intVal);
+                PCPLUS 1;
+                printf("Int %d converted to byte.\n", (int32_t) PEEK.intVal);
+                break;
+
             // i2d: convert int to double
             // Purpuri: (double) pop()
             case Instruction::i2d:
@@ -445,10 +564,10 @@ uint32_t Engine::Ignite(StackFrame* Stack) {
             case Instruction::ldc2_w:
                 Index = ReadShortFromStream(&Code[CurrentFrame->ProgramCounter + 1]);
                 CurrentFrame->StackPointer++;
-                PEEK.pointerVal = ReadLongFromStream(&((char *)Class->Constants[Index])[1]);
+                PEEK.pointerVal = (size_t) Class->Constants[Index].Long;
                 PCPLUS 3;
 
-                printf("Pushed constant %d of type %d, value 0x" PrtHex64 " / %.6f onto the stack\n", Index, Class->Constants[Index]->Tag, PEEK.pointerVal, PEEK.doubleVal);
+                printf("Pushed constant %d of type %d, value 0x" PrtHex64 " / %.6f onto the stack\n", Index, Class->Constants[Index].Tag, PEEK.pointerVal, PEEK.doubleVal);
                 break;
 
             // ddiv: divide the two doubles on the stack.
@@ -532,38 +651,39 @@ uint32_t Engine::Ignite(StackFrame* Stack) {
 
             // aastore: store the reference object on the stack into the array on the stack.
 		    case Instruction::aastore:
-			    _ObjectHeap.GetObjectPtr(CurrentFrame->Stack[CurrentFrame->StackPointer - 2].object)
-                    [UNDER.intVal + 1] =
-                        PEEK;
+                // This may overwrite a reference, so it goes through the Collector's write barrier.
+			    _ObjectHeap.StoreElement(CurrentFrame->Stack[CurrentFrame->StackPointer - 2].object, UNDER.intVal, PEEK.object);
                 printf("Stored reference %d into the " PrtSizeT "th entry of array object " PrtSizeT ".\n", PEEK.intVal, (size_t) UNDER.intVal + 1, CurrentFrame->Stack[CurrentFrame->StackPointer - 2].object.Heap);
 			    CurrentFrame->StackPointer -= 3;
 			    PCPLUS 1;
 			    break;
 
-            // [ialsbc]astore: store the integer data on the stack into the array on the stack.
+            // [ialsbcfd]astore: store the number on the stack into the primitive array on the stack.
+            // The value is narrowed to the width of the array's elements; see the xaload instructions above.
             case Instruction::iastore:
             case Instruction::lastore:
             case Instruction::sastore:
             case Instruction::bastore:
             case Instruction::castore:
-            	_ObjectHeap.GetObjectPtr(CurrentFrame->Stack[CurrentFrame->StackPointer - 2].object)
-                    [UNDER.intVal + 1] =
-                        PEEK;
-                printf("Stored number %d into the " PrtSizeT "th entry of array object " PrtSizeT ".\n", PEEK.intVal, (size_t) UNDER.intVal, CurrentFrame->Stack[CurrentFrame->StackPointer - 2].object.Heap);
-			    CurrentFrame->StackPointer -= 3;
-			    PCPLUS 1;
-			    break;
-
-            // [fd]astore: store the floating point number on the stack into the array on the stack.
             case Instruction::fastore:
-            case Instruction::dastore:
-                _ObjectHeap.GetObjectPtr(CurrentFrame->Stack[CurrentFrame->StackPointer - 2].object)
-                    [UNDER.intVal + 1] =
-                        PEEK;
-                printf("Stored number (%.6f) into the " PrtSizeT "th entry of array object " PrtSizeT ".\n", PEEK.doubleVal, (size_t) UNDER.intVal + 1, CurrentFrame->Stack[CurrentFrame->StackPointer - 2].object.Heap);
+            case Instruction::dastore: {
+                uint8_t* Elements = _ObjectHeap.GetArrayData(CurrentFrame->Stack[CurrentFrame->StackPointer - 2].object);
+                Index = UNDER.intVal;
+
+                switch(Code[CurrentFrame->ProgramCounter]) {
+                    case Instruction::bastore: ((uint8_t*) Elements)[Index] = (uint8_t) PEEK.intVal; break;
+                    case Instruction::castore:
+                    case Instruction::sastore: ((uint16_t*) Elements)[Index] = (uint16_t) PEEK.intVal; break;
+                    case Instruction::iastore:
+                    case Instruction::fastore: ((uint32_t*) Elements)[Index] = PEEK.intVal; break;
+                    default:                   ((uint64_t*) Elements)[Index] = PEEK.pointerVal; break;
+                }
+
+                printf("Stored number " PrtSizeT " (%.6f) into entry %d of array object " PrtSizeT ".\n", PEEK.pointerVal, PEEK.floatVal, Index, CurrentFrame->Stack[CurrentFrame->StackPointer - 2].object.Heap);
 			    CurrentFrame->StackPointer -= 3;
 			    PCPLUS 1;
 			    break;
+            }
 
             // drem: push the remainder of the division of the two doubles on the stack.
             case Instruction::_drem: {
@@ -678,33 +798,51 @@ uint32_t Engine::Ignite(StackFrame* Stack) {
             // bipush: push the integer type "byte" of a certain value to the stack.
             case Instruction::bipush:
                 CurrentFrame->StackPointer++;
-                PEEK.charVal = (uint8_t) Code[CurrentFrame->ProgramCounter + 1];
+                PEEK = Variable((int) (int8_t) Code[CurrentFrame->ProgramCounter + 1]);
                 PCPLUS 2;
-                printf("Pushed char %d to the stack\n", PEEK.charVal);
+                printf("Pushed byte %d to the stack\n", (int32_t) PEEK.intVal);
                 break;
 
             // sipush: push the integer type "short" of a certain value to the stack.
             case Instruction::sipush:
                 CurrentFrame->StackPointer++;
-                PEEK.shortVal = ReadShortFromStream(Code + (CurrentFrame->ProgramCounter + 1));
+                PEEK = Variable((int) (int16_t) ReadShortFromStream(Code + (CurrentFrame->ProgramCounter + 1)));
                 PCPLUS 3;
-                printf("Pushed short %d to the stack\n", PEEK.shortVal);
+                printf("Pushed short %d to the stack\n", (int32_t) PEEK.intVal);
+                break;
+
+            // ifeq: if value on stack equal to 0, jump to specified location
+            case Instruction::ifeq: {
+                bool Equal = PEEK.intVal == 0;
+                printf("Comparing: %d == 0\n", (int32_t) PEEK.intVal);
+                printf("Integer equality comparison returned %s\n", Equal ? "true" : "false");
+
+                CurrentFrame->StackPointer--;
+
+                // Bytecode stores our destination, but just skip past it if we want to continue on our code path
+                if(Equal) {
+                    short Offset = (Code[CurrentFrame->ProgramCounter + 1] << 8) | (Code[CurrentFrame->ProgramCounter + 2]);
+                    printf("Jumping to (%d + %hd) = %d\n", CurrentFrame->ProgramCounter, Offset, CurrentFrame->ProgramCounter + Offset);
+                    PCPLUS Offset;
+                } else {
+                    PCPLUS 3;
+                }
                 break;
+            }
 
             // ifne: if value on stack not equal to 0, jump to specified location
             case Instruction::ifne: {
-                bool NotEqual = PEEK.pointerVal != 0;
-                printf("Comparing: " PrtInt64 " != 0\n", PEEK.pointerVal);
+                bool NotEqual = PEEK.intVal != 0;
+                printf("Comparing: %d != 0\n", (int32_t) PEEK.intVal);
                 printf("Integer equality comparison returned %s\n", NotEqual ? "true" : "false");
 
-                CurrentFrame->StackPointer -= 2;
+                CurrentFrame->StackPointer--;
 
                 // Bytecode stores our destination, but just skip past it if we want to continue on our code path
                 if(NotEqual) {
                     short Offset = (Code[CurrentFrame->ProgramCounter + 1] << 8) | (Code[CurrentFrame->ProgramCounter + 2]);
                     printf("Jumping to (%d + %hd) = %d\n", CurrentFrame->ProgramCounter, Offset, CurrentFrame->ProgramCounter + Offset);
                     PCPLUS Offset;
-                    CurrentFrame->ProgramCounter += Offset;
                 } else {
                     PCPLUS 3;
                 }
@@ -866,28 +1004,24 @@ Variable Engine::GetConstant(Class *Class, uint8_t Index) const {
     Variable temp;
     temp.pointerVal = 0;
 
-    char* Code = (char*) Class->Constants[Index];
-    uint16_t shortTemp;
-    Object obj {};
+    const ConstantPoolEntry& Constant = Class->Constants[Index];
 
-    switch(Code[0]) {
+    switch(Constant.Tag) {
         // Floats and Integers are single-wide.
         case TypeFloat:
         case TypeInteger:
-            temp.intVal = ReadIntFromStream(&Code[1]);
+            temp.intVal = (uint32_t) Constant.Int;
             break;
 
-        // Strings are arbitrary width
+        // Strings are interned, so each literal is only created once.
         case TypeString:
-            shortTemp = ReadShortFromStream(&Code[1]);
-            obj = _ObjectHeap.CreateString(Class->GetStringConstant(shortTemp), _ClassHeap);
-            temp.pointerVal = obj.Heap;
+            temp.object = Class->ResolveString(Index, &_ObjectHeap);
             break;
 
         // Doubles and longs are double-wide
         case TypeDouble:
         case TypeLong:
-            temp.pointerVal = ReadLongFromStream(&Code[1]);
+            temp.pointerVal = (size_t) Constant.Long;
             break;
     }
 
@@ -910,15 +1044,91 @@ Variable Engine::GetConstant(Class *Class, uint8_t Index) const {
 int Engine::New(StackFrame *Stack) {
     auto Index = ReadShortFromStream(&Stack->_Method->Code->Code[Stack->ProgramCounter + 1]);
 
-    Object newObj = Stack->_Class->CreateObject(Index, &_ObjectHeap);
-    if(newObj == ObjectHeap::Null)
+    // The template is resolved the first time this class constant is used; after that, this is just a bump and a header store.
+    const AllocationTemplate& Template = Stack->_Class->ResolveAllocation(Index);
+    if(Template.Klass == 0)
         return false;
 
+    // The first new of a class initializes it. After that, this instruction never needs to check again.
+    if(InitializeClass((class Class*) Template.Klass, &Stack[1], &Stack->Stack[Stack->StackPointer + 1]))
+        Stack->_Class->RewriteCode(&Stack->_Method->Code->Code[Stack->ProgramCounter], Instruction::new_quick);
+
+    Object newObj = _ObjectHeap.CreateObject(Template);
+
     printf("New object is in ObjectHeap position " PrtSizeT ".\n", newObj.Heap);
     Stack->Stack[++Stack->StackPointer].object = newObj;
     return true;
 }
 
+/**
+ * The quick version of new, which replaces it once the class is resolved and initialized.
+ * There's nothing left to check; it's only the allocation.
+ *
+ * @param Stack the StackFrame of the currently executing method.
+ */
+void Engine::NewQuick(StackFrame* Stack) {
+    auto Index = ReadShortFromStream(&Stack->_Method->Code->Code[Stack->ProgramCounter + 1]);
+
+    Stack->Stack[++Stack->StackPointer].object = _ObjectHeap.CreateObject(Stack->_Class->GetResolvedAllocation(Index));
+}
+
+/**
+ * The initialization barrier; make sure a class is initialized before it's used.
+ *
+ * A class is loaded when it's first referenced, but only initialized when it's first actively used; when it's
+ *  instantiated with new, when one of its static fields is read or written, or when one of its static methods is
+ *  called. Each of those instructions calls this first.
+ * Once the class is initialized, the instruction replaces itself in the bytecode with a quick version that doesn't
+ *  call this any more, so the barrier costs nothing after the first time. See Instruction#new_quick.
+ *
+ * The super class is initialized first.
+ * A class that is already being initialized is being used by its own static initializer (or something it called),
+ *  and Java lets that go ahead with the statics as they are. The instruction can't be made quick yet, though.
+ *
+ * The initializer runs in the given frame, which has to be free; usually it's the one above the method executing.
+ * Its stack starts at Base, which has to be above anything the executing method still needs.
+ * Static initializers get very spammy, so they run in quiet mode with the debugger turned off.
+ *
+ * @param pClass the class about to be used
+ * @param Frame the Stack Frame to run the initializer in
+ * @param Base the first free slot on the Member Stack
+ * @return true if the class is initialized, false if it is still being initialized.
+ */
+bool Engine::InitializeClass(class Class* pClass, StackFrame* Frame, Variable* Base) {
+    if(pClass->GetInitState() == Class::Initialized) return true;
+    if(pClass->GetInitState() == Class::Initializing) return false;
+
+    pClass->SetInitState(Class::Initializing);
+
+    if(pClass->GetSuper() != nullptr)
+        InitializeClass(pClass->GetSuper(), Frame, Base);
+
+    uint32_t Init = pClass->GetMethodFromDescriptor("<clinit>", "()V", pClass->GetClassName().c_str(), pClass);
+
+    // If there's no static initializer, there's nothing else to do.
+    if(Init != std::numeric_limits<uint32_t>::max()) {
+        bool quiet = Engine::QuietMode;
+        bool debug = Debugger::Enabled;
+        Engine::QuietMode = true;
+        Debugger::Enabled = false;
+
+        *Frame = StackFrame();
+        Frame->_Class = pClass;
+        Frame->_Method = &pClass->Methods[Init];
+        Frame->Stack = Base;
+        Frame->StackPointer = Frame->_Method->Code->LocalsSize;
+
+        print("Running static initializer for class %s\n", pClass->GetClassName().c_str());
+        Ignite(Frame);
+
+        Engine::QuietMode = quiet;
+        Debugger::Enabled = debug;
+    }
+
+    pClass->SetInitState(Class::Initialized);
+    return true;
+}
+
 /**
  * Create a new array of primitives and push it to the stack.
  * The length of the array is stored on the stack.
@@ -959,12 +1169,52 @@ void Engine::ANewArray(StackFrame* Stack) {
     auto Index = ReadShortFromStream(&Stack->_Method->Code->Code[Stack->ProgramCounter + 1]);
     uint32_t Count = Stack->Stack[Stack->StackPointer].intVal; // pop
 
-    if(!Stack->_Class->CreateObjectArray(Index, Count, _ObjectHeap, Stack->Stack[++Stack->StackPointer].object)) // push
+    if(!Stack->_Class->CreateObjectArray(Index, Count, &_ObjectHeap, Stack->Stack[Stack->StackPointer].object)) // push
         // TODO: ERROR
         printf("Initializing array failed.");
     printf("Initialized a %d-wide array of objects.\n", Count);
 }
 
+/**
+ * Create a new multi-dimensional array and push it to the stack.
+ * The length of each dimension is on the stack, with the outermost deepest.
+ * The type of the array is stored in the bytecode.
+ *
+ * The multinewarray instruction is followed by two bytes for the array type, and one for the number of dimensions.
+ * There may be fewer dimensions than the type has; the rest are left null, to be filled in later.
+ *
+ * The lengths are popped, and the new array takes the place of the outermost one.
+ * A negative length, or an element class that can't be loaded, stops the VM.
+ *
+ * @param Stack the StackFrame of the currently executing method.
+ */
+void Engine::MultiNewArray(StackFrame* Stack) {
+    auto Index = ReadShortFromStream(&Stack->_Method->Code->Code[Stack->ProgramCounter + 1]);
+    uint8_t Dimensions = Stack->_Method->Code->Code[Stack->ProgramCounter + 3];
+
+    std::vector<uint32_t> Counts(Dimensions);
+    Stack->StackPointer -= Dimensions - 1; // pop
+    for(uint8_t i = 0; i < Dimensions; i++) {
+        auto Count = (int32_t) Stack->Stack[Stack->StackPointer + i].intVal;
+
+        // Every count is checked, even one below a 0 that means it'd never be used.
+        // As with the array being too big, the interpreter can't throw the exception, so the VM stops here instead.
+        if(Count < 0) {
+            fprintf(stderr, "Exception in thread \"main\" java.lang.NegativeArraySizeException: %d\n", Count);
+            fprintf(stderr, "Unable to create a %d-dimensional array. Fatal error.\n", Dimensions);
+            exit(8);
+        }
+
+        Counts[i] = (uint32_t) Count;
+    }
+
+    if(!Stack->_Class->CreateMultiArray(Index, Counts, &_ObjectHeap, Stack->Stack[Stack->StackPointer].object)) { // push
+        fprintf(stderr, "Unable to create a %d-dimensional array of type %s. Fatal error.\n", Dimensions,
+                Stack->_Class->GetStringConstant(Index).c_str());
+        exit(6);
+    }
+}
+
 /**
  * Easily the single most complex function in the VM.
  * Handles calling other methods from within methods, preserving state in the process.
@@ -984,7 +1234,7 @@ void Engine::Invoke(StackFrame *Stack, uint16_t Type) {
     auto MethodIndex = ReadShortFromStream(&Stack->_Method->Code->Code[Stack->ProgramCounter + 1]);
 
     printf("Invoking a function.. index is %d.\r\n", MethodIndex);
-    auto* Constants = (uint8_t*) Stack->_Class->Constants[MethodIndex];
+    const ConstantPoolEntry& Constant = Stack->_Class->Constants[MethodIndex];
 
     // This next block is for sanity checking and debug output.
     // Since there's no sane way to switch-add a string to a log without duplicating or using a std::string wrapper, we kill two birds with one stone here.
@@ -992,47 +1242,44 @@ void Engine::Invoke(StackFrame *Stack, uint16_t Type) {
     switch(Type) {
         // Interface invokes must point to an Interface Method.
         case Instruction::invokeinterface:
-            if(Constants[0] != TypeInterfaceMethod)
+            if(Constant.Tag != TypeInterfaceMethod)
                 exit(4);
             TypeName = (char*) "interface";
             break;
         // Virtual and Special invokes must point to a regular method.
         case Instruction::invokevirtual:
         case Instruction::invokespecial:
-            if(Constants[0] != TypeMethod)
+            if(Constant.Tag != TypeMethod)
                 exit(4);
             TypeName = (char*) " instance";
             break;
         // Static invokes must also point to a regular method, but there's special handling for later.
         case Instruction::invokestatic:
-            if(Constants[0] != TypeMethod)
+            if(Constant.Tag != TypeMethod)
                 exit(4);
             TypeName = (char*) "   static";
             break;
         default:
-            printf("\tUnknown invocation: %d as %d\r\n", Constants[0], Type);
+            printf("\tUnknown invocation: %d as %d\r\n", Constant.Tag, Type);
             break;
     }
 
     printf("\tResolving invocation for %s function.\n", TypeName);
 
-    auto ClassIndex = ReadShortFromStream(&Constants[1]);
-    auto ClassNTIndex = ReadShortFromStream(&Constants[3]);
+    auto ClassIndex = Constant.Member.Class;
 
-    // Now that we have the index of the class and name type that we want to invoke, we can resolve them to strings.
-    std::string ClassName = Stack->_Class->GetStringConstant(ClassIndex);
+    // Now that we have the index of the class that we want to invoke, we can resolve it to a string.
+    const std::string& ClassName = Stack->_Class->GetStringConstant(ClassIndex);
     printf("\tInvocation is calling into class %s\n", ClassName.c_str());
 
-    // Swap over to the NameAndType of the method and continue.
-    Constants = (uint8_t*) Stack->_Class->Constants[ClassNTIndex];
-
+    // The name and descriptor of the method were copied from its NameAndType when the class was parsed.
     Method MethodToInvoke {};
-    MethodToInvoke.Name = ReadShortFromStream(&Constants[1]);
-    MethodToInvoke.Descriptor = ReadShortFromStream(&Constants[3]);
+    MethodToInvoke.Name = Constant.Member.Name;
+    MethodToInvoke.Descriptor = Constant.Member.Descriptor;
     MethodToInvoke.Access = 0; // Access requires more processing later.
 
-    std::string MethodName = Stack->_Class->GetStringConstant(MethodToInvoke.Name);
-    std::string MethodDesc = Stack->_Class->GetStringConstant(MethodToInvoke.Descriptor);
+    const std::string& MethodName = Stack->_Class->GetStringConstant(MethodToInvoke.Name);
+    const std::string& MethodDesc = Stack->_Class->GetStringConstant(MethodToInvoke.Descriptor);
     printf("\tInvocation resolves to method %s%s\n", MethodName.c_str(), MethodDesc.c_str());
 
     // The biggest pain here is that we need to synchronize parameters between the caller and callee.
@@ -1041,18 +1288,6 @@ void Engine::Invoke(StackFrame *Stack, uint16_t Type) {
 
     printf("\tMethod has " PrtSizeT " parameters, skipping ahead..\r\n", Parameters);
     
-    // Sometimes the stack can be corrupted on the edge between caller and callee return.
-    // By storing the value under the stack pointer (for non-void methods) we can hope to restore the proper
-    // value to them. This is not a guarantee, and is indeed an indicator of a larger logic fault at hand, but I've
-    // been unable to find said larger fault yet.
-    // This is a hack, but it works, and it solves a really annoying problem.
-    Variable UnderStack;
-    if(Stack->StackPointer <= (Parameters + 1))
-        UnderStack = 0;
-    else
-        UnderStack = Stack->Stack[Stack->StackPointer - (Parameters + 1)];
-    printf("\tSaved value " PrtSizeT " (object " PrtSizeT ") for restoration\r\n", UnderStack.pointerVal, UnderStack.object.Heap);
-
     // Now that we know how many parameters there are, we can peel them from the stack and put them in this list.
     // We do this because the stack has an inverted order relative to how the method wants them, and the difference is
     // irreconcilable.
@@ -1063,17 +1298,60 @@ void Engine::Invoke(StackFrame *Stack, uint16_t Type) {
     }
 
     // Of course, we need to know any necessary data about the class we're going to jump into. We take that here.
-    Variable ClassInStack = Stack->Stack[Stack->StackPointer - Parameters];
-    printf("\tClass to invoke is object #" PrtSizeT ".\r\n", ClassInStack.object.Heap);
+    // Static methods are resolved from the constant, once; the class it names is loaded if this is the first time
+    //  it's been referenced, and searched up to the class that declares the method. See Class#ResolveMethod.
+    // Everything else is called on an Object, which was pushed before the parameters.
+    bool Static = Type == Instruction::invokestatic;
+    Variable ClassInStack = 0;
+    class Class* VirtualClass;
+    uint32_t MethodInClassIndex;
+    if(Static) {
+        const ResolvedMethod& Resolved = Stack->_Class->ResolveMethod(MethodIndex);
+        VirtualClass = Resolved.Owner;
+        MethodInClassIndex = Resolved.Method;
+    } else {
+        ClassInStack = Stack->Stack[Stack->StackPointer - Parameters];
+        printf("\tClass to invoke is object #" PrtSizeT ".\r\n", ClassInStack.object.Heap);
+
+        // With detail about the object we're going to invoke, we can resolve it to a Class instance.
+        Variable* ObjectFromHeap = _ObjectHeap.GetObjectPtr(ClassInStack.object);
+        printf("\tClass at 0x" PrtHex64 ".\r\n", ObjectFromHeap->pointerVal);
+        VirtualClass = (class Class*) ObjectFromHeap->pointerVal;
+
+        // Here's where we search the class for the method we want to call (since it may want to be in an interface, etc.)
+        // If this class does not exist, something has gone horribly wrong with the compiler.
+        MethodInClassIndex = VirtualClass->GetMethodFromDescriptor(Stack->_Class->GetSymbol(MethodToInvoke.Name),
+            Stack->_Class->GetSymbol(MethodToInvoke.Descriptor), Stack->_Class->GetSymbol(ClassIndex), VirtualClass);
+    }
+
+    // Some methods are implemented inside the VM, where they can work on the Object Heap directly. See Intrinsics.cpp.
+    // These were picked out by the constant when this class was linked.
+    intrinsic_t Intrinsic = Stack->_Class->GetIntrinsic(MethodIndex);
 
-    // With detail about the object we're going to invoke, we can resolve it to a Class instance.
-    Variable* ObjectFromHeap = _ObjectHeap.GetObjectPtr(ClassInStack.object);
-    printf("\tClass at 0x" PrtHex64 ".\r\n", ObjectFromHeap->pointerVal);
-    auto* VirtualClass = (class Class*) ObjectFromHeap->pointerVal;
+    // Calling a static method initializes the class that declares it, the first time. See InitializeClass.
+    // That includes intrinsics; the VM implements the method, but the class' static initializer still has to run.
+    // Only methods with bytecode are made quick; intrinsics and natives need the parameters copied out anyway.
+    if(Static && InitializeClass(VirtualClass, &Stack[1], &Stack->Stack[Stack->StackPointer + 1]) &&
+            Intrinsic == nullptr && !(VirtualClass->Methods[MethodInClassIndex].Access & 0x100))
+        Stack->_Class->RewriteCode(&Stack->_Method->Code->Code[Stack->ProgramCounter], Instruction::invokestatic_quick);
 
-    // Here's where we search the class for the method we want to call (since it may want to be in an interface, etc.)
-    // If this class does not exist, something has gone horribly wrong with the compiler.
-    uint32_t MethodInClassIndex = VirtualClass->GetMethodFromDescriptor(MethodName.c_str(), MethodDesc.c_str(), ClassName.c_str(), VirtualClass);
+    // Intrinsics are all static, so the parameters are all that's on the stack, and the return value takes their place.
+    if(Intrinsic != nullptr) {
+        printf("\tMethod is an intrinsic.\r\n");
+        Native::Parameters = ParamList;
+
+        Variable Result;
+        try {
+            Intrinsic();
+        } catch (NativeReturn& e) {
+            Result = e.Value;
+        }
+
+        Stack->StackPointer -= ParamList.size();
+        if(MethodDesc.find(")V") == std::string::npos)
+            Stack->Stack[++Stack->StackPointer] = Result;
+        return;
+    }
 
     // Now, we know which class has the code, we know what method we want to call, we know the parameters of the call, and we know
     // what object of the class it was called on.
@@ -1094,12 +1372,14 @@ void Engine::Invoke(StackFrame *Stack, uint16_t Type) {
         } catch (NativeReturn& e) {
             printf("Native: %s " PrtSizeT "\n", e.what(), e.Value.pointerVal);
 
-            // We need to decrement the stack pointer since a method was called.
+            // We need to pop the parameters, and the Object if there was one, since a method was called.
             Stack->StackPointer -= ParamList.size();
+            if(!Static)
+                Stack->StackPointer--;
 
-            // Don't set return value if the function returned void.
+            // Don't push a return value if the function returned void.
             if(MethodDesc.find(")V") == std::string::npos)
-                Stack->Stack[Stack->StackPointer] = e.Value;
+                Stack->Stack[++Stack->StackPointer] = e.Value;
 
             // And now we can return to the caller method.
             return;
@@ -1111,8 +1391,43 @@ void Engine::Invoke(StackFrame *Stack, uint16_t Type) {
         exit(5);
     }
 
+    // 0x8 means "static". Non-static methods implicitly have the object they were called on as the first parameter.
+    if(!(VirtualClass->Methods[MethodInClassIndex].Access & 0x8))
+        Parameters++;
+
+    printf("Invoking method %s%s\n", MethodName.c_str(), MethodDesc.c_str());
+    InvokeFrame(Stack, VirtualClass, MethodInClassIndex, Parameters, MethodDesc.find(")V") == std::string::npos);
+}
+
+/**
+ * The quick version of invokestatic, which replaces it once the method is resolved and its class is initialized.
+ * The method, and the shape of its parameters, are taken straight from the resolution cache. See Class#ResolveMethod.
+ *
+ * Only methods with bytecode are made quick, so there's nothing else to check.
+ *
+ * @param Stack the Stack Frame for the method currently being executed.
+ */
+void Engine::InvokeStaticQuick(StackFrame* Stack) {
+    auto MethodIndex = ReadShortFromStream(&Stack->_Method->Code->Code[Stack->ProgramCounter + 1]);
+    const ResolvedMethod& Resolved = Stack->_Class->GetResolvedMethod(MethodIndex);
+
+    InvokeFrame(Stack, Resolved.Owner, Resolved.Method, Resolved.Parameters, Resolved.Returns);
+}
+
+/**
+ * Run a method that has bytecode, in a new Stack Frame above the given one.
+ * The Object (if there is one) and the parameters are taken off the caller's stack, and the return value (if there is
+ *  one) is pushed in their place.
+ *
+ * @param Stack the Stack Frame of the caller
+ * @param Owner the class that declares the method
+ * @param MethodIndex the index of the method in the Owner class
+ * @param Parameters how many Variables the Object and the parameters take up on the caller's stack
+ * @param Returns whether the method returns a value
+ */
+void Engine::InvokeFrame(StackFrame* Stack, Class* Owner, uint32_t MethodIndex, size_t Parameters, bool Returns) {
     /*
-     * With the native edge-case out of the way, this is where it gets juicy.
+     * Natives and intrinsics are dealt with in Invoke, so this is where it gets juicy.
      * As a basic primer to the workings of Stack Frames (see the Purpuri documentation for more detail here)
      * They are the fundamental container of interpreter state.
      * Every method that is executed gets its own Frame.
@@ -1133,44 +1448,21 @@ void Engine::Invoke(StackFrame *Stack, uint16_t Type) {
     // We create a new Stack Frame here and prepare to fill it with data.
     // It's Stack[1] because we want it to be linked to (and accessible from) the lower frame.
     Stack[1] = StackFrame();
-    Stack[1]._Method = &VirtualClass->Methods[MethodInClassIndex];
-
-    printf("\tMethod has access 0x%x.\r\n", Stack[1]._Method->Access);
-    // 0x8 means "static". Non-static methods implicitly have the object they were called on as the first parameter, so we can skip it if it's static.
-    if(!(Stack[1]._Method->Access & 0x8))
-        Parameters++;
-
-    Stack[1]._Class = VirtualClass;
+    Stack[1]._Method = &Owner->Methods[MethodIndex];
+    Stack[1]._Class = Owner;
 
     // The dual usage of "Stack" here may be confusing.
     // The first Stack (the one we're indexing [1] into) represents the Call Stack; the hierarchy of calls made by a given program.
     // The second Stack (the one we're setting) represents the Value Stack; the things that are pushed and popped by the Java program to carry data around.
-    // The logic for calculating the new position is basically "the lowest possible with the ability to contain the parameters of the method".
-    Stack[1].Stack = &StackFrame::MemberStack[Stack->Stack - StackFrame::MemberStack + Stack->StackPointer - Parameters];
-
-    size_t ParameterCount = 0;
-    printf("\tSetting locals..\r\n");
-    // If non-static, set "this"
-    // This check is separate from the one immediately above, because we needed to calculate the Parameters additional length
-    // to be able to set the Member Stack size, and we need to use the Member Stack Size to be able to set the instance of the Object.
-    // It's a chicken-and-egg scenario. The simplest solution was two checks.
-    if(!(Stack[1]._Method->Access & 0x8)) {
-        printf("\tSetting \"this\" to " PrtSizeT ".\r\n", ClassInStack.object.Heap);
-        Stack[1].Stack[ParameterCount] = ClassInStack;
-        ParameterCount++;
-    }
+    // The caller pushed the Object (if there is one) and then the parameters in order, which is exactly how the
+    //  callee wants them in its locals. So the new frame's Value Stack starts at the Object, or the first parameter,
+    //  and nothing needs to be copied at all.
+    Stack[1].Stack = &Stack->Stack[(ptrdiff_t) Stack->StackPointer + 1 - (ptrdiff_t) Parameters];
 
-    // The rest of the parameters are on-stack, so just zip through them.
-    for(size_t i = ParameterCount; i < Parameters; i++) {
-        Stack[1].Stack[i] = Stack->Stack[Stack->StackPointer - (i - 1)];
-        printf("\tSetting local " PrtSizeT " to " PrtSizeT ".\r\n", i, Stack[1].Stack[i].pointerVal);
-    }
-
-    printf("\tFunction's parameters start at " PrtSizeT ".\r\n", Parameters);
-    // Don't want to accidentally immediately overwrite a parameter, so set the stack at the earliest empty value.
-    Stack[1].StackPointer = Parameters;
-
-    printf("Invoking method %s%s\n", MethodName.c_str(), MethodDesc.c_str());
+    // The rest of the locals come after the parameters, and the callee's own stack after that.
+    // As in StartVM, the Stack Pointer starts at the end of the locals, so that nothing pushed can overwrite one.
+    Stack[1].StackPointer = Stack[1]._Method->Code->LocalsSize;
+    printf("\tFunction's parameters start at " PrtSizeT ", stack at %d.\r\n", Parameters, Stack[1].StackPointer);
 
     // Ignite is the main interpreter function above.
     // We pass Stack[1] so that it becomes the new "reference", and if another invoke is called, it will simply
@@ -1181,29 +1473,15 @@ void Engine::Invoke(StackFrame *Stack, uint16_t Type) {
     // However, it's trivial to retrieve, since we also have its stack pointer.
     Variable ReturnValue = Stack[1].Stack[Stack[1].StackPointer];
 
-    // If the method was void, we need to adjust positively (this is about to be used in a -= so - is positive)
-    // to ensure that we don't overwrite whatever was on the stack before this.
-    if(MethodDesc.find(")V") != std::string::npos)
-        Parameters--;
-
     // Now we can deal with removing the now unused parameters.
     Stack->StackPointer -= Parameters;
     printf("Shrinking the stack by " PrtSizeT " positions.\r\n", Parameters);
 
     // If the method was NOT void, then we now need to push the return value to the stack (since we didn't do that).
-    int Offset = 0;
-    if(MethodDesc.find(")V") == std::string::npos) {
-        Stack->Stack[Stack->StackPointer] = ReturnValue;
+    if(Returns) {
+        Stack->Stack[++Stack->StackPointer] = ReturnValue;
         printf("Pushing function return value, " PrtSizeT "\r\n", ReturnValue.pointerVal);
-        Offset--; // Make Offset -1, so that the line below works with return.
     }
-
-    // As mentioned earlier, some edge cases occur on the interface between caller and callee.
-    // By forcibly setting the value that used to be there into the same location, we can ensure that nothing changes or is corrupted.
-    // Again, this problem is an indication of a bigger fault, but it's an enormous pain to debug, so I'll live with it and so should you.
-    Stack->Stack[Stack->StackPointer + Offset] = UnderStack;
-    printf("Restoring the value " PrtSizeT " under the function, just in case.\r\n", UnderStack.pointerVal);
-
 }
 
 /**
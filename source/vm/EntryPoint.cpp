@@ -7,6 +7,8 @@
 #include <cstdio>
 #include <cstring>
 #include <vm/Stack.hpp>
+#include <vm/Collector.hpp>
+#include <vm/ClassLoader.hpp>
 
 #include <vm/debug/Debug.hpp>
 #include <filesystem>
@@ -26,16 +28,142 @@ void DisplayUsage(char* Name) {
         fprintf(stderr, "          -d: Enable Visual Debugger\n");
     #endif
     fprintf(stderr, "          -q: Enable Quiet Mode\n");
+    fprintf(stderr, "          -g: Log Garbage Collection\n");
+    fprintf(stderr, "          -cp <path>: Also search these directories and JAR files for classes, separated by '" ifsystem(":", ";", ":") "'\n");
+    fprintf(stderr, "          -Xgc=<concurrent|parallel>: Choose the Garbage Collector\n");
+    fprintf(stderr, "          -Xgc-threads=<N>: Use N threads for parallel Garbage Collection\n");
+    fprintf(stderr, "          -Xloader-threads=<N>: Read and parse class files on N threads, or 0 to only load them when used\n");
+    fprintf(stderr, "          -Xshare:<dump|on|off>: Write the classes this program loads to a shared archive, or load them from it\n");
+    fprintf(stderr, "          -Xshare-archive=<file>: Use the given shared archive (default purpuri.jsa)\n");
+    fprintf(stderr, "          -Xcompressed-refs: Store references in arrays as 32 bit offsets (heap up to 32GB)\n");
+    fprintf(stderr, "          -Xhuge-pages: Back large arrays with transparent huge pages\n");
+    fprintf(stderr, "          -Xmx<size>: Set the maximum heap size, ie. -Xmx512m (default 4g)\n");
+    fprintf(stderr, "          -Xms<size>: Set the initial heap size, to allocate before the first collection\n");
+    fprintf(stderr, "          -Xmemory-summary: Print peak memory usage when the VM exits\n");
     fprintf(stderr, "Compiled on " ifsystem("linux", "windows", "macOS") " with " ifcompiler("gcc", "clang", "MSVC") ".");
     fprintf(stderr, "\n16:50 25/02/21 Curle\n");
 }
 
+// Everything given with -cp, to add to the ClassPath once there is one.
+static std::string UserClassPath;
+
+/**
+ * Read a size in bytes, which may end in k, m or g for kilobytes, megabytes or gigabytes.
+ * ie. 512m
+ * @param Text the size to read
+ * @param Size where to put the size, if it's valid
+ * @return whether the size was valid
+ */
+static bool ParseSize(const char* Text, size_t& Size) {
+    if(*Text < '0' || *Text > '9')
+        return false;
+
+    char* End;
+    size_t Value = strtoull(Text, &End, 10);
+
+    switch(*End) {
+        case 'k': case 'K': Value <<= 10; End++; break;
+        case 'm': case 'M': Value <<= 20; End++; break;
+        case 'g': case 'G': Value <<= 30; End++; break;
+        default: break;
+    }
+
+    if(*End != '\0' || Value == 0)
+        return false;
+
+    Size = Value;
+    return true;
+}
+
+/**
+ * Options that start with -X are named rather than single letters, and may carry a value after an '='.
+ * ie. -Xgc-threads=4
+ * @param Option the text of the option, after the -X
+ * @return whether the option was recognised
+ */
+bool ParseExtendedOption(const char* Option) {
+    if(strcmp(Option, "gc=concurrent") == 0) {
+        Collector::Algorithm = Collector::Concurrent;
+        return true;
+    }
+
+    if(strcmp(Option, "gc=parallel") == 0) {
+        Collector::Algorithm = Collector::Parallel;
+        return true;
+    }
+
+    if(strncmp(Option, "gc-threads=", 11) == 0) {
+        char* End;
+        long Threads = strtol(Option + 11, &End, 10);
+        if(*End != '\0' || Threads < 1)
+            return false;
+
+        Collector::Threads = (size_t) Threads;
+        return true;
+    }
+
+    if(strncmp(Option, "loader-threads=", 15) == 0) {
+        char* End;
+        long Threads = strtol(Option + 15, &End, 10);
+        if(*End != '\0' || Threads < 0)
+            return false;
+
+        ClassLoader::Threads = (size_t) Threads;
+        return true;
+    }
+
+    if(strcmp(Option, "share:dump") == 0) {
+        SharedArchive::Sharing = SharedArchive::Dump;
+        return true;
+    }
+
+    if(strcmp(Option, "share:on") == 0) {
+        SharedArchive::Sharing = SharedArchive::On;
+        return true;
+    }
+
+    if(strcmp(Option, "share:off") == 0) {
+        SharedArchive::Sharing = SharedArchive::Off;
+        return true;
+    }
+
+    if(strncmp(Option, "share-archive=", 14) == 0 && Option[14] != '\0') {
+        SharedArchive::Path = Option + 14;
+        return true;
+    }
+
+    if(strcmp(Option, "compressed-refs") == 0) {
+        ObjectHeap::CompressedReferences = true;
+        return true;
+    }
+
+    if(strcmp(Option, "huge-pages") == 0) {
+        ObjectHeap::HugePages = true;
+        return true;
+    }
+
+    // The heap sizes follow straight on, with no '='. The heap needs at least a megabyte to work with.
+    if(strncmp(Option, "mx", 2) == 0)
+        return ParseSize(Option + 2, ObjectHeap::MaxHeapSize) && ObjectHeap::MaxHeapSize >= 1024 * 1024;
+
+    if(strncmp(Option, "ms", 2) == 0)
+        return ParseSize(Option + 2, ObjectHeap::InitialHeapSize);
+
+    if(strcmp(Option, "memory-summary") == 0) {
+        ObjectHeap::MemorySummary = true;
+        return true;
+    }
+
+    return false;
+}
+
 /**
  * When a valid file is given, execute the code.
  * This will, in order:
  *  - Classload the Object class
  *  - Classload the requested class
- *  - Execute static initializers of every class in the heap all at once
+ *  - Link every class that was loaded
+ *  - Execute the static initializer of the requested class; every other class is initialized when it's first used
  *  - Create an execution engine context
  *  - Execute the static main method of the given class file
  *
@@ -54,6 +182,20 @@ void StartVM(char* MainFile, char* Executable) {
     heap.AddToClassPath(ExecutablePath);
     heap.AddToClassPath(std::filesystem::current_path().string());
 
+    // The user's ClassPath comes after the defaults, in the order it was given.
+    const char Separator = ifsystem(':', ';', ':');
+    for(size_t Start = 0, End; Start <= UserClassPath.size() && !UserClassPath.empty(); Start = End + 1) {
+        End = UserClassPath.find(Separator, Start);
+        if(End == std::string::npos) End = UserClassPath.size();
+
+        if(End > Start)
+            heap.AddToClassPath(UserClassPath.substr(Start, End - Start));
+    }
+
+    // Everything the Shared Archive has is loaded from it, rather than the ClassPath. See Archive.cpp.
+    if(SharedArchive::Sharing == SharedArchive::On)
+        heap.SetArchive(SharedArchive::Open(SharedArchive::Path, heap.DescribeClassPath()));
+
     // Initialize the Object class before anything else.
     auto* Object = new Class();
     Object->SetClassHeap(&heap);
@@ -82,6 +224,14 @@ void StartVM(char* MainFile, char* Executable) {
         exit(6);
     }
 
+    // Everything that's going to be loaded up front is loaded now, so lay out every class.
+    // This loads their super classes too. Nothing else is loaded until the program uses it; see ClassHeap#GetClass.
+    // See Class#Link for what that involves.
+    // Linking adds classes to the heap, so this works from a copy of the list.
+    std::vector<Class*> Loaded = heap.GetAllClasses();
+    for(Class* clazz : Loaded)
+        clazz->Link();
+
     // Here we search for the index of the EntryPoint method.
     // The reason we use EntryPoint rather than main will be explained later, but we need to check this NOW,
     // rather than after we do so much extra work on clinit.
@@ -122,10 +272,14 @@ void StartVM(char* MainFile, char* Executable) {
     // stack data structure. An array makes more sense here, just this once.
     size_t StackSize = 100;
     StackFrame::MemberStack = new Variable[StackSize];
+    StackFrame::MemberStackSize = StackSize;
     // Like before, we only declared the list, we need to initialize the values.
     for(size_t i = 0; i < StackSize; i++)
         StackFrame::MemberStack[i] = 0;
 
+    // The Collector scans the Member Stack and the static fields of every class for roots.
+    Collector::Attach(&heap);
+
     // Now we create the Execution Engine itself.
     // This is what actually interprets the bytecode.
     // See Engine.cpp for how it works.
@@ -142,49 +296,10 @@ void StartVM(char* MainFile, char* Executable) {
     // In Java, when you have a block that contains static { }, or static Object THING = new xyz(), this inserts
     // code into a special function called <clinit>.
 
-    // This stands for ClassLoading Initializer, and is intended to be run as soon as classloading happens.
-
-    // Purpuri goes against the Java spec for ease of implementation here; we run all static initializers early,
-    // rather than when the class is first referenced.
-
-    // This has disastrous consequences on programs that rely on the order of static initializers, and will be changed
-    // in the future.
-
-    bool quiet = Engine::QuietMode; // Save the current value of the quiet setting, so that we can override it temporarily
-    bool debug = Debugger::Enabled; // Save the current value of the debugger setting, so that we can override it temporarily
-    Engine::QuietMode = true; // Set quiet mode for static initializers; they get very spammy
-    Debugger::Enabled = false; // Disable the debugger; speeds things up considerably.
-
-    // As mentioned, we go against the Java spec here.
-    // This is not supposed to be done in one batch, but it's far far far easier to implement like this.
-    for(Class* clazz : heap.GetAllClasses()) {
-        // We need to know the index of the method before we can invoke it.
-        uint32_t init = clazz->GetMethodFromDescriptor("<clinit>", "()V", clazz->GetClassName().c_str(), clazz);
-
-        // If there's no static initializer, skip this class.
-        if(init == std::numeric_limits<uint32_t>::max())
-            continue;
-
-        // New execution context, so make this the 0th execution.
-        // From a regular debugger's perspective, this is the equivalent of the main() method.
-        int StartFrame = 0;
-
-        // Set some of the required metadata.
-        // The Execution Engine relies on this data being available before it can start interpreting bytecode.
-        Stack[StartFrame]._Class = clazz;
-        Stack[StartFrame]._Method = &clazz->Methods[init]; // This is why we needed the lookup.
-        Stack[StartFrame].Stack = StackFrame::MemberStack; // This is unclear to see, but it sets the stack to the base of the array, index 0.
-        Stack[StartFrame].StackPointer = Stack[StartFrame]._Method->Code->LocalsSize; // The stack grows down towards 0, which is what facilitates pop.
-
-        print("Running static initializer for class %s\n", clazz->GetClassName().c_str());
-
-        // Everything's ready; start executing bytecode!
-        engine.Ignite(&Stack[StartFrame]);
-    }
-
-    // After all static initializers are executed, we can undo our temporary changes to these variables.
-    Engine::QuietMode = quiet;
-    Debugger::Enabled = debug;
+    // This stands for ClassLoading Initializer, and is run the first time the class is actively used;
+    // see Engine#InitializeClass. The class we were asked to run is about to be used, so it's initialized now.
+    // Everything else waits for the program to get to it.
+    engine.InitializeClass(GivenClass, &Stack[0], StackFrame::MemberStack);
 
     // -------------------------------------------------------------------------------------------------------------- //
 
@@ -234,9 +349,16 @@ void StartVM(char* MainFile, char* Executable) {
     // If we get here, the EntryPoint function returned successfully.
     // This is an achievement!
 
+    // Every class the program needed is loaded now, so this is the time to save them for next time.
+    if(SharedArchive::Sharing == SharedArchive::Dump)
+        SharedArchive::Write(SharedArchive::Path, heap.DescribeClassPath(), heap);
+
     // The debugger lives in a separate thread, so after the Engine is finished executing, we need to wait for that
     // thread to die.
     DEBUG(Debugger::Rejoin());
+
+    // The same goes for the Collector, if it was ever started.
+    Collector::Rejoin();
 }
 
 int main(int argc, char* argv[]) {
@@ -250,6 +372,27 @@ int main(int argc, char* argv[]) {
         // ie. erc >> -v -T -o << test.exe src/main.er
         if(*argv[i] != '-')
             break;
+
+        // The ClassPath is the next argument along.
+        if(strcmp(argv[i], "-cp") == 0 || strcmp(argv[i], "-classpath") == 0) {
+            if(++i >= argc) {
+                DisplayUsage(argv[0]);
+                return 0;
+            }
+
+            UserClassPath = argv[i];
+            continue;
+        }
+
+        // Extended options use up the whole argument.
+        if(argv[i][1] == 'X') {
+            if(!ParseExtendedOption(argv[i] + 2)) {
+                DisplayUsage(argv[0]);
+                return 0;
+            }
+
+            continue;
+        }
         
         // Once we identify a flag, we need to make sure it's not just a minus in-place.
         for(int j = 1; (*argv[i] == '-') && argv[i][j]; j++) {
@@ -270,6 +413,11 @@ int main(int argc, char* argv[]) {
                     Engine::QuietMode = true;
                     break;
 
+                case 'g':
+                    // Print every Collector event to stderr, regardless of quiet mode.
+                    Collector::Logging = true;
+                    break;
+
                 default:
                     DisplayUsage(argv[0]);
                     return 0;
@@ -282,6 +430,18 @@ int main(int argc, char* argv[]) {
         DisplayUsage(argv[0]);
         return 0;
     }
+
+    if(ObjectHeap::InitialHeapSize > ObjectHeap::MaxHeapSize) {
+        fprintf(stderr, "Initial heap size is larger than the maximum heap size.\n");
+        return 0;
+    }
+
+    // The VM tends to exit() from wherever it is, so the summary has to be printed on the way out rather than at
+    //  the end of StartVM.
+    std::atexit([]() {
+        if(ObjectHeap::MemorySummary)
+            Engine::_ObjectHeap.PrintMemorySummary();
+    });
     
     StartVM(argv[i], argv[0]);
 
@@ -281,7 +281,12 @@ std::map<size_t, std::string> Instruction::InstrToName = {
         { goto_w, "goto_w" },
         { jsr_w, "jsr_w" },
 
-        { breakpoint, "breakpoint"}  
+        { breakpoint, "breakpoint"},
+
+        { new_quick, "new_quick" },
+        { getstatic_quick, "getstatic_quick" },
+        { putstatic_quick, "putstatic_quick" },
+        { invokestatic_quick, "invokestatic_quick" }
 };
 
 std::map<size_t, size_t> Instruction::InstrLengths = {
@@ -333,5 +338,6 @@ std::map<size_t, size_t> Instruction::InstrLengths = {
         { multinewarray, 4 },
         { ifnull, 3 }, { ifnonnull, 3 },
         { goto_w, 5 }, { jsr_w, 5 },
-        { breakpoint, 1 }
+        { breakpoint, 1 },
+        { new_quick, 3 }, { getstatic_quick, 3 }, { putstatic_quick, 3 }, { invokestatic_quick, 3 }
     };
\ No newline at end of file
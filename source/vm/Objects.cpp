@@ -5,9 +5,19 @@
 
 #include <vm/Objects.hpp>
 #include <vm/Class.hpp>
+#include <vm/Collector.hpp>
 
 #include <cstring>
 
+#if defined WIN32
+    #include <windows.h>
+    #undef GetClassName
+    #undef LoadLibrary
+    #undef GetObject
+#elif defined linux || defined __APPLE__
+    #include <sys/mman.h>
+#endif
+
 // This is the global Object that represents "null" across the whole JVM.
 // This facilitates null checking, while retaining a valid Object on the heap.
 // It is imperative that everything that COULD use a null value, check that it doesn't.
@@ -16,12 +26,13 @@ Object ObjectHeap::Null;
 /**
  * This file implements the ObjectHeap class, declared in Objects.hpp.
  *
- * Objects are a simple pair of ID, Heap.
- * ID is an ascending long value that uniquely identifies each Object.
- * Heap is a pointer to the actual Variable data on the heap.
+ * Objects are a single word; a reference to the Object's data in the arena.
+ * The arena is one big reservation of address space, handed out in 8 byte Granules.
+ * A reference is the offset of the Object's Variable Data from the start of the arena, counted in Granules.
+ * Turning a reference back into a pointer is a shift and an add, so nothing needs to be looked up.
  *
  * Heap Data is implemented as an array of Variables.
- * See the enum in Common.hpp for how Variable is implemented.
+ * See the union in Common.hpp for how Variable is implemented. Each Variable is 8 bytes.
  *
  * In short, classes will have the format of:
  * ┌─────────────────────────────────────────────────────────────────────────────────────────────────────────────┐
@@ -36,9 +47,11 @@ Object ObjectHeap::Null;
  * │                                                                                                             │
  * └─────────────────────────────────────────────────────────────────────────────────────────────────────────────┘
  *
- * Class Variables will continue for as many fields are in the class (including superclasses).
- * ie. a simple Object with no fields will have no Variables, a class with two fields will have two Class Variables
- *  (for a total length of three), etc
+ * Class Variables hold every instance field in the class (including superclasses), packed at the width of their type.
+ * The layout is worked out when the class is linked; see Class#Link. Fields are read and written with LoadField and
+ *  StoreField, given the byte offset and type that the class has for them.
+ * ie. a simple Object with no fields will have no Variables, a class with four boolean fields will have one Class
+ *  Variable (for a total length of two), etc
  *
  * Arrays will have the format of:
  * ┌─────────────────────────────────────────────────────────────────────────────────────────────────────────────┐
@@ -46,7 +59,7 @@ Object ObjectHeap::Null;
  * │  ┌───────────────────────┐  ┌───────────────────────┐ ┌─ ─ ── ── ── ── ── ── ─┐ ┌─ ─ ── ── ── ── ── ── ─┐   │
  * │  │                       │  │                       │ │                       │ │                       │   │
  * │  │                       │  │                       │                                                       │
- * │  │      Array Type       │  │       Array Data      │ │       Array Data      │ │       Array Data      │   │
+ * │  │      Array Type       │  │     Array Length      │ │       Array Data      │ │       Array Data      │   │
  * │  │                       │  │                       │                                                       │
  * │  │                       │  │                       │ │                       │ │                       │   │
  * │  └───────────────────────┘  └───────────────────────┘ └─ ─ ── ── ── ── ── ── ─┘ └─ ─ ── ── ── ── ── ── ─┘   │
@@ -54,21 +67,928 @@ Object ObjectHeap::Null;
  * └─────────────────────────────────────────────────────────────────────────────────────────────────────────────┘
  *
  * The Array Type is either primitive or reference.
- * Reference includes other arrays.
+ * Reference includes other arrays. For those, the Array Type is the class pointer of the element type.
+ * The Array Length is read directly by arraylength; there's nothing to look up.
+ * Only the bottom 32 bits of it are the length. The top holds the shape of the array; see ARRAY_DIMENSIONS_SHIFT.
  * As you'd expect, Array Data continues for the length of the array.
  *
- * To facilitate the arraylength instruction, there's also an Array Size Map here, that provides fast ID -> Length mapping.
+ * Reference arrays hold one Variable per entry, but primitive arrays are packed.
+ * Their Array Data is the raw elements at their natural width (1 byte for boolean and byte, 2 for char and short,
+ *  4 for int and float, 8 for long and double), rounded up to a whole number of Variables.
+ * ie. a char[10] takes 20 bytes of Array Data, which is three Variables after the Array Type and Length.
+ * See GetArrayData for how to read them.
+ *
+ * With compressed references (-Xcompressed-refs), reference arrays store their elements as 32 bit offsets.
+ * Because the offsets are counted in Granules rather than bytes, that's still enough to reach 32GB of arena.
+ * LoadElement and StoreElement are the only places that need to know which form an array is in.
+ *
+ * Every block in the arena, whether it's an Object or free space, has a one Granule header in front of it.
+ * For Objects, the header also carries the lock bits and a lazily assigned identity hash (see GetIdentityHash).
+ * Together with the class word, that makes a two word header for instances and three for arrays:
+ * ┌────────────────────────┐ ┌────────────────────────────────────────────────┐ ┌────────────────────────┐
+ * │ Granules │    Flags    │ │ Variable Data (the Object's layout, as above)  │ │ Granules │    Flags    │ ...
+ * └────────────────────────┘ └────────────────────────────────────────────────┘ └────────────────────────┘
+ *   ^ Block Start bit          ^ the reference points here
+ *
+ * Two bitmaps sit alongside the arena, with one bit per Granule:
+ *  - Block Starts are set wherever there's a header. The Collector uses this to check that a value that looks like
+ *     a reference actually is one, and to find the first block in a Region.
+ *  - Marks are set on the headers of reachable Objects while the Collector runs.
+ *
+ * New Objects are carved out of free lists if there's a free block of the right size, and bumped off the Top of
+ *  the arena otherwise. Free blocks are found and coalesced by the Collector's sweep.
+ *
+ * Multi-dimensional arrays from multinewarray are the exception to one-block-per-allocation.
+ * The whole tree is allocated as one run of Granules, and carved up into the outer array followed by its rows,
+ *  depth first, so that walking a[i][j] row by row walks straight through memory:
+ * ┌────────┬─────────────────────┬────────┬─────────────┬────────┬─────────────┬─────┬────────┬─────────────┐
+ * │ Header │ Outer (refs to rows)│ Header │ Row 0       │ Header │ Row 1       │ ... │ Header │ Row n-1     │
+ * └────────┴─────────────────────┴────────┴─────────────┴────────┴─────────────┴─────┴────────┴─────────────┘
+ * Each row still has its own header and Block Start bit, so after that, they are ordinary Objects;
+ *  a row that outlives the outer array is kept alive on its own, and a dead one is swept on its own.
+ *
+ * Large Objects (HEAP_LARGE_OBJECT bytes and up, which in practice means big arrays) don't go through any of that.
+ * They're given whole pages of their own at the other end of the arena, which is mapped fresh for each one, so the
+ *  memory is already zero without us touching it. When one dies, its pages are handed back to the OS straight away.
+ * They are still in the arena, so a reference to one is the same as any other.
+ * ┌───┬──────────────────────────────────┬─────────────────────────┬──────────────┬──────────┬─────────────┐
+ * │ 0 │  Objects and free blocks         │  untouched              │  large       │  (free)  │  large      │
+ * └───┴──────────────────────────────────┴─────────────────────────┴──────────────┴──────────┴─────────────┘
+ *                                        ^ Top                     ^ Large Bottom                          ^ Limit
  *
- * Otherwise, this file is mostly dedicated to the management of these IDs and the references to the Heap values they contain.
+ * Objects are freed by the Collector (see Collector.cpp), which may be running on another thread.
+ * While it is, every change to the free lists, bitmaps and headers here has to hold the heap Lock.
+ */
+
+// Take the heap lock, but only if the Collector thread could be looking at the arena right now.
+#define HEAP_LOCK \
+    std::unique_lock<std::mutex> Guard(Lock, std::defer_lock); \
+    if(Collector::Active) Guard.lock()
+
+bool ObjectHeap::CompressedReferences = false;
+size_t ObjectHeap::MaxHeapSize = (size_t) 4 * 1024 * 1024 * 1024;
+size_t ObjectHeap::InitialHeapSize = 0;
+bool ObjectHeap::MemorySummary = false;
+
+/**
+ * Reserve a range of address space, without using any memory for it until it's touched.
+ * The memory reads as zero the first time it's touched.
+ *
+ * Windows doesn't let reserved memory be touched until it's committed, and counts everything committed against the
+ *  commit limit whether it's touched or not. So there, only the address space is reserved; see CommitReserved.
+ * @param Size the number of bytes to reserve
+ * @return the start of the range, or nullptr if it couldn't be reserved.
+ */
+static void* ReserveMemory(size_t Size) {
+    #ifdef WIN32
+        return VirtualAlloc(nullptr, Size, MEM_RESERVE, PAGE_READWRITE);
+    #elif defined linux || defined __APPLE__
+        void* Memory = mmap(nullptr, Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        return Memory == MAP_FAILED ? nullptr : Memory;
+    #endif
+}
+
+/**
+ * Give back a range from ReserveMemory.
+ */
+static void ReleaseMemory(void* Memory, size_t Size) {
+    if(Memory == nullptr) return;
+
+    #ifdef WIN32
+        SHUTUPUNUSED(Size);
+        VirtualFree(Memory, 0, MEM_RELEASE);
+    #elif defined linux || defined __APPLE__
+        munmap(Memory, Size);
+    #endif
+}
+
+/**
+ * Make part of a range from ReserveMemory usable, keeping whatever is already in it.
+ * On Linux and macOS, reserved memory is backed as it's touched, so this only does anything on Windows.
+ * The range doesn't have to be page aligned; every page it touches is committed.
+ */
+static void CommitReserved(void* Memory, size_t Size) {
+    #ifdef WIN32
+        VirtualAlloc(Memory, Size, MEM_COMMIT, PAGE_READWRITE);
+    #elif defined linux || defined __APPLE__
+        SHUTUPUNUSED(Memory);
+        SHUTUPUNUSED(Size);
+    #endif
+}
+
+/**
+ * Back part of the arena with fresh pages, which read as zero.
+ * The range has to be page aligned.
+ * @param HugePages whether to ask for the range to be backed by huge pages
+ */
+static void CommitMemory(void* Memory, size_t Size, bool HugePages) {
+    #ifdef WIN32
+        SHUTUPUNUSED(HugePages);
+        VirtualFree(Memory, Size, MEM_DECOMMIT);
+        VirtualAlloc(Memory, Size, MEM_COMMIT, PAGE_READWRITE);
+    #elif defined linux || defined __APPLE__
+        mmap(Memory, Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+
+        #ifdef MADV_HUGEPAGE
+            if(HugePages)
+                madvise(Memory, Size, MADV_HUGEPAGE);
+        #else
+            SHUTUPUNUSED(HugePages);
+        #endif
+    #endif
+}
+
+/**
+ * Give the pages behind part of the arena back to the OS, keeping the address space reserved.
+ * The range has to be page aligned.
  */
+static void DecommitMemory(void* Memory, size_t Size) {
+    #ifdef WIN32
+        VirtualFree(Memory, Size, MEM_DECOMMIT);
+    #elif defined linux || defined __APPLE__
+        // Mapping over the range drops whatever was there. Unmapping it would let something else take the hole.
+        mmap(Memory, Size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    #endif
+}
 
+bool ObjectHeap::HugePages = false;
 
 ObjectHeap::ObjectHeap() {
-    NextObjectID = 1;
-    ObjectMap = std::map<size_t, size_t>();
+    Base = nullptr;
+    Top = 0;
+    Committed = 0;
+    Limit = 0;
+    LargeBottom = 0;
+    BlockStarts = nullptr;
+    Marks = nullptr;
+    AllocateBlack = false;
+    HashSeed = 0x9E3779B9;
+
+    for(size_t& List : FreeLists)
+        List = 0;
+}
+
+ObjectHeap::~ObjectHeap() {
+    ReleaseMemory(Base, Limit << HEAP_GRANULE_SHIFT);
+    ReleaseMemory(BlockStarts, Limit / 8);
+    ReleaseMemory((void*) Marks, Limit / 8);
+}
+
+/**
+ * Set up the arena and its bitmaps.
+ * This happens on the first allocation rather than in the constructor, so that the command line has been read.
+ */
+void ObjectHeap::Reserve() {
+    size_t Size = MaxHeapSize;
+
+    // A 32 bit offset can't reach any further than this.
+    if(CompressedReferences && Size > HEAP_COMPRESSED_LIMIT)
+        Size = HEAP_COMPRESSED_LIMIT;
+
+    // Keep the bitmaps in whole words.
+    Limit = (Size >> HEAP_GRANULE_SHIFT) & ~(size_t) 63;
+
+    Base = (uint8_t*) ReserveMemory(Limit << HEAP_GRANULE_SHIFT);
+    BlockStarts = (uint64_t*) ReserveMemory(Limit / 8);
+    Marks = (std::atomic<uint64_t>*) ReserveMemory(Limit / 8);
+
+    if(Base == nullptr || BlockStarts == nullptr || Marks == nullptr) {
+        fprintf(stderr, "Unable to reserve " PrtSizeT " bytes for the Object Heap. Fatal error.\n", Size);
+        exit(8);
+    }
+
+    // Granule 0 is never handed out, so that a reference of 0 is always null.
+    Top = 1;
+    LargeBottom = Limit & ~(HEAP_LARGE_GRANULES - 1);
+    CommitArena(Top);
+
+    // A small heap has to be collected more often, or it fills up between cycles.
+    // The first cycle still waits until the initial heap size has been allocated, though.
+    Collector::Trigger = std::max(std::min(Collector::Trigger, Size / 4), std::min(InitialHeapSize, Size / 2));
+}
+
+/**
+ * Add a new allocation to the memory counts.
+ * @param Flags the flags of the new block, to tell arrays from instances
+ * @param Bytes the size of the new block, including its header
+ */
+void ObjectHeap::CountAllocation(uint32_t Flags, size_t Bytes) {
+    if(Flags & BLOCK_ARRAY)
+        Arrays.Add(Bytes);
+    else
+        Instances.Add(Bytes);
+
+    Used.Add(Bytes);
+}
+
+/**
+ * Take what a sweep freed off the memory counts.
+ * @param Bytes the size of every block that was freed, including headers
+ * @param ArrayBytes how many of those Bytes were arrays
+ */
+void ObjectHeap::CountFree(size_t Bytes, size_t ArrayBytes) {
+    Arrays.Remove(ArrayBytes);
+    Instances.Remove(Bytes - ArrayBytes);
+    Used.Remove(Bytes);
+}
+
+/**
+ * Stop the VM, because the heap has run out.
+ * There's nowhere to throw an OutOfMemoryError to yet, so this reports it, and then what the heap was being used for.
+ * @param Reason the message of the OutOfMemoryError, as Java would give it
+ * @param Bytes how big the allocation that failed was
+ */
+void ObjectHeap::OutOfMemory(const char* Reason, size_t Bytes) {
+    fprintf(stderr, "Exception in thread \"main\" java.lang.OutOfMemoryError: %s\n", Reason);
+    fprintf(stderr, "Unable to allocate " PrtSizeT " bytes with a maximum heap size of " PrtSizeT " bytes. Fatal error.\n", Bytes, MaxHeapSize);
+
+    // The summary is printed on the way out; see EntryPoint.cpp.
+    MemorySummary = true;
+    exit(8);
+}
+
+/**
+ * Print the peak and current memory use, by what it was used for.
+ * This is printed when the VM exits if -Xmemory-summary was given, and always after an OutOfMemoryError.
+ */
+void ObjectHeap::PrintMemorySummary() {
+    auto Row = [](const char* Name, MemoryUsage& Usage) {
+        fprintf(stderr, "[Memory]   %-15s " PrtSizeT " KB peak, " PrtSizeT " KB at exit\n", Name, Usage.Peak / 1024, Usage.Current.load() / 1024);
+    };
+
+    fprintf(stderr, "[Memory] Heap limit " PrtSizeT " KB, " PrtSizeT " KB reserved\n", MaxHeapSize / 1024, (Limit << HEAP_GRANULE_SHIFT) / 1024);
+    Row("Instances:", Instances);
+    Row("Arrays:", Arrays);
+    Row("Heap total:", Used);
+    Row("Class metadata:", Metadata);
+}
+
+/**
+ * Find space for a new Object from a ready-made template, and set up its header.
+ * Every allocation in the heap but multinewarray's ends up here, so this is also where the Collector hears about them.
+ * That's either a free block of exactly the right size, a bump of the Top, or fresh pages for a large object,
+ *  and then the header and class word are stored straight out of the template.
+ *
+ * The Variable Data is always zeroed, as Java expects of every new Object.
+ *
+ * The class word is stored before the Collector can see the Object, so it never scans one without it.
+ *
+ * @param Template the header and class word of the new Object
+ * @param Out the reference to the new Object
+ * @return the Variable Data of the new Object
+ */
+Variable* ObjectHeap::Allocate(const AllocationTemplate& Template, Object& Out) {
+    size_t Granules = Template.Header.Granules;
+    size_t Block;
+
+    for(bool Collected = false; ; Collected = true) {
+        {
+            HEAP_LOCK;
+            if(Base == nullptr)
+                Reserve();
+
+            // Large objects get fresh pages, so they never need cleaning.
+            if(Granules * HEAP_GRANULE >= HEAP_LARGE_OBJECT)
+                Block = TakeLarge(Granules);
+            else
+                Block = TakeArena(Granules);
+
+            if(Block != 0) {
+                BlockHeader* Header = HeaderAt(Block);
+                *Header = Template.Header;
+                ((Variable*) (Header + 1))->pointerVal = Template.Klass;
+                SetBlockStart(Block);
+
+                // Anything allocated while the Collector is mid-cycle survives that cycle.
+                if(AllocateBlack)
+                    TryMark(Block + 1);
+            }
+        }
+
+        if(Block != 0) break;
+
+        // This has to wait until the lock is dropped, or the Collector thread could never finish and let the VM exit.
+        if(Collected)
+            OutOfMemory("Java heap space", Granules * HEAP_GRANULE);
+
+        // The arena may only be full of garbage that the Collector hasn't got to yet. See Collector#Reclaim.
+        Collector::Reclaim();
+    }
+
+    CountAllocation(Template.Header.Flags, Granules * HEAP_GRANULE);
+    Collector::NotifyAllocation(Granules * HEAP_GRANULE);
+
+    Out.Heap = Block + 1;
+    return (Variable*) (HeaderAt(Block) + 1);
+}
+
+/**
+ * Find zeroed space in the main part of the arena; either a free block, or a bump of the Top.
+ * The heap lock must be held.
+ * @param Granules the size of the space, including the header of the first block in it
+ * @return the Granule that the space starts at, or 0 if the arena is full.
+ */
+size_t ObjectHeap::TakeArena(size_t Granules) {
+    size_t Block = TakeFree(Granules);
+
+    if(Block != 0) {
+        // Reused space has to be cleaned out.
+        memset((void*) HeaderAt(Block + 1), 0, (Granules - 1) * HEAP_GRANULE);
+        return Block;
+    }
+
+    if(Top + Granules > LargeBottom)
+        return 0;
+
+    if(Top + Granules > Committed)
+        CommitArena(Top + Granules);
+
+    // Memory above the Top has never been touched, so it's already zero.
+    Block = Top;
+    Top += Granules;
+    return Block;
 }
 
-ObjectHeap::~ObjectHeap() = default;
+/**
+ * Commit the main part of the arena up to at least the given Granule, along with its bitmaps.
+ * It's done a large object's worth of Granules at a time, so that the Top doesn't have to ask for every Object.
+ * The heap lock must be held.
+ * @param End the first Granule that doesn't need to be committed
+ */
+void ObjectHeap::CommitArena(size_t End) {
+    size_t To = std::min((End + HEAP_LARGE_GRANULES - 1) & ~(HEAP_LARGE_GRANULES - 1), LargeBottom);
+
+    CommitReserved(HeaderAt(Committed), (To - Committed) << HEAP_GRANULE_SHIFT);
+    CommitBitmaps(Committed, To);
+    Committed = To;
+}
+
+/**
+ * Commit the bitmap words that cover a range of the arena.
+ * The word that To is in is included; ClearMarks reads the one the Top is in, even if the Top is at the very end.
+ * @param From the first Granule
+ * @param To the Granule after the last
+ */
+void ObjectHeap::CommitBitmaps(size_t From, size_t To) {
+    size_t First = From >> 6;
+    size_t Last = std::min((To >> 6) + 1, Limit >> 6);
+
+    CommitReserved(&BlockStarts[First], (Last - First) * sizeof(uint64_t));
+    CommitReserved((void*) &Marks[First], (Last - First) * sizeof(uint64_t));
+}
+
+/**
+ * Take a block of exactly the given size out of the free lists, splitting a bigger one if needed.
+ * Free blocks link to the next one in their list through the Granule after their header.
+ * The heap lock must be held.
+ * @param Granules the size of the block, including the header
+ * @return the Granule of the block's header, or 0 if there's nothing suitable.
+ */
+size_t ObjectHeap::TakeFree(size_t Granules) {
+    // Small blocks have their own list per size, so the first one always fits.
+    if(Granules < HEAP_FREE_CLASSES && FreeLists[Granules] != 0) {
+        size_t Block = FreeLists[Granules];
+        FreeLists[Granules] = *(size_t*) HeaderAt(Block + 1);
+        return Block;
+    }
+
+    // Everything else is first-fit from the list of big blocks.
+    size_t* Link = &FreeLists[0];
+    while(*Link != 0) {
+        size_t Block = *Link;
+        size_t Size = HeaderAt(Block)->Granules;
+
+        if(Size < Granules) {
+            Link = (size_t*) HeaderAt(Block + 1);
+            continue;
+        }
+
+        *Link = *(size_t*) HeaderAt(Block + 1);
+
+        // Whatever's left over becomes a free block of its own.
+        if(Size > Granules) {
+            size_t Rest = Block + Granules;
+            size_t RestSize = Size - Granules;
+
+            HeaderAt(Rest)->Granules = (uint32_t) RestSize;
+            HeaderAt(Rest)->Flags = 0;
+            SetBlockStart(Rest);
+
+            // A single Granule has no room for a link; it'll be picked up by the next sweep.
+            if(RestSize > 1) {
+                size_t Class = RestSize < HEAP_FREE_CLASSES ? RestSize : 0;
+                *(size_t*) HeaderAt(Rest + 1) = FreeLists[Class];
+                FreeLists[Class] = Rest;
+            }
+        }
+
+        return Block;
+    }
+
+    return 0;
+}
+
+/**
+ * Find space for a large object, and map fresh pages for it.
+ * Freed ranges are reused first-fit; otherwise the large object space grows down towards the Top.
+ * The heap lock must be held.
+ * @param Granules the size of the Object, including the header
+ * @return the Granule of the Object's header, or 0 if the arena is full.
+ */
+size_t ObjectHeap::TakeLarge(size_t Granules) {
+    size_t Span = (Granules + HEAP_LARGE_GRANULES - 1) & ~(HEAP_LARGE_GRANULES - 1);
+    size_t Block = 0;
+
+    for(auto Range = LargeFree.begin(); Range != LargeFree.end(); Range++) {
+        if(Range->second < Span) continue;
+
+        Block = Range->first;
+        size_t Rest = Range->second - Span;
+        LargeFree.erase(Range);
+
+        if(Rest != 0)
+            LargeFree.emplace(Block + Span, Rest);
+        break;
+    }
+
+    if(Block == 0) {
+        if(LargeBottom < Top + Span)
+            return 0;
+
+        LargeBottom -= Span;
+        Block = LargeBottom;
+    }
+
+    CommitMemory(HeaderAt(Block), Span << HEAP_GRANULE_SHIFT, HugePages);
+    CommitBitmaps(Block, Block + Span);
+    LargeObjects.push_back(Block);
+    return Block;
+}
+
+/**
+ * Hand the pages of a dead large object back to the OS, and keep its range for reuse.
+ * If the range is at the bottom of the large object space, the space shrinks instead, so the Top can grow into it.
+ * @param Block the Granule of the Object's header
+ * @param Span the Granules it was given, as rounded up by TakeLarge
+ */
+void ObjectHeap::ReleaseLarge(size_t Block, size_t Span) {
+    DecommitMemory(HeaderAt(Block), Span << HEAP_GRANULE_SHIFT);
+
+    auto Next = LargeFree.lower_bound(Block);
+    if(Next != LargeFree.end() && Next->first == Block + Span) {
+        Span += Next->second;
+        Next = LargeFree.erase(Next);
+    }
+
+    if(Next != LargeFree.begin()) {
+        auto Previous = std::prev(Next);
+        if(Previous->first + Previous->second == Block) {
+            Block = Previous->first;
+            Span += Previous->second;
+            LargeFree.erase(Previous);
+        }
+    }
+
+    // The large object space may have grown down past what the Top had committed. Those pages aren't there any more.
+    if(Block == LargeBottom) {
+        LargeBottom += Span;
+        Committed = std::min(Committed, Block);
+    } else
+        LargeFree.emplace(Block, Span);
+}
+
+/**
+ * Free every large object that was not marked.
+ * Large objects are never near the Top, so this doesn't have to wait for the main sweep; it's done in the pause
+ *  at the end of marking.
+ * @param State where to count the freed Objects
+ * @return how many large objects were freed.
+ */
+size_t ObjectHeap::SweepLarge(SweepState& State) {
+    size_t Freed = 0;
+    size_t Kept = 0;
+    size_t Bytes = 0;
+    size_t ArrayBytes = 0;
+
+    for(size_t Block : LargeObjects) {
+        if(IsMarked(Block)) {
+            LargeObjects[Kept++] = Block;
+            continue;
+        }
+
+        size_t Granules = HeaderAt(Block)->Granules;
+        State.Freed++;
+        State.FreedBytes += Granules * HEAP_GRANULE;
+        Freed++;
+
+        Bytes += Granules * HEAP_GRANULE;
+        if(HeaderAt(Block)->Flags & BLOCK_ARRAY)
+            ArrayBytes += Granules * HEAP_GRANULE;
+
+        ClearBlockStart(Block);
+        ReleaseLarge(Block, (Granules + HEAP_LARGE_GRANULES - 1) & ~(HEAP_LARGE_GRANULES - 1));
+    }
+
+    LargeObjects.resize(Kept);
+    CountFree(Bytes, ArrayBytes);
+    return Freed;
+}
+
+/**
+ * Check whether a value is a reference to an Object in the arena.
+ * The Collector is conservative, so it uses this on anything that might be a reference.
+ * @param Candidate the value to check
+ * @return true if there's a live Object's data at this Granule.
+ */
+bool ObjectHeap::IsObject(size_t Candidate) {
+    if(Candidate < 2 || Candidate >= Limit) return false;
+    // Nothing lives between the Top and the large object space.
+    if(Candidate >= Top && Candidate <= LargeBottom) return false;
+
+    return IsBlockStart(Candidate - 1) && (HeaderAt(Candidate - 1)->Flags & BLOCK_ALLOCATED);
+}
+
+/**
+ * Mark an Object as reachable.
+ * This is safe to race from several threads; exactly one of them will see that it made the mark.
+ * @param Ref the reference to the Object
+ * @return true if the Object was not marked before.
+ */
+bool ObjectHeap::TryMark(size_t Ref) {
+    size_t Granule = Ref - 1;
+    uint64_t Bit = (uint64_t) 1 << (Granule & 63);
+
+    return !(Marks[Granule >> 6].fetch_or(Bit, std::memory_order_relaxed) & Bit);
+}
+
+/**
+ * Forget every mark, ready for a new cycle.
+ */
+void ObjectHeap::ClearMarks() {
+    for(size_t i = 0; i <= Top >> 6 && Marks != nullptr; i++)
+        Marks[i].store(0, std::memory_order_relaxed);
+
+    // The large object space is sparse, so only the bits of the Objects in it are cleared.
+    for(size_t Block : LargeObjects)
+        Marks[Block >> 6].fetch_and(~((uint64_t) 1 << (Block & 63)), std::memory_order_relaxed);
+}
+
+/**
+ * Find the first block whose header is in the given range.
+ * @return the Granule of the header, or To if there is none.
+ */
+size_t ObjectHeap::FirstBlock(size_t From, size_t To) {
+    size_t Granule = From;
+
+    while(Granule < To) {
+        uint64_t Word = BlockStarts[Granule >> 6] >> (Granule & 63);
+
+        if(Word != 0)
+            return std::min(To, Granule + __builtin_ctzll(Word));
+
+        Granule = (Granule | 63) + 1;
+    }
+
+    return To;
+}
+
+/**
+ * Free every unmarked Object whose header is in the given range, and coalesce neighbouring free space.
+ * A run of free space can carry on from one call to the next, as long as the same State is passed in; it is only
+ *  turned into a free block by FinishRun.
+ *
+ * Separate Regions may be swept from separate threads at once, as long as each has its own State.
+ *
+ * @param From the first Granule to look at
+ * @param To the Granule to stop at
+ * @param State where to collect the free blocks
+ * @return the Granule after the last block that was swept.
+ */
+size_t ObjectHeap::Sweep(size_t From, size_t To, SweepState& State) {
+    size_t Block = FirstBlock(From, To);
+
+    while(Block < To) {
+        BlockHeader* Header = HeaderAt(Block);
+        size_t Granules = Header->Granules;
+
+        if((Header->Flags & BLOCK_ALLOCATED) && IsMarked(Block)) {
+            FinishRun(State);
+            Block += Granules;
+            continue;
+        }
+
+        if(Header->Flags & BLOCK_ALLOCATED) {
+            State.Freed++;
+            State.FreedBytes += Granules * HEAP_GRANULE;
+            if(Header->Flags & BLOCK_ARRAY)
+                State.FreedArrayBytes += Granules * HEAP_GRANULE;
+        }
+
+        // A Block Header only has room for 32 bits of size.
+        if(State.RunGranules + Granules > UINT32_MAX)
+            FinishRun(State);
+
+        if(State.RunGranules == 0) {
+            State.RunStart = Block;
+        } else {
+            ClearBlockStart(Block);
+        }
+
+        State.RunGranules += Granules;
+        Block += Granules;
+    }
+
+    return Block;
+}
+
+/**
+ * Turn the current run of free space into a single free block, and add it to the State's lists.
+ */
+void ObjectHeap::FinishRun(SweepState& State) {
+    if(State.RunGranules == 0) return;
+
+    BlockHeader* Header = HeaderAt(State.RunStart);
+    Header->Granules = (uint32_t) State.RunGranules;
+    Header->Flags = 0;
+
+    // A single Granule has no room for a link; it'll be picked up by the next sweep.
+    if(State.RunGranules > 1) {
+        size_t Class = State.RunGranules < HEAP_FREE_CLASSES ? State.RunGranules : 0;
+        *(size_t*) HeaderAt(State.RunStart + 1) = 0;
+
+        if(State.Tails[Class] != 0)
+            *(size_t*) HeaderAt(State.Tails[Class] + 1) = State.RunStart;
+        else
+            State.Heads[Class] = State.RunStart;
+        State.Tails[Class] = State.RunStart;
+    }
+
+    State.RunGranules = 0;
+}
+
+/**
+ * Splice the free blocks that a sweep found onto the front of the free lists, and take what it freed off the counts.
+ * The heap lock must be held.
+ */
+void ObjectHeap::InstallFreeLists(SweepState& State) {
+    for(size_t Class = 0; Class < HEAP_FREE_CLASSES; Class++) {
+        if(State.Heads[Class] == 0) continue;
+
+        *(size_t*) HeaderAt(State.Tails[Class] + 1) = FreeLists[Class];
+        FreeLists[Class] = State.Heads[Class];
+    }
+
+    CountFree(State.FreedBytes, State.FreedArrayBytes);
+}
+
+/**
+ * Forget every free block.
+ * A sweep finds all of them again (and coalesces them with whatever died next to them), so the free lists are
+ *  dropped before one starts. Until it's done, new Objects come from the Top of the arena.
+ * The heap lock must be held.
+ */
+void ObjectHeap::DropFreeLists() {
+    for(size_t& List : FreeLists)
+        List = 0;
+}
+
+/**
+ * Store a value into a slot of an Object's Variable Data.
+ *
+ * This is the SATB write barrier used by the Collector.
+ * While the Collector is marking, the value being overwritten has to be logged first, or an Object that was
+ *  reachable at the start of the cycle could be hidden from it.
+ * Stores that may overwrite a reference in the heap (putfield, aastore) must go through here.
+ *
+ * @param Slot the slot in an Object's Variable Data to write to
+ * @param Value the value to write
+ */
+void ObjectHeap::StoreReference(Variable* Slot, Variable Value) {
+    if(Collector::BarrierActive) {
+        std::lock_guard<std::mutex> lock(Lock);
+        Collector::Remember(*Slot);
+        *Slot = Value;
+        return;
+    }
+
+    *Slot = Value;
+}
+
+/**
+ * Read an element of a reference array.
+ * With compressed references, the element is a 32 bit offset that has to be widened.
+ * @param Array the array to read from
+ * @param Index the index of the element
+ * @return the reference stored there
+ */
+Object ObjectHeap::LoadElement(Object Array, uint32_t Index) {
+    Variable* Data = GetObjectPtr(Array);
+
+    Object Value {};
+    if(CompressedReferences)
+        Value.Heap = ((uint32_t*) (Data + ARRAY_HEADER_SLOTS))[Index];
+    else
+        Value = Data[Index + ARRAY_HEADER_SLOTS].object;
+
+    return Value;
+}
+
+/**
+ * Write an element of a reference array, going through the write barrier like StoreReference.
+ * With compressed references, the element is narrowed to a 32 bit offset.
+ * @param Array the array to write into
+ * @param Index the index of the element
+ * @param Value the reference to store
+ */
+void ObjectHeap::StoreElement(Object Array, uint32_t Index, Object Value) {
+    Variable* Data = GetObjectPtr(Array);
+
+    if(!CompressedReferences) {
+        StoreReference(&Data[Index + ARRAY_HEADER_SLOTS], Variable(Value));
+        return;
+    }
+
+    StoreCompressed(&((uint32_t*) (Data + ARRAY_HEADER_SLOTS))[Index], Value);
+}
+
+/**
+ * Find how wide each element of an array is.
+ * @param Array the array to check
+ * @return the size of one element in bytes; a reference for reference arrays, or ArrayElementSize for primitives.
+ */
+size_t ObjectHeap::ElementWidth(Object Array) {
+    GetObjectPtr(Array);
+
+    if(HeaderAt(Array.Heap - 1)->Flags & BLOCK_REFERENCES)
+        return ReferenceSize();
+
+    return ArrayElementSize(GetArrayType(Array));
+}
+
+/**
+ * Show every reference in a range of a reference array to the write barrier, before they're all overwritten at once.
+ * This is the same as what StoreElement does for each one. The heap lock must be held.
+ * @param Array the array that's about to be written to
+ * @param From the first element that will be overwritten
+ * @param Count how many elements will be overwritten
+ */
+void ObjectHeap::RememberElements(Object Array, uint32_t From, uint32_t Count) {
+    for(uint32_t i = From; i < From + Count; i++)
+        Collector::Remember(Variable(LoadElement(Array, i)));
+}
+
+/**
+ * Copy a range of elements from one array to another, for System.arraycopy.
+ * Both arrays must hold the same kind of element, which is up to the caller to check, along with the bounds.
+ *
+ * The elements are packed at the same width in both arrays, so the whole range is moved as a single block of memory.
+ * That's correct even when the two ranges overlap in the same array.
+ * References that are about to be overwritten go through the write barrier first, so a copy in the middle of a
+ *  concurrent cycle is the same as storing every element one by one.
+ *
+ * @param Source the array to copy from
+ * @param SourcePos the index of the first element to copy
+ * @param Dest the array to copy into
+ * @param DestPos the index the first element is copied to
+ * @param Length how many elements to copy
+ */
+void ObjectHeap::CopyElements(Object Source, uint32_t SourcePos, Object Dest, uint32_t DestPos, uint32_t Length) {
+    size_t Width = ElementWidth(Dest);
+    uint8_t* From = GetArrayData(Source) + SourcePos * Width;
+    uint8_t* To = GetArrayData(Dest) + DestPos * Width;
+
+    if(Collector::BarrierActive && (HeaderAt(Dest.Heap - 1)->Flags & BLOCK_REFERENCES)) {
+        std::lock_guard<std::mutex> lock(Lock);
+        RememberElements(Dest, DestPos, Length);
+        memmove(To, From, Length * Width);
+        return;
+    }
+
+    memmove(To, From, Length * Width);
+}
+
+/**
+ * Set a range of an array to the same value, for Arrays.fill.
+ * The caller has to check the bounds, and that the value can be stored in the array.
+ *
+ * The first element is written as normal, and then everything written so far is copied after itself until the range
+ *  is full. That's a handful of memcpy calls, which use the widest stores the machine has, rather than one store per
+ *  element. Bytes and booleans can skip all of that and go straight to memset.
+ *
+ * @param Array the array to fill
+ * @param From the index of the first element to set
+ * @param To the index after the last element to set
+ * @param Value the value to set them to; the low bytes are stored, so a reference is its' Heap offset
+ */
+void ObjectHeap::FillElements(Object Array, uint32_t From, uint32_t To, Variable Value) {
+    if(From >= To) return;
+
+    size_t Width = ElementWidth(Array);
+    size_t Bytes = (To - From) * Width;
+    uint8_t* Data = GetArrayData(Array) + From * Width;
+
+    std::unique_lock<std::mutex> Guard(Lock, std::defer_lock);
+    if(Collector::BarrierActive && (HeaderAt(Array.Heap - 1)->Flags & BLOCK_REFERENCES)) {
+        Guard.lock();
+        RememberElements(Array, From, To - From);
+    }
+
+    if(Width == 1) {
+        memset(Data, Value.charVal, Bytes);
+        return;
+    }
+
+    memcpy(Data, &Value, Width);
+    for(size_t Done = Width; Done < Bytes; Done *= 2)
+        memcpy(Data + Done, Data, std::min(Done, Bytes - Done));
+}
+
+/**
+ * Write a compressed reference, going through the write barrier like StoreReference.
+ * @param Slot the 32 bit slot to write into
+ * @param Value the reference to store
+ */
+void ObjectHeap::StoreCompressed(uint32_t* Slot, Object Value) {
+    if(Collector::BarrierActive) {
+        std::lock_guard<std::mutex> lock(Lock);
+        Collector::Remember(Variable((size_t) *Slot));
+        *Slot = (uint32_t) Value.Heap;
+        return;
+    }
+
+    *Slot = (uint32_t) Value.Heap;
+}
+
+/**
+ * Read an instance field, at the width of its type.
+ * Like the xaload instructions, byte and short are sign extended, and char is not.
+ * @param obj the Object to read from
+ * @param Offset the byte offset of the field in the Object's Variable Data, from Class#GetFieldOffset
+ * @param Type the type of the field, from Class#GetFieldType
+ * @return the value of the field
+ */
+Variable ObjectHeap::LoadField(Object obj, uint32_t Offset, uint8_t Type) {
+    uint8_t* Field = (uint8_t*) GetObjectPtr(obj) + Offset;
+    Variable Value;
+
+    switch(Type) {
+        case ArrayBoolean:
+        case ArrayByte:   Value.intVal = (int32_t) *(int8_t*) Field; break;
+        case ArrayChar:   Value.intVal = *(uint16_t*) Field; break;
+        case ArrayShort:  Value.intVal = (int32_t) *(int16_t*) Field; break;
+        case ArrayInt:
+        case ArrayFloat:  Value.intVal = *(uint32_t*) Field; break;
+        case FieldReference:
+            Value.pointerVal = CompressedReferences ? *(uint32_t*) Field : *(size_t*) Field;
+            break;
+        default:          Value.pointerVal = *(uint64_t*) Field; break;
+    }
+
+    return Value;
+}
+
+/**
+ * Write an instance field, narrowing the value to the width of its type.
+ * References go through the write barrier.
+ * @param obj the Object to write into
+ * @param Offset the byte offset of the field in the Object's Variable Data, from Class#GetFieldOffset
+ * @param Type the type of the field, from Class#GetFieldType
+ * @param Value the value to store
+ */
+void ObjectHeap::StoreField(Object obj, uint32_t Offset, uint8_t Type, Variable Value) {
+    uint8_t* Field = (uint8_t*) GetObjectPtr(obj) + Offset;
+
+    switch(Type) {
+        case ArrayBoolean:
+        case ArrayByte:   *Field = (uint8_t) Value.intVal; break;
+        case ArrayChar:
+        case ArrayShort:  *(uint16_t*) Field = (uint16_t) Value.intVal; break;
+        case ArrayInt:
+        case ArrayFloat:  *(uint32_t*) Field = Value.intVal; break;
+        case FieldReference:
+            if(CompressedReferences)
+                StoreCompressed((uint32_t*) Field, Value.object);
+            else
+                StoreReference((Variable*) Field, Value);
+            break;
+        default:          *(uint64_t*) Field = Value.pointerVal; break;
+    }
+}
+
+/**
+ * Find where the references are in an instance, for the Collector.
+ * This is out here, rather than in ForEachReference, because Objects.hpp can't see inside a Class.
+ * @param Data the Variable Data of an instance
+ * @return the byte offsets of every reference field in it.
+ */
+const std::vector<uint32_t>& ObjectHeap::InstanceReferences(Variable* Data) {
+    static const std::vector<uint32_t> None;
+
+    auto* InstanceClass = (Class*) Data[0].pointerVal;
+    if(InstanceClass == nullptr) return None;
+
+    return InstanceClass->GetReferenceOffsets();
+}
 
 /**
  * A simple wrapper to create a new instance of the given class.
@@ -77,7 +997,7 @@ ObjectHeap::~ObjectHeap() = default;
  * The Object will have its' layout according to that of the main comment;
  *  First, the class pointer, then the class field data.
  *
- * Once the new Object is ready, it will be emplaced into the heap.
+ * The space for the new Object comes out of the arena, already zeroed.
  *
  * @param Class the Class to be instantiated.
  * @return the constructed class, or the Null object if failed.
@@ -86,42 +1006,69 @@ ObjectHeap::~ObjectHeap() = default;
 Object ObjectHeap::CreateObject(Class *Class) {
     if(Class == nullptr) return Null;
 
-    // This is where we set the length of the Variable Data.
-    size_t ObjectSize = Class->GetClassFieldCount() + 1;
-    auto* ClassObj = new Variable[ObjectSize];
+    return CreateObject(InstanceTemplate(Class));
+}
 
-    Object object{};
-    object.Heap = NextObjectID++;
-    object.Type = 0;
+/**
+ * Create a new instance from an Allocation Template.
+ * The new instruction caches a template for every class it creates, so this is its' fast path.
+ * @param Template the template, from InstanceTemplate
+ * @return the constructed class.
+ */
+Object ObjectHeap::CreateObject(const AllocationTemplate& Template) {
+    Object object {};
+    Allocate(Template, object);
 
-    // The first entry in the Variable Data is the Class pointer.
-    ClassObj[0].pointerVal = (size_t) Class;
+    return object;
+}
 
-    // The Object is placed into the map so that we can fetch it later.
-    ObjectMap.emplace((size_t) object.Heap, (size_t) ClassObj);
+/**
+ * Work out how to allocate an instance of the given class.
+ * The result only depends on the class' layout, so it can be kept for as long as the class is loaded.
+ * @param Class the (linked) class to be instantiated
+ * @return the template to give to CreateObject.
+ */
+AllocationTemplate ObjectHeap::InstanceTemplate(Class* Class) {
+    // This is where we set the length of the Variable Data.
+    // The instance size includes the Class pointer, and the fields are packed, so round it up to whole Variables.
+    size_t ObjectSize = (Class->GetInstanceSize() + HEAP_GRANULE - 1) / HEAP_GRANULE;
 
-    return object;
+    // The first entry in the Variable Data is the Class pointer.
+    return AllocationTemplate { { (uint32_t) ObjectSize + 1, BLOCK_REFERENCES | BLOCK_ALLOCATED }, (size_t) Class, 0 };
 }
 
 /**
  * A simple wrapper to retrieve the Variable Data of the given Object.
- * Effectively reads the heap ID and looks up the data in the Object Map.
+ * Effectively adds the reference, in Granules, to the start of the arena.
  * @param obj the Object to retrieve the data of
  * @return the Variable Data of the given Object.
  */
 Variable* ObjectHeap::GetObjectPtr(Object obj) {
-    auto objIter = ObjectMap.find(obj.Heap);
-
     // Perform a basic sanity check, but this should not be possible in normal usage.
-    // If an Object has been instantiated (and a new ID generated) without being placed in the Map, something
-    // has gone horribly wrong.
-    if(objIter == ObjectMap.end()) {
-        printf("******************\nObject Heap does not contain object " PrtSizeT ". Highest object is " PrtSizeT ".\n******************\n", obj.Heap, ObjectMap.size());
+    // If a reference points outside of the arena, something has gone horribly wrong.
+    if(obj.Heap == 0 || obj.Heap >= Limit || (obj.Heap >= Top && obj.Heap <= LargeBottom)) {
+        printf("******************\nObject Heap does not contain object " PrtSizeT ". Top of the heap is " PrtSizeT ", large objects start at " PrtSizeT ".\n******************\n", obj.Heap, Top, LargeBottom);
         for(;;);
     }
 
-    // For most normal usage, just cast and return the map value.
-    return (Variable*) objIter->second;
+    // For most normal usage, just return the Variable Data.
+    return (Variable*) (Base + (obj.Heap << HEAP_GRANULE_SHIFT));
+}
+
+/**
+ * Find the value and coder fields of java/lang/String, which everything that works on a String's contents needs.
+ * The Symbols are only interned the first time; after that, it's a lookup in the String class' Field Index.
+ * @return false if the String class doesn't have them.
+ */
+static bool FindStringFields(Class* String, Class* &ValueOwner, uint16_t& ValueField, Class* &CoderOwner, uint16_t& CoderField) {
+    static Symbol* const Value = SymbolTable::Intern("value");
+    static Symbol* const Coder = SymbolTable::Intern("coder");
+    static Symbol* const ByteArray = SymbolTable::Intern("[B");
+    static Symbol* const Byte = SymbolTable::Intern("B");
+
+    ValueOwner = String->FindField(Value, ByteArray, ValueField);
+    CoderOwner = String->FindField(Coder, Byte, CoderField);
+    return ValueOwner != nullptr && CoderOwner != nullptr;
 }
 
 /**
@@ -129,101 +1076,408 @@ Variable* ObjectHeap::GetObjectPtr(Object obj) {
  * Primarily, we need to account for interning, which breaks the usual Object pattern.
  *
  * However, if we assume this method is the end point of all interning handling, then it's simple;
+ *  - Work out whether the String fits in Latin-1, and encode it
  *  - Create an instance of the String class
- *  - Create a Char array to fit inside it
- *  - Copy the String data into the char array
- *  - Put the char array into the class instance
+ *  - Create a byte array to fit inside it
+ *  - Copy the encoded String data into the byte array
+ *  - Put the byte array and its' coder into the class instance
  *  - Return the class instance
  *
  * That's rather a lot of work, so it's handled in this wrapper.
  *
- * @param String the String data to put in the new instance
+ * @param String the String data to put in the new instance, as (modified) UTF-8 from a class file
  * @param ClassHeap the Heap to load the String class from.
  * @return the new String instance as an Object
  */
 Object ObjectHeap::CreateString(const std::string& String, ClassHeap *ClassHeap) {
+    std::string Value;
+    uint8_t Coder = EncodeString(String, Value);
+
+    return CreateString(Value, Coder, ClassHeap);
+}
+
+/**
+ * Create a String instance from data that is already encoded the way the String class keeps it.
+ * @param Value the contents; one byte per char for Latin-1, two (low byte first) for UTF-16
+ * @param Coder STRING_LATIN1 or STRING_UTF16
+ * @param ClassHeap the Heap to load the String class from.
+ * @return the new String instance as an Object
+ */
+Object ObjectHeap::CreateString(const std::string& Value, uint8_t Coder, ClassHeap *ClassHeap) {
     // Retrieve the String class
     if(ClassHeap == nullptr) return Null;
     Class* Class = ClassHeap->GetClass("java/lang/String");
     if(Class == nullptr) return Null;
 
+    // Find where the value and coder go.
+    uint16_t ValueField, CoderField;
+    class Class* ValueOwner, * CoderOwner;
+    if(!FindStringFields(Class, ValueOwner, ValueField, CoderOwner, CoderField)) return Null;
+
     // Create a new String instance
     Object obj = CreateObject(Class);
-    Variable* Var = this->GetObjectPtr(obj);
-    if(Var == nullptr) return Null;
-
-    // Create a new char array
-    Object array = CreateArray(5, String.length());
-    auto* data = (Variable*) ObjectMap.at(array.Heap);
-    
-    // Copy the string into the array
-    const char* str = String.c_str();
-    size_t strLen = String.length();
-    for(size_t i = 0; i < strLen; i++)
-        data[i + 1] = Variable(str[i]);
-
-    // Append the array to the String instance, storing the data within.
-    Var[1].object = array;
+
+    // Byte arrays are packed, so the whole String can be copied in at once.
+    // Nothing refers to the instance yet, so it's pinned in case the array has to collect first.
+    Pinned.push_back(obj.Heap);
+    Object array = CreateArray(ArrayByte, Value.length());
+    Pinned.pop_back();
+    memcpy(GetArrayData(array), Value.data(), Value.length());
+
+    StoreField(obj, ValueOwner->GetFieldOffset(ValueField), ValueOwner->GetFieldType(ValueField), Variable(array));
+    StoreField(obj, CoderOwner->GetFieldOffset(CoderField), CoderOwner->GetFieldType(CoderField), Variable((int) Coder));
 
     return obj;
 }
 
+/**
+ * Convert the modified UTF-8 of a class file constant into the representation used by the String class.
+ * If every char fits in a byte, the String is Latin-1 and takes one byte per char.
+ * Otherwise, it falls back to UTF-16, with two bytes per char, low byte first.
+ *
+ * @param String the modified UTF-8 data
+ * @param Value set to the encoded contents
+ * @return the coder of the encoded contents
+ */
+uint8_t ObjectHeap::EncodeString(const std::string& String, std::string& Value) {
+    std::u16string Chars;
+    Chars.reserve(String.length());
+
+    auto* Bytes = (const uint8_t*) String.data();
+    size_t Length = String.length();
+    for(size_t i = 0; i < Length;) {
+        // Modified UTF-8 never has four byte forms; anything outside of the BMP is a pair of three byte surrogates.
+        if((Bytes[i] & 0xE0) == 0xC0 && i + 1 < Length) {
+            Chars.push_back((char16_t) (((Bytes[i] & 0x1F) << 6) | (Bytes[i + 1] & 0x3F)));
+            i += 2;
+        } else if((Bytes[i] & 0xF0) == 0xE0 && i + 2 < Length) {
+            Chars.push_back((char16_t) (((Bytes[i] & 0x0F) << 12) | ((Bytes[i + 1] & 0x3F) << 6) | (Bytes[i + 2] & 0x3F)));
+            i += 3;
+        } else {
+            Chars.push_back((char16_t) Bytes[i]);
+            i += 1;
+        }
+    }
+
+    bool Latin1 = true;
+    for(char16_t Char : Chars)
+        if(Char > 0xFF) Latin1 = false;
+
+    Value.clear();
+    if(Latin1) {
+        for(char16_t Char : Chars)
+            Value.push_back((char) Char);
+        return STRING_LATIN1;
+    }
+
+    for(char16_t Char : Chars) {
+        Value.push_back((char) (Char & 0xFF));
+        Value.push_back((char) (Char >> 8));
+    }
+    return STRING_UTF16;
+}
+
+/**
+ * Fetch the canonical String with the given contents, creating it if this is the first time it has been asked for.
+ * String constants are loaded through here, so every ldc of the same literal gives the same Object.
+ *
+ * @param String the contents of the String
+ * @param ClassHeap the ClassHeap containing the String class
+ * @return the interned String, or Null if the String class isn't loaded.
+ */
+Object ObjectHeap::InternString(const std::string& String, ClassHeap *ClassHeap) {
+    // The encoding of a String only depends on what's in it, so the coder and value together make the key.
+    std::string Key;
+    uint8_t Coder = EncodeString(String, Key);
+    Key.push_back((char) Coder);
+
+    auto Existing = InternTable.find(Key);
+    if(Existing != InternTable.end())
+        return Existing->second;
+
+    Object obj = CreateString(Key.substr(0, Key.length() - 1), Coder, ClassHeap);
+    if(obj == Null) return Null;
+
+    InternTable.emplace(std::move(Key), obj);
+    return obj;
+}
+
+/**
+ * The implementation of String.intern.
+ * If a String with the same contents is already interned, that is returned. Otherwise, this String becomes the canonical one.
+ * @param String the String instance to intern
+ * @return the canonical String with the same contents.
+ */
+Object ObjectHeap::Intern(Object String) {
+    if(String == Null) return Null;
+
+    return InternTable.emplace(StringKey(String), String).first->second;
+}
+
+/**
+ * Read the value of a String instance out of its' backing array, followed by its' coder.
+ * This is the key for the intern table.
+ * @param String the String instance
+ * @return the key of the String, or nothing if it isn't a String.
+ */
+std::string ObjectHeap::StringKey(Object String) {
+    Class* Class = GetClass(String);
+    if(Class == nullptr) return "";
+
+    uint16_t ValueField, CoderField;
+    class Class* ValueOwner, * CoderOwner;
+    if(!FindStringFields(Class, ValueOwner, ValueField, CoderOwner, CoderField)) return "";
+
+    Object Array = LoadField(String, ValueOwner->GetFieldOffset(ValueField), ValueOwner->GetFieldType(ValueField)).object;
+    if(Array == Null) return "";
+
+    std::string Key((const char*) GetArrayData(Array), GetArraySize(Array));
+    Key.push_back((char) LoadField(String, CoderOwner->GetFieldOffset(CoderField), CoderOwner->GetFieldType(CoderField)).intVal);
+    return Key;
+}
+
+/**
+ * Primitive arrays store their elements at the natural width of the type.
+ * @param Type the Type of the array, as given to newarray
+ * @return the size of one element in bytes.
+ */
+size_t ObjectHeap::ArrayElementSize(uint8_t Type) {
+    switch(Type) {
+        case ArrayBoolean:
+        case ArrayByte:
+            return 1;
+
+        case ArrayChar:
+        case ArrayShort:
+            return 2;
+
+        case ArrayFloat:
+        case ArrayInt:
+            return 4;
+
+        default:
+            return 8;
+    }
+}
+
 /**
  * A simple wrapper to create an array Object on heap.
  *
  * An array structure is specified in the primary comment of this file.
- * In short, the first index specifies the type of the array, followed by the data.
+ * In short, the first index specifies the type of the array, followed by the packed data.
  *
  * @param Type the Type of the data that will go into this Array.
  * @param Count the amount of data that will go into this Array.
  * @return the new, empty Array with the correct allocated size
  */
 Object ObjectHeap::CreateArray(uint8_t Type, uint32_t Count) {
-    // Allocate the Variable Data first.
-    auto* array = new Variable[Count + 1];
+    // Allocate the Variable Data first; it comes zeroed, as Java arrays start out full of zeroes.
+    // The first index is set as it's allocated; array type.
+    Object object {};
+    const AllocationTemplate Template = ArrayTemplate(Type, Type, Count, 1, Type);
+    Variable* array = Allocate(Template, object);
+    // And then the length.
+    array[1].pointerVal = Template.Shape | Count;
+
+    return object;
+}
+
+/**
+ * Work out the header and class word of an array.
+ * The length isn't part of the template, as it goes in the Variable Data; it has to be stored after allocating.
+ *
+ * The shape goes in the top of the length word, so that it doesn't cost any space. Nothing but the bulk array
+ *  intrinsics need it yet; they have to know what an array of arrays can hold, which the class word can't say.
+ *
+ * @param Type the Array Type of a primitive array, or FieldReference for a reference array
+ * @param Klass the class word; the Array Type again for primitives, or the Class pointer of the innermost elements
+ * @param Count the length of the array
+ * @param Dimensions how many dimensions the array has; 1 unless it holds arrays
+ * @param Innermost the Array Type of the primitives at the bottom of the array, or 0 if they're Objects
+ * @return everything that Allocate needs to make the array.
+ */
+AllocationTemplate ObjectHeap::ArrayTemplate(uint8_t Type, size_t Klass, uint32_t Count, uint8_t Dimensions, uint8_t Innermost) {
+    // One Variable each for the Array Type and Length, then enough whole Variables to hold the elements.
+    size_t Bytes = (size_t) Count * FieldSize(Type);
+    size_t Granules = 1 + ARRAY_HEADER_SLOTS + (Bytes + HEAP_GRANULE - 1) / HEAP_GRANULE;
 
-    // Prepare the Object ready for emplacement later
-    Object object{};
-    object.Heap = NextObjectID++;
-    object.Type = Type;
+    // A Block Header only has room for 32 bits of size.
+    if(Granules > UINT32_MAX)
+        OutOfMemory("Requested array size exceeds VM limit", Granules * HEAP_GRANULE);
 
-    // Initialize the Variable Data, since we've only allocated it
-    for (size_t i = 0; i < Count + 1; i++)
-        array[i] = Variable((char) 0);
-    // Set the first index; array type.
-    array[0].intVal = Type;
+    // Primitive arrays never hold references, so the Collector doesn't need to look inside.
+    uint32_t Flags = BLOCK_ALLOCATED | BLOCK_ARRAY;
+    if(Type == FieldReference) {
+        Flags |= BLOCK_REFERENCES;
+        if(CompressedReferences)
+            Flags |= BLOCK_COMPRESSED;
+    }
 
-    // Emplace the object into the required maps - it's an array and an Object, so there's two.
-    ObjectMap.emplace((size_t) object.Heap, (size_t) array);
-    ArraySizeMap.emplace((size_t) object.Heap, (size_t) Count);
+    size_t Shape = ((size_t) Dimensions << ARRAY_DIMENSIONS_SHIFT) | ((size_t) Innermost << ARRAY_INNERMOST_SHIFT);
+    return { { (uint32_t) Granules, Flags }, Klass, Shape };
+}
 
-    return object;
+/**
+ * Create a multi-dimensional array, for multinewarray.
+ *
+ * Every level of the tree is filled in, down to the last one that has a count; that one is left zeroed, whether its
+ *  elements are primitives or null references to arrays that haven't been made yet.
+ * A count of 0 stops the tree there, as there's nothing to hang the next level off.
+ *
+ * As long as none of the arrays in the tree are large objects on their own, the whole tree is allocated in one go
+ *  and laid out as described at the top of this file. Otherwise, each array is allocated by itself, so that the
+ *  big ones can go to the large object space.
+ *
+ * @param Levels how to allocate an array at each level, from the outermost in. See ArrayTemplate.
+ * @param Counts the length of the arrays at each level
+ * @return the outermost array.
+ */
+Object ObjectHeap::CreateMultiArray(const std::vector<AllocationTemplate>& Levels, const std::vector<uint32_t>& Counts) {
+    // Add up the whole tree. There's one outermost array, Counts[0] arrays at the next level, and so on.
+    size_t Total = 0;
+    size_t Siblings = 1;
+    bool Contiguous = true;
+
+    for(size_t Level = 0; Level < Levels.size() && Siblings != 0; Level++) {
+        size_t Granules = Levels[Level].Header.Granules;
+
+        if(Granules * HEAP_GRANULE >= HEAP_LARGE_OBJECT)
+            Contiguous = false;
+
+        // Anything this big would never fit in the arena anyway, and carrying on could overflow.
+        if(Siblings > (MaxHeapSize >> HEAP_GRANULE_SHIFT) / Granules)
+            OutOfMemory("Java heap space", MaxHeapSize);
+
+        Total += Siblings * Granules;
+        Siblings *= Counts[Level];
+    }
+
+    Object Outer {};
+    if(!Contiguous || Levels.size() == 1) {
+        Outer.Heap = AllocateTree(Levels, Counts, 0);
+        return Outer;
+    }
+
+    size_t Next;
+    for(bool Collected = false; ; Collected = true) {
+        {
+            HEAP_LOCK;
+            if(Base == nullptr)
+                Reserve();
+
+            Next = TakeArena(Total);
+            if(Next != 0)
+                Outer.Heap = CarveTree(Levels, Counts, 0, Next);
+        }
+
+        if(Next != 0) break;
+
+        // The same as in Allocate; collect everything that can be, and only then give up.
+        if(Collected)
+            OutOfMemory("Java heap space", Total * HEAP_GRANULE);
+
+        Collector::Reclaim();
+    }
+
+    CountAllocation(BLOCK_ARRAY, Total * HEAP_GRANULE);
+    Collector::NotifyAllocation(Total * HEAP_GRANULE);
+    return Outer;
+}
+
+/**
+ * Lay out one array of a multi-dimensional array, and then everything under it, in space that's already been taken.
+ * The heap lock must be held.
+ *
+ * @param Levels how to allocate an array at each level
+ * @param Counts the length of the arrays at each level
+ * @param Level which level this array is on
+ * @param Next the next free Granule in the space; moved on past everything that was laid out
+ * @return the reference to the array.
+ */
+size_t ObjectHeap::CarveTree(const std::vector<AllocationTemplate>& Levels, const std::vector<uint32_t>& Counts, size_t Level, size_t& Next) {
+    const AllocationTemplate& Template = Levels[Level];
+    size_t Block = Next;
+    Next += Template.Header.Granules;
+
+    BlockHeader* Header = HeaderAt(Block);
+    *Header = Template.Header;
+    auto* Data = (Variable*) (Header + 1);
+    Data[0].pointerVal = Template.Klass;
+    Data[1].pointerVal = Template.Shape | Counts[Level];
+    SetBlockStart(Block);
+
+    if(AllocateBlack)
+        TryMark(Block + 1);
+
+    if(Level + 1 == Levels.size())
+        return Block + 1;
+
+    // The rows are brand new, and so is this array, so there's no barrier to go through.
+    for(uint32_t i = 0; i < Counts[Level]; i++) {
+        size_t Row = CarveTree(Levels, Counts, Level + 1, Next);
+
+        if(CompressedReferences)
+            ((uint32_t*) (Data + ARRAY_HEADER_SLOTS))[i] = (uint32_t) Row;
+        else
+            Data[ARRAY_HEADER_SLOTS + i].pointerVal = Row;
+    }
+
+    return Block + 1;
+}
+
+/**
+ * Allocate one array of a multi-dimensional array, and then everything under it, one Object at a time.
+ * Any of the allocations under it could have to collect, and nothing else refers to the array until it's returned, so
+ *  it's pinned until then.
+ *
+ * @param Levels how to allocate an array at each level
+ * @param Counts the length of the arrays at each level
+ * @param Level which level this array is on
+ * @return the reference to the array.
+ */
+size_t ObjectHeap::AllocateTree(const std::vector<AllocationTemplate>& Levels, const std::vector<uint32_t>& Counts, size_t Level) {
+    Object Array {};
+    Variable* Data = Allocate(Levels[Level], Array);
+    Data[1].pointerVal = Levels[Level].Shape | Counts[Level];
+
+    if(Level + 1 == Levels.size())
+        return Array.Heap;
+
+    Pinned.push_back(Array.Heap);
+    for(uint32_t i = 0; i < Counts[Level]; i++)
+        StoreElement(Array, i, Object { AllocateTree(Levels, Counts, Level + 1) });
+    Pinned.pop_back();
+
+    return Array.Heap;
+}
+
+/**
+ * Find the elements of a primitive array.
+ * They start immediately after the Array Type and Length, packed at the width given by ArrayElementSize.
+ * @param obj the array to look into
+ * @return a pointer to the first element.
+ */
+uint8_t* ObjectHeap::GetArrayData(Object obj) {
+    return (uint8_t*) (GetObjectPtr(obj) + ARRAY_HEADER_SLOTS);
 }
 
 /**
  * A simple wrapper to create an array of Class Instances.
  * This is much the same as a regular array, except its' type is replaced with the class pointer.
+ * The elements are references; use LoadElement and StoreElement to access them.
  *
  * @param pClass the Class type that this array will store
  * @param Count the number of items in the array.
  * @return the empty, allocated Array of Class instances.
  */
 Object ObjectHeap::CreateObjectArray(Class* pClass, uint32_t Count) {
-    // Pre-allocate the Variable Data.
-    auto* array = new Variable[Count];
+    // Index 0 is the class type, index 1 the length, and then the elements are packed at the width of a reference.
+    // The first index is set as it's allocated; the class type
+    Object object {};
+    const AllocationTemplate Template = ArrayTemplate(FieldReference, (size_t) pClass, Count, 1, 0);
+    Variable* array = Allocate(Template, object);
+    array[1].pointerVal = Template.Shape | Count;
 
-    // Initialize the Variables, since we only allocated them
-    for (size_t i = 1; i < Count; i++)
-        array[i] = Variable((char) 0);
-    // Set the first index; the class type
-    array[0].pointerVal = (size_t) pClass;
-
-    Object object{};
-    object.Heap = NextObjectID++;
-
-    // This is an Object and an array, so emplace it into two Maps.
-    ObjectMap.emplace((size_t) object.Heap, (size_t) array);
-    ArraySizeMap.emplace((size_t) object.Heap, (size_t) Count);
     return object;
 }
 
@@ -233,11 +1487,103 @@ Object ObjectHeap::CreateObjectArray(Class* pClass, uint32_t Count) {
  * @return the length of the given array.
  */
 size_t ObjectHeap::GetArraySize(Object obj) {
-    auto objIter = ArraySizeMap.find(obj.Heap);
-
     // Quick sanity check - this should not be possible in normal usage.
-    if(objIter == ArraySizeMap.end())
+    if(!IsArray(obj))
         return 0;
 
-    return objIter->second;
+    return GetObjectPtr(obj)[1].pointerVal & ARRAY_LENGTH_MASK;
+}
+
+/**
+ * Check whether an Object is an array, from the flags in its header.
+ * @param obj the Object to check
+ * @return true if it has an Array Length.
+ */
+bool ObjectHeap::IsArray(Object obj) {
+    if(obj.Heap == 0) return false;
+
+    GetObjectPtr(obj);
+    return HeaderAt(obj.Heap - 1)->Flags & BLOCK_ARRAY;
+}
+
+/**
+ * Find the class of an Object from its class word.
+ * For reference arrays, this is the class of the elements.
+ * @param obj the Object to check
+ * @return the Class, or nullptr if this is a primitive array.
+ */
+Class* ObjectHeap::GetClass(Object obj) {
+    Variable* Data = GetObjectPtr(obj);
+
+    if((HeaderAt(obj.Heap - 1)->Flags & (BLOCK_ARRAY | BLOCK_REFERENCES)) == BLOCK_ARRAY)
+        return nullptr;
+
+    return (Class*) Data[0].pointerVal;
+}
+
+/**
+ * Find the type of a primitive array from its class word.
+ * @param obj the array to check
+ * @return the Type given to newarray, or 0 if this is not a primitive array.
+ */
+uint8_t ObjectHeap::GetArrayType(Object obj) {
+    Variable* Data = GetObjectPtr(obj);
+
+    if((HeaderAt(obj.Heap - 1)->Flags & (BLOCK_ARRAY | BLOCK_REFERENCES)) != BLOCK_ARRAY)
+        return 0;
+
+    return (uint8_t) Data[0].intVal;
+}
+
+/**
+ * Find how many dimensions an array has, from the shape in its length word.
+ * @param obj the array to check
+ * @return 1 for an array of primitives or Objects, 2 for an array of those arrays, and so on.
+ */
+uint8_t ObjectHeap::GetArrayDimensions(Object obj) {
+    return (uint8_t) (GetObjectPtr(obj)[1].pointerVal >> ARRAY_DIMENSIONS_SHIFT);
+}
+
+/**
+ * Find what's at the bottom of an array, from the shape in its length word.
+ * For a primitive array, this is the same as GetArrayType. For an array of them, it's the only way to tell.
+ * @param obj the array to check
+ * @return the Array Type of the innermost elements, or 0 if they're Objects.
+ */
+uint8_t ObjectHeap::GetInnermostType(Object obj) {
+    return (uint8_t) (GetObjectPtr(obj)[1].pointerVal >> ARRAY_INNERMOST_SHIFT);
+}
+
+/**
+ * Get the identity hash of an Object, as returned by Object.hashCode and System.identityHashCode.
+ *
+ * Most Objects are never hashed, so the hash isn't generated until the first time it's asked for.
+ * Then it's stored in the top of the Block Header, so the same Object always gives the same hash.
+ * Objects never move, so the hash could be made from the reference, but that would make
+ *  neighbouring Objects hash to neighbouring values.
+ *
+ * @param obj the Object to hash
+ * @return a hash that is never 0, and never changes for the lifetime of the Object.
+ */
+uint32_t ObjectHeap::GetIdentityHash(Object obj) {
+    GetObjectPtr(obj);
+
+    HEAP_LOCK;
+    BlockHeader* Header = HeaderAt(obj.Heap - 1);
+
+    if((Header->Flags & HASH_MASK) == 0) {
+        uint32_t Hash;
+
+        // A Marsaglia xorshift, skipping anything that leaves the hash bits empty.
+        do {
+            HashSeed ^= HashSeed << 13;
+            HashSeed ^= HashSeed >> 17;
+            HashSeed ^= HashSeed << 5;
+            Hash = HashSeed & HASH_MASK;
+        } while(Hash == 0);
+
+        Header->Flags |= Hash;
+    }
+
+    return Header->Flags >> HASH_SHIFT;
 }
\ No newline at end of file
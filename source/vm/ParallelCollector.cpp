@@ -0,0 +1,265 @@
+/**************
+ * GEMWIRE    *
+ *    PURPURI *
+ **************/
+
+#include <vm/Collector.hpp>
+#include <vm/Stack.hpp>
+
+#include <cstdio>
+#include <deque>
+#include <memory>
+
+/**
+ * This file implements the parallel stop-the-world half of the Collector class, declared in Collector.hpp.
+ * It is used instead of the concurrent collector when the VM is started with -Xgc=parallel.
+ *
+ * The interpreter stops at a Safepoint for the whole cycle, which makes everything much simpler:
+ *  nothing else touches the heap, so there's no barrier and no heap lock.
+ * Instead of running alongside the interpreter, the cycle is made shorter by throwing more threads at it.
+ * Marks are set with an atomic or on the mark bitmap, so two workers can never both think they marked an Object.
+ *
+ * A cycle has three phases, which are each timed in the GC log:
+ *  - Roots; the interpreter thread marks everything the Member Stack and class statics point to,
+ *     dealing the Objects out across the workers' mark queues.
+ *  - Mark; every worker traces from its own queue. A worker that runs out steals from the others.
+ *  - Sweep; the arena is split up into Regions, and workers claim Regions one at a time until there are none left.
+ *     Each worker collects the free blocks it finds in its own lists, and they're all spliced in at the end.
+ *     Free space is only coalesced within a Region, so that no two workers ever touch the same block.
+ *
+ * The interpreter thread works as worker 0, so -Xgc-threads=1 runs the whole cycle inline with no extra threads.
+ *
+ * Marking finishes when no worker holds any grey Object.
+ * That's tracked with the Pending count; an Object is counted from the moment it is pushed to a queue until the
+ *  moment a worker is done scanning it. Workers only give up once Pending reaches zero, because until then, the
+ *  Object someone else is scanning could still produce more work.
+ */
+
+/**
+ * One worker's share of the grey set.
+ *
+ * The owner pushes and pops at the back, so it works depth-first through whatever it just found.
+ * Thieves take from the front, which is the oldest work - usually the closest to the roots, so the biggest subgraphs.
+ *
+ * A single lock per queue is enough here; the owner only ever contends with a thief that has run out of work.
+ */
+struct MarkQueue {
+    std::mutex Lock;
+    std::deque<size_t> Items;
+
+    void Push(size_t Ref) {
+        std::lock_guard<std::mutex> lock(Lock);
+        Items.push_back(Ref);
+    }
+
+    bool Pop(size_t& Ref) {
+        std::lock_guard<std::mutex> lock(Lock);
+        if(Items.empty()) return false;
+
+        Ref = Items.back();
+        Items.pop_back();
+        return true;
+    }
+
+    bool Steal(size_t& Ref) {
+        std::lock_guard<std::mutex> lock(Lock);
+        if(Items.empty()) return false;
+
+        Ref = Items.front();
+        Items.pop_front();
+        return true;
+    }
+};
+
+/**
+ * What each worker did during a cycle.
+ * Every worker has its own, so that they don't fight over counters. They're added up for the log afterwards.
+ */
+struct WorkerStats {
+    size_t Marked;
+    size_t Steals;
+    size_t Regions;
+
+    // What this worker freed, and the free blocks it found.
+    SweepState Swept;
+};
+
+static size_t WorkerCount = 1;
+static std::unique_ptr<MarkQueue[]> Queues;
+static std::vector<WorkerStats> Stats;
+
+// How many Objects are in a queue or being scanned right now.
+static std::atomic<size_t> Pending;
+// The next Region that a sweeping worker should claim.
+static std::atomic<size_t> NextRegion;
+// The queue that the next root is dealt to.
+static size_t NextQueue = 0;
+
+/**
+ * Run the given function on every worker.
+ * The calling thread is worker 0, the rest are spun up here and joined before returning.
+ * @param Work the function to run, given the index of its worker.
+ */
+static void RunWorkers(void (*Work)(size_t)) {
+    std::vector<std::thread> Workers;
+    for(size_t i = 1; i < WorkerCount; i++)
+        Workers.emplace_back(Work, i);
+
+    Work(0);
+
+    for(std::thread& Worker : Workers)
+        Worker.join();
+}
+
+/**
+ * Run a full collection with the interpreter stopped.
+ */
+void Collector::Collect() {
+    auto Start = std::chrono::steady_clock::now();
+
+    ObjectHeap& Heap = Engine::_ObjectHeap;
+
+    WorkerCount = Threads;
+    if(WorkerCount == 0)
+        WorkerCount = std::max(1u, std::thread::hardware_concurrency());
+
+    // Nothing can be allocated until we're done, so everything below the Top right now is a candidate.
+    Heap.ClearMarks();
+    AllocatedSinceCycle = 0;
+
+    Queues.reset(new MarkQueue[WorkerCount]);
+    Stats.assign(WorkerCount, WorkerStats {});
+    Pending.store(0);
+    NextQueue = 0;
+
+    // Roots
+    size_t Roots = ScanRoots(ShadeRoot);
+    double RootMillis = ELAPSED_MS(Start);
+
+    // Mark
+    auto MarkStart = std::chrono::steady_clock::now();
+    RunWorkers(MarkWorker);
+    double MarkMillis = ELAPSED_MS(MarkStart);
+
+    // Sweep
+    auto SweepStart = std::chrono::steady_clock::now();
+    NextRegion.store(0);
+    Heap.DropFreeLists();
+    RunWorkers(SweepWorker);
+
+    WorkerStats Total {};
+    for(WorkerStats& Worker : Stats) {
+        Total.Marked += Worker.Marked;
+        Total.Steals += Worker.Steals;
+        Total.Regions += Worker.Regions;
+        Total.Swept.Freed += Worker.Swept.Freed;
+        Total.Swept.FreedBytes += Worker.Swept.FreedBytes;
+
+        Heap.InstallFreeLists(Worker.Swept);
+    }
+    Heap.SweepLarge(Total.Swept);
+    double SweepMillis = ELAPSED_MS(SweepStart);
+
+    Queues.reset();
+    Stats.clear();
+
+    if(Logging) {
+        fprintf(stderr, "[GC] Parallel collection with " PrtSizeT " threads, %.3fms pause\n", WorkerCount, ELAPSED_MS(Start));
+        fprintf(stderr, "[GC]   Roots: " PrtSizeT " slots, %.3fms\n", Roots, RootMillis);
+        fprintf(stderr, "[GC]   Mark:  " PrtSizeT " objects, " PrtSizeT " steals, %.3fms\n", Total.Marked, Total.Steals, MarkMillis);
+        fprintf(stderr, "[GC]   Sweep: " PrtSizeT " objects (" PrtSizeT " bytes), " PrtSizeT " regions swept, %.3fms\n", Total.Swept.Freed, Total.Swept.FreedBytes, Total.Regions, SweepMillis);
+    }
+}
+
+/**
+ * Mark the Object at the given reference, if it exists and hasn't been marked yet.
+ * Several workers may find the same Object at once; only one of them wins, and only the winner scans it.
+ * @param Candidate a value that may be a reference to an Object
+ * @return true if this call marked it.
+ */
+bool Collector::Claim(size_t Candidate) {
+    ObjectHeap& Heap = Engine::_ObjectHeap;
+
+    return Heap.IsObject(Candidate) && !Heap.IsMarked(Candidate - 1) && Heap.TryMark(Candidate);
+}
+
+/**
+ * Mark a root, and deal it out to the next worker's queue.
+ * This is only called by the interpreter thread before the workers start.
+ * @param Candidate a value that may be a reference to an Object
+ */
+void Collector::ShadeRoot(size_t Candidate) {
+    if(!Claim(Candidate)) return;
+
+    Stats[0].Marked++;
+    if(!(Engine::_ObjectHeap.HeaderAt(Candidate - 1)->Flags & BLOCK_REFERENCES)) return;
+
+    Pending.fetch_add(1);
+    Queues[NextQueue].Push(Candidate);
+    NextQueue = (NextQueue + 1) % WorkerCount;
+}
+
+/**
+ * The body of a mark worker.
+ * Scans Objects from its own queue, then from everyone else's, until there's no work left anywhere.
+ * @param Worker the index of this worker
+ */
+void Collector::MarkWorker(size_t Worker) {
+    ObjectHeap& Heap = Engine::_ObjectHeap;
+    MarkQueue& Own = Queues[Worker];
+    WorkerStats& Mine = Stats[Worker];
+
+    while(true) {
+        size_t Ref;
+        bool Found = Own.Pop(Ref);
+
+        // Try everyone else, starting with our neighbour so that thieves spread out.
+        for(size_t i = 1; !Found && i < WorkerCount; i++) {
+            Found = Queues[(Worker + i) % WorkerCount].Steal(Ref);
+            if(Found) Mine.Steals++;
+        }
+
+        if(!Found) {
+            // Someone else is still scanning, and may yet push something for us to steal.
+            if(Pending.load() != 0) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            return;
+        }
+
+        Heap.ForEachReference(Ref, [&](size_t Child) {
+            if(!Claim(Child)) return;
+
+            Mine.Marked++;
+            if(Heap.HeaderAt(Child - 1)->Flags & BLOCK_REFERENCES) {
+                Pending.fetch_add(1);
+                Own.Push(Child);
+            }
+        });
+
+        Pending.fetch_sub(1);
+    }
+}
+
+/**
+ * The body of a sweep worker.
+ * Claims Regions of the arena one by one and frees everything in them that wasn't marked.
+ * A block belongs to the Region its header is in, so no two workers ever touch the same block, and because Regions
+ *  are a multiple of 64 Granules, they never share a word of the Block Start bitmap either.
+ * @param Worker the index of this worker
+ */
+void Collector::SweepWorker(size_t Worker) {
+    ObjectHeap& Heap = Engine::_ObjectHeap;
+    WorkerStats& Mine = Stats[Worker];
+
+    while(true) {
+        size_t Start = NextRegion.fetch_add(1) * HEAP_REGION_GRANULES;
+        if(Start >= Heap.Top) return;
+
+        Heap.Sweep(std::max(Start, (size_t) 1), std::min(Start + HEAP_REGION_GRANULES, Heap.Top), Mine.Swept);
+        Heap.FinishRun(Mine.Swept);
+        Mine.Regions++;
+    }
+}
@@ -0,0 +1,124 @@
+/**************
+ * GEMWIRE    *
+ *    PURPURI *
+ **************/
+
+#include <vm/Symbols.hpp>
+
+/**
+ * This file implements the SymbolTable class declared in Symbols.hpp.
+ *
+ * Every class has a Constants Pool full of strings, and most of them are the same from one class to the next;
+ *  java/lang/Object, <init>, ()V, and the names and descriptors of every method and field that one class uses in
+ *  another. Each class used to keep its own copy of every one of them.
+ *
+ * Now, every string is interned into the Symbol Table when its class is parsed, and the class keeps a pointer to the
+ *  Symbol instead. However many classes use a string, there's only one copy of it.
+ * That also makes comparing them cheap. Looking for a method by name and descriptor is a matter of comparing two
+ *  pointers per method, rather than two strings; see Class#GetMethodFromDescriptor.
+ *
+ * Symbols are never freed, the same as the classes that use them.
+ *
+ * Classes are parsed on the Class Loader's threads as well as the interpreter's, so the table is locked.
+ * It's only touched while parsing, and when something outside of a Constants Pool is looked up by name.
+ *
+ * This is also where the Member Index lives. Every class has one for its methods and one for its fields, built once
+ *  it's parsed, so that finding a member is a hash lookup on a pair of Symbols rather than a walk over all of them.
+ * It's a plain open addressed table with linear probing. Members are never removed, so there's no need for
+ *  tombstones, and it's sized once up front so it never needs to grow.
+ */
+
+std::mutex SymbolTable::Lock;
+std::unordered_map<std::string_view, Symbol*> SymbolTable::Table;
+std::atomic<size_t> SymbolTable::Size { 0 };
+
+/**
+ * Fetch the Symbol for a string, making it if this is the first time the string has been seen.
+ * @param Text the string
+ * @return the one Symbol for it.
+ */
+Symbol* SymbolTable::Intern(std::string_view Text) {
+    std::lock_guard<std::mutex> lock(Lock);
+
+    auto Found = Table.find(Text);
+    if(Found != Table.end())
+        return Found->second;
+
+    auto* New = new Symbol { std::string(Text) };
+    Table.emplace(New->Text, New);
+    Size.fetch_add(sizeof(Symbol) + New->Text.capacity() + sizeof(std::pair<std::string_view, Symbol*>), std::memory_order_relaxed);
+
+    return New;
+}
+
+/**
+ * Fetch the Symbol for a string, if there is one.
+ * If there isn't, then no class that has ever been loaded uses the string, for anything.
+ * @param Text the string
+ * @return the Symbol for it, or null.
+ */
+Symbol* SymbolTable::Find(std::string_view Text) {
+    std::lock_guard<std::mutex> lock(Lock);
+
+    auto Found = Table.find(Text);
+    return Found == Table.end() ? nullptr : Found->second;
+}
+
+/**
+ * Make room for the given number of members. This throws away anything already in the index.
+ * @param Count how many members will be added
+ */
+void MemberIndex::Reserve(size_t Count) {
+    size_t Capacity = 4;
+    while(Capacity < Count * 2)
+        Capacity <<= 1;
+
+    Slots.assign(Capacity, Slot { nullptr, nullptr, None });
+}
+
+/**
+ * Mix the two Symbols into an index into the slots.
+ * Symbols are unique, so their addresses are all that needs hashing. The low bits are always the same, thanks to
+ *  alignment, so the product is taken from the top.
+ */
+size_t MemberIndex::Hash(Symbol* Name, Symbol* Descriptor) const {
+    uint64_t Key = (uint64_t) (uintptr_t) Name * 31 + (uint64_t) (uintptr_t) Descriptor;
+    return (size_t) ((Key * 0x9E3779B97F4A7C15ull) >> 32) & (Slots.size() - 1);
+}
+
+/**
+ * Add a member to the index.
+ * If there's already one with the same name and descriptor, the first one stays; the same as a search from the start.
+ * @param Name the name of the member
+ * @param Descriptor the descriptor of the member
+ * @param Index the index of the member in its class
+ */
+void MemberIndex::Add(Symbol* Name, Symbol* Descriptor, uint16_t Index) {
+    if(Name == nullptr || Slots.empty()) return;
+
+    for(size_t i = Hash(Name, Descriptor); ; i = (i + 1) & (Slots.size() - 1)) {
+        Slot& At = Slots[i];
+        if(At.Name == Name && At.Descriptor == Descriptor) return;
+
+        if(At.Name == nullptr) {
+            At = Slot { Name, Descriptor, Index };
+            return;
+        }
+    }
+}
+
+/**
+ * Find a member by its name and descriptor.
+ * @param Name the name of the member
+ * @param Descriptor the descriptor of the member
+ * @return the index of the member in its class, or None if there isn't one.
+ */
+uint16_t MemberIndex::Find(Symbol* Name, Symbol* Descriptor) const {
+    if(Name == nullptr || Slots.empty()) return None;
+
+    for(size_t i = Hash(Name, Descriptor); ; i = (i + 1) & (Slots.size() - 1)) {
+        const Slot& At = Slots[i];
+        if(At.Name == nullptr) return None;
+        if(At.Name == Name && At.Descriptor == Descriptor) return At.Index;
+    }
+}
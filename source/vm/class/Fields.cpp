@@ -7,6 +7,8 @@
 #include <vm/Class.hpp>
 #include <vm/Stack.hpp>
 
+#include <limits>
+
 /**
  * This file implements all of the functions of the Engine class declared in Class.hpp related to fields.
  *
@@ -31,92 +33,80 @@
  * The field index is stored in the next byte of the program code.
  * It indexes a Field constant in the Class' Constants Pool.
  * The field may not exist in the current class, so it must also be resolved here.
+ * See Class#ResolveField for how that works.
  *
  * Most of this is a simple wrapper around Class#PutStatic.
  *
  * @param Stack the Stack Frame for the method currently being executed.
  */
-void Engine::PutStatic(StackFrame* Stack) const {
+void Engine::PutStatic(StackFrame* Stack) {
     // First, figure out which field we need to write to
     auto ConstantIndex = ReadShortFromStream(&Stack->_Method->Code->Code[Stack->ProgramCounter + 1]);
 
-    // Now we can get the field's name and descriptor.
-    Class* SearchClass = Stack->_Class;
-    std::string FieldName = SearchClass->GetStringConstant(ConstantIndex);
-    
-    // The field's owning class takes some searching.
-    // This is because a class' fields can be in the super class, or any implemented interface.
-    // Thankfully, the Java language tells us which class the field actually belongs to - it's part of the Field data
-    //  that the Constants Pool index points to.
-
-    // First, read the constant pool for the class' name index.
-    char* Data = (char*) SearchClass->Constants[ConstantIndex];
-    auto classInd = ReadShortFromStream(Data + 1);
-    
-    // Read the constant pool for the class' name string
-    Data = (char*) SearchClass->Constants[classInd];
-    auto val = ReadShortFromStream(Data + 1);
-    // Save it as a std::string
-    std::string ClassName = SearchClass->GetStringConstant(val);
-
-    // Now, this class is the class (or interface) where the field actually lives.
-    SearchClass = _ClassHeap->GetClass(ClassName);
-
-    // We can finally get the field location..
-    uint32_t FieldIndex = SearchClass->GetFieldFromDescriptor(FieldName);
-    printf("Field %d resolved to index %d.\n", ConstantIndex, FieldIndex);
+    // The field may be in this class, a super class, or an interface.
+    Class* Owner;
+    uint16_t FieldIndex;
+    Stack->_Class->ResolveField(ConstantIndex, Owner, FieldIndex);
+    printf("Field %d resolved to index %d of class %s.\n", ConstantIndex, FieldIndex, Owner->GetClassName().c_str());
+
+    // The first access initializes the class that declares the field. After that, this instruction never needs to
+    //  resolve or check anything again. See Engine#InitializeClass.
+    if(InitializeClass(Owner, &Stack[1], &Stack->Stack[Stack->StackPointer + 1]))
+        Stack->_Class->RewriteCode(&Stack->_Method->Code->Code[Stack->ProgramCounter], Instruction::putstatic_quick);
 
     // Fetch the data for what was last pushed to the stack..
     Variable Value = Stack->Stack[Stack->StackPointer];
 
     // And save that data to the class.
-    if(!SearchClass->PutStatic(FieldIndex, Value))
+    if(!Owner->PutStatic(Owner->GetFieldOffset(FieldIndex), Value))
         printf("Setting static field failed!\n");
 }
 
+/**
+ * The quick version of putstatic, which replaces it once the field is resolved and its class is initialized.
+ * The field is taken straight from the resolution cache, and the value straight into the class' statics.
+ *
+ * @param Stack the Stack Frame for the method currently being executed.
+ */
+void Engine::PutStaticQuick(StackFrame* Stack) {
+    auto ConstantIndex = ReadShortFromStream(&Stack->_Method->Code->Code[Stack->ProgramCounter + 1]);
+
+    Class* Owner;
+    uint16_t FieldIndex;
+    Stack->_Class->GetResolvedField(ConstantIndex, Owner, FieldIndex);
+
+    Owner->GetStatics()[Owner->GetFieldOffset(FieldIndex)] = Stack->Stack[Stack->StackPointer];
+}
+
 /**
  * Read a value from a static field.
  *
  * The field index is stored in the next byte of the program code.
  * It indexes a Field constant in the Class' Constants Pool.
  * The field may not exist in the current class, so it must also be resolved here.
+ * See Class#ResolveField for how that works.
  *
  * Most of this is a simple wrapper around Class#GetStatic.
  *
  * @param Stack the Stack Frame for the method currently being executed.
  */
 void Engine::GetStatic(StackFrame* Stack) {
-    // First, figure out which field we need to write to
+    // First, figure out which field we need to read from
     auto ConstantIndex = ReadShortFromStream(&Stack->_Method->Code->Code[Stack->ProgramCounter + 1]);
 
-    // Now we can get the field's name and descriptor.
-    Class* SearchClass = Stack->_Class;
-    std::string FieldName = SearchClass->GetStringConstant(ConstantIndex);
-
-    // The field's owning class takes some searching.
-    // This is because a class' fields can be in the super class, or any implemented interface.
-    // Thankfully, the Java language tells us which class the field actually belongs to - it's part of the Field data
-    //  that the Constants Pool index points to.
+    // The field may be in this class, a super class, or an interface.
+    Class* Owner;
+    uint16_t FieldIndex;
+    Stack->_Class->ResolveField(ConstantIndex, Owner, FieldIndex);
+    printf("Field %d resolved to index %d of class %s.\n", ConstantIndex, FieldIndex, Owner->GetClassName().c_str());
 
-    // First, read the constant pool for the class' name index.
-    char* Data = (char*) SearchClass->Constants[ConstantIndex];
-    auto classInd = ReadShortFromStream(Data + 1);
-
-    // Read the constant pool for the class' name string
-    Data = (char*) SearchClass->Constants[classInd];
-    auto val = ReadShortFromStream(Data + 1);
-    // Save it as a std::string
-    std::string ClassName = SearchClass->GetStringConstant(val);
-
-    // Now, this class is the class (or interface) where the field actually lives.
-    SearchClass = _ClassHeap->GetClass(ClassName);
-
-    // We can finally get the field location..
-    uint32_t FieldIndex = SearchClass->GetFieldFromDescriptor(FieldName);
-    printf("Field %d resolved to index %d.\n", ConstantIndex, FieldIndex);
+    // The first access initializes the class that declares the field. After that, this instruction never needs to
+    //  resolve or check anything again. See Engine#InitializeClass.
+    if(InitializeClass(Owner, &Stack[1], &Stack->Stack[Stack->StackPointer + 1]))
+        Stack->_Class->RewriteCode(&Stack->_Method->Code->Code[Stack->ProgramCounter], Instruction::getstatic_quick);
 
     // Retrieve the data in the field...
-    Variable Value = SearchClass->GetStatic(FieldIndex);
+    Variable Value = Owner->GetStatic(Owner->GetFieldOffset(FieldIndex));
 
     // And push it to the stack.
     Stack->Stack[Stack->StackPointer + 1] = Value;
@@ -125,6 +115,22 @@ void Engine::GetStatic(StackFrame* Stack) {
     // It's up to the bytecode what to do now.
 }
 
+/**
+ * The quick version of getstatic, which replaces it once the field is resolved and its class is initialized.
+ * Like getstatic, this writes the value above the top of the stack and leaves the push to the caller.
+ *
+ * @param Stack the Stack Frame for the method currently being executed.
+ */
+void Engine::GetStaticQuick(StackFrame* Stack) {
+    auto ConstantIndex = ReadShortFromStream(&Stack->_Method->Code->Code[Stack->ProgramCounter + 1]);
+
+    Class* Owner;
+    uint16_t FieldIndex;
+    Stack->_Class->GetResolvedField(ConstantIndex, Owner, FieldIndex);
+
+    Stack->Stack[Stack->StackPointer + 1] = Owner->GetStatics()[Owner->GetFieldOffset(FieldIndex)];
+}
+
 /**
  * Write a value to an instanced field.
  *
@@ -132,6 +138,10 @@ void Engine::GetStatic(StackFrame* Stack) {
  * The Object Reference to store the data in, was pushed before that.
  * The Field Index is the next byte in the code.
  *
+ * The field is resolved against the Constants Pool of the class that is executing, not the class of the Object.
+ * Every class in a hierarchy agrees on where a field is (see Class#Link), so the offset works for any Object that
+ *  the bytecode could legally hand us.
+ *
  * @param Stack the Stack Frame for the method currently being executed.
  */
 void Engine::PutField(StackFrame* Stack) {
@@ -142,22 +152,17 @@ void Engine::PutField(StackFrame* Stack) {
     Variable Obj = Stack->Stack[Stack->StackPointer - 1];
     Variable ValueToSet = Stack->Stack[Stack->StackPointer];
 
-    // We have the Object Reference, now we need to get the field data as an array.
-    Variable* VarList = _ObjectHeap.GetObjectPtr(Obj.object);
+    // Find which class the field belongs to, and so where it is in the Object.
+    Class* Owner;
+    uint16_t FieldIndex;
+    Stack->_Class->ResolveField(FieldNameIndex, Owner, FieldIndex);
+    uint32_t Offset = Owner->GetFieldOffset(FieldIndex);
 
-    // Having the required data, now we can fetch the class data that the Object Reference refers to...
-    auto* FieldsClass = (Class*)VarList->pointerVal;
+    printf("Setting field %s (offset %d) to " PrtSizeT ".\r\n", Stack->_Class->GetStringConstant(FieldNameIndex).c_str(), Offset, ValueToSet.pointerVal);
 
-    // Read the full name of the Field in its' owning class..
-    std::string FieldName = FieldsClass->GetStringConstant(FieldNameIndex);
-
-    // Fetch the index of the field into that class (the index into VarList from the class data)
-    uint32_t FieldIndex = FieldsClass->GetFieldFromDescriptor(FieldName);
-
-    printf("Setting field %s to " PrtSizeT ".\r\n", FieldName.c_str(), ValueToSet.pointerVal);
-
-    // And store that data (+ 1 for the class referred to at the start) in the VarList.
-    VarList[FieldIndex + 1] = ValueToSet;
+    // And store that data in the Object, at the width of the field.
+    // If the field holds a reference, this goes through the Collector's write barrier.
+    _ObjectHeap.StoreField(Obj.object, Offset, Owner->GetFieldType(FieldIndex), ValueToSet);
 
     // Note that we don't increase the stack pointer yet - this isn't a push, just a write.
     // It's up to the bytecode what to do now.
@@ -169,6 +174,8 @@ void Engine::PutField(StackFrame* Stack) {
  * The Object Reference to read the data from is the last thing pushed to the stack.
  * The Field Index is the next byte in the code.
  *
+ * Like PutField, the field is resolved against the class that is executing.
+ *
  * @param Stack the Stack Frame for the method currently being executed.
  */
 void Engine::GetField(StackFrame* Stack) {
@@ -178,24 +185,16 @@ void Engine::GetField(StackFrame* Stack) {
     // Read the Object and Value from the stack
     Variable Obj = Stack->Stack[Stack->StackPointer];
 
-    // We have the Object Reference, now we need to get the field data as an array.
-    Variable* VarList = _ObjectHeap.GetObjectPtr(Obj.object);
+    // Find which class the field belongs to, and so where it is in the Object.
+    Class* Owner;
+    uint16_t FieldIndex;
+    Stack->_Class->ResolveField(FieldNameIndex, Owner, FieldIndex);
+    uint32_t Offset = Owner->GetFieldOffset(FieldIndex);
 
-    // Having the required data, now we can fetch the class data that the Object Reference refers to...
-    auto* FieldsClass = (Class*)VarList->pointerVal;
+    printf("Reading field data - field is %s, class is %s, offset %d.\n", Stack->_Class->GetStringConstant(FieldNameIndex).c_str(), Owner->GetClassName().c_str(), Offset);
 
-    // Read the full name of the Field in its' owning class..
-    std::string FieldName = FieldsClass->GetStringConstant(FieldNameIndex);
-    printf("Reading field data - field is %s, class is %s.\n", FieldName.c_str(), FieldsClass->GetClassName().c_str());
-
-    // Fetch the index of the field into that class (the index into VarList from the class data)
-    uint32_t FieldIndex = FieldsClass->GetFieldFromDescriptor(FieldName);
-
-    size_t ClassSize = FieldsClass->GetClassSize(), Fields = FieldsClass->GetClassFieldCount();
-    printf("\tClass has " PrtSizeT " entries and " PrtSizeT " field(s), we want to read the %dth.\n", ClassSize, Fields, FieldNameIndex);
-
-    // And save the data into the stack, overwriting the current value with our modified array.
-    Stack->Stack[Stack->StackPointer] = VarList[FieldIndex + 1];
+    // And save the data into the stack, overwriting the Object Reference, widened from the width of the field.
+    Stack->Stack[Stack->StackPointer] = _ObjectHeap.LoadField(Obj.object, Offset, Owner->GetFieldType(FieldIndex));
     printf("Reading value " PrtSizeT " from field\n", Stack->Stack[Stack->StackPointer].pointerVal);
 
     // Note that we don't touch the stack pointer - we effectively popped the old value and pushed a new one, so it's
@@ -204,27 +203,117 @@ void Engine::GetField(StackFrame* Stack) {
 
 /**
  * A simple wrapper to search a class for a field with the matching name and descriptor.
+ * Only this class is searched; see FindField for the places a field could have been inherited from.
  *
- * Attempting to call this method with a field name that is not in this class is invalid behavior.
- * The program will immediately close upon detecting this.
+ * @param Name the name of the field
+ * @param Descriptor the descriptor of the field
+ * @return the index of the field in the given class, or the maximum uint32_t if it isn't there.
+ */
+uint32_t Class::GetFieldFromDescriptor(const char* Name, const char* Descriptor) {
+    uint16_t Field = FieldIndex.Find(SymbolTable::Find(Name), SymbolTable::Find(Descriptor));
+
+    if(Field == MemberIndex::None) {
+        printf("Unable to find field %s%s in class %s.\n", Name, Descriptor, GetClassName().c_str());
+        return std::numeric_limits<uint32_t>::max();
+    }
+
+    return Field;
+}
+
+/**
+ * Search this class for a field, and then the places it could have been inherited from.
+ * Per the Java spec, that's the interfaces this class implements first, then the super class.
  *
- * TODO: make it not do that?
+ * If the name or descriptor have never been interned, then no loaded class can have the field.
  *
- * @param FieldAndDescriptor the field information in the form of Name(Parameters)Return - name and descriptor.
- * @return the index of the field in the given class.
+ * @param Name the name of the field
+ * @param Descriptor the descriptor of the field
+ * @param Field set to the index of the field in the class that declares it
+ * @return the class that declares the field, or nullptr if there is none.
  */
-uint32_t Class::GetFieldFromDescriptor(const std::string& FieldAndDescriptor) {
-    for(uint32_t i = 0; i < FieldsCount; i++) {
-        std::string FieldName = GetStringConstant(Fields[i]->Name);
-        std::string FieldDesc = GetStringConstant(Fields[i]->Descriptor);
-        std::string NameDesc = FieldName.append(FieldDesc);
-
-        if(NameDesc == FieldAndDescriptor)
-            return i;
+Class* Class::FindField(const char* Name, const char* Descriptor, uint16_t& Field) {
+    Symbol* NameSymbol = SymbolTable::Find(Name);
+    Symbol* DescriptorSymbol = SymbolTable::Find(Descriptor);
+    if(NameSymbol == nullptr || DescriptorSymbol == nullptr)
+        return nullptr;
+
+    return FindField(NameSymbol, DescriptorSymbol, Field);
+}
+
+/**
+ * The same search as above, for Symbols that are already at hand; such as those from a Field constant.
+ * Each class is searched through its Field Index, so nothing here compares strings. See Symbols.cpp.
+ *
+ * @param Name the name of the field
+ * @param Descriptor the descriptor of the field
+ * @param Field set to the index of the field in the class that declares it
+ * @return the class that declares the field, or nullptr if there is none.
+ */
+Class* Class::FindField(Symbol* Name, Symbol* Descriptor, uint16_t& Field) {
+    uint16_t Found = FieldIndex.Find(Name, Descriptor);
+    if(Found != MemberIndex::None) {
+        Field = Found;
+        return this;
     }
 
-    printf("Unable to find field %s in class %s. Fatal error.\n", FieldAndDescriptor.c_str(), GetClassName().c_str());
-    exit(7);
+    for(Class* Interface : GetInterfaces()) {
+        Class* Owner = Interface->FindField(Name, Descriptor, Field);
+        if(Owner != nullptr) return Owner;
+    }
+
+    if(GetSuper() != nullptr)
+        return SuperClass->FindField(Name, Descriptor, Field);
+
+    return nullptr;
+}
+
+/**
+ * Resolve a Field constant in this class' Constants Pool to the class that declares it, and the index of the field.
+ *
+ * The Field constant names the class to start searching from, which may not be the class that declares it.
+ * ie. for class B extends A, B.x may refer to a field x that is declared in A.
+ *
+ * The result never changes, so it's cached by Constants Pool index and only worked out on first use.
+ *
+ * Attempting to call this method with a field that does not exist is invalid behavior.
+ * The program will immediately close upon detecting this.
+ *
+ * @param Index the index of a Field constant
+ * @param Owner set to the class that declares the field
+ * @param Field set to the index of the field in the Owner class
+ */
+void Class::ResolveField(uint16_t Index, Class* &Owner, uint16_t& Field) {
+    if(!Linked) Link();
+
+    ResolvedField& Cached = ResolvedFields.at(Index);
+    if(Cached.Owner != nullptr) {
+        Owner = Cached.Owner;
+        Field = Cached.Field;
+        return;
+    }
+
+    // Read the class that the constant names..
+    const MemberReference& Member = Constants[Index].Member;
+    const std::string& ClassName = GetStringConstant(Member.Class);
+
+    // And the name and descriptor of the field.
+    const std::string& FieldName = GetStringConstant(Index);
+    Symbol* Name = GetSymbol(Member.Name);
+    Symbol* Descriptor = GetSymbol(Member.Descriptor);
+
+    Class* Start = _ClassHeap->GetClass(ClassName);
+    Owner = Start == nullptr ? nullptr : Start->FindField(Name, Descriptor, Field);
+
+    if(Owner == nullptr) {
+        printf("Unable to find field %s in class %s. Fatal error.\n", FieldName.c_str(), ClassName.c_str());
+        exit(7);
+    }
+
+    // The owner's layout has to be known before anyone can use the offset.
+    Owner->Link();
+
+    Cached.Owner = Owner;
+    Cached.Field = Field;
 }
 
 /**
@@ -235,11 +324,10 @@ uint32_t Class::GetFieldFromDescriptor(const std::string& FieldAndDescriptor) {
  * @return true if the value was stored successfully, false otherwise
  */
 bool Class::PutStatic(uint16_t Field, Variable Value) {
-    std::string Name = GetClassName();
-    if(!_ClassHeap->ClassExists(Name))
+    if(Field >= FieldsCount)
         return false;
 
-    printf("Setting static field %s::%s (index %d) to " PrtSizeT ".\n", Name.c_str(), GetStringConstant(Fields[Field]->Name).c_str(), Field, Value.pointerVal);
+    printf("Setting static field %s::%s (index %d) to " PrtSizeT ".\n", GetClassName().c_str(), GetStringConstant(Fields[Field]->Name).c_str(), Field, Value.pointerVal);
     ClassStatics[Field] = Value;
 
     return true;
@@ -252,11 +340,10 @@ bool Class::PutStatic(uint16_t Field, Variable Value) {
  * @return the value stored in the Field
  */
 Variable Class::GetStatic(uint16_t Field) {
-    std::string Name = GetClassName();
-    if(!_ClassHeap->ClassExists(Name))
+    if(Field >= FieldsCount)
         return Variable(ObjectHeap::Null);
 
-    printf("Retrieving value from field %s::%s\n", Name.c_str(), GetStringConstant(Fields[Field]->Name).c_str());
+    printf("Retrieving value from field %s::%s\n", GetClassName().c_str(), GetStringConstant(Fields[Field]->Name).c_str());
 
     return ClassStatics[Field];
 }
@@ -0,0 +1,255 @@
+/**************
+ * GEMWIRE    *
+ *    PURPURI *
+ **************/
+
+#include <vm/Class.hpp>
+#include <vm/Native.hpp>
+#include <unordered_set>
+
+/**
+ * This file contains the intrinsics; methods of the Java standard library that the VM implements itself.
+ *
+ * They're the bulk array operations. Done in bytecode, these are a loop of loads and stores, each of which goes back
+ *  through the interpreter and into the Object Heap. Done here, it's a single memmove or a handful of memcpy calls
+ *  straight on the array data. See ObjectHeap::CopyElements and ObjectHeap::FillElements.
+ *
+ * An intrinsic is written the same as a PNI function in the native library, with VM::GetParameters and VM::Return.
+ * The difference is that they're found by what method is being called; every Method constant is looked up here once,
+ *  when the class that holds it is linked. The interpreter still loads and initializes the class being called, as
+ *  for any static call, but never looks for the method in it, so the method doesn't even have to be declared native.
+ * Only static methods can be intrinsics for now, as they're never given "this".
+ *
+ * The interpreter can't throw exceptions yet, so anything that Java would throw here stops the VM instead.
+ */
+
+/**
+ * Fetch the parameters of the current call, in the order they were declared.
+ * The PNI hands them over last first, which is fine for one parameter but gets confusing quickly after that.
+ * @return the parameters, first first.
+ */
+static std::vector<Variable> Arguments() {
+    std::vector<Variable> Parameters = VM::GetParameters();
+    return std::vector<Variable>(Parameters.rbegin(), Parameters.rend());
+}
+
+/**
+ * Stop the VM, because an intrinsic would have thrown an exception.
+ * @param Method the name of the intrinsic, for the message
+ * @param Exception the name of the exception that Java would throw
+ * @param Reason what was wrong
+ */
+[[noreturn]] static void Throw(const char* Method, const char* Exception, const char* Reason) {
+    fprintf(stderr, "%s threw %s: %s. Fatal error.\n", Method, Exception, Reason);
+    exit(5);
+}
+
+/**
+ * The type of a reference, as far as storing it in an array goes.
+ * Arrays of arrays share the class word of their innermost elements, so this is built from their shape as well.
+ */
+struct ArrayShape {
+    // 0 for an Object that isn't an array.
+    uint8_t Dimensions;
+    // The Array Type at the bottom of an array of primitives, or 0.
+    uint8_t Innermost;
+    // The class of the Object, or of the Objects at the bottom of the array. nullptr if they're primitives.
+    Class* Klass;
+};
+
+/**
+ * Work out the shape of an Object, whether or not it's an array.
+ * @param Value the Object, which must not be null
+ * @return its shape.
+ */
+static ArrayShape ShapeOf(Object Value) {
+    ObjectHeap& Heap = Engine::_ObjectHeap;
+
+    if(!Heap.IsArray(Value))
+        return { 0, 0, Heap.GetClass(Value) };
+
+    return { Heap.GetArrayDimensions(Value), Heap.GetInnermostType(Value), Heap.GetClass(Value) };
+}
+
+/**
+ * Every array is an Object, Cloneable and Serializable, so an array of any of those can hold any array.
+ * @param Klass the class to check
+ * @return true if any array can be used as one of these.
+ */
+static bool HoldsAnyArray(Class* Klass) {
+    const std::string& Name = Klass->GetClassName();
+    return Name == "java/lang/Object" || Name == "java/lang/Cloneable" || Name == "java/io/Serializable";
+}
+
+/**
+ * Check whether something of one shape can be used where another is expected, the same as checkcast would.
+ *
+ * An array fits where an array of the same depth is expected if the things at the bottom do; primitives have to be
+ *  the same type, and classes have to be assignable. Where a shallower array is expected, the rest of the array is
+ *  one of the elements, so they have to be able to hold any array.
+ *
+ * @param From the shape of the value
+ * @param To the shape that's expected
+ * @return true if the value fits.
+ */
+static bool Fits(const ArrayShape& From, const ArrayShape& To) {
+    if(From.Dimensions < To.Dimensions)
+        return false;
+
+    if(From.Dimensions > To.Dimensions)
+        return To.Innermost == 0 && To.Klass != nullptr && HoldsAnyArray(To.Klass);
+
+    if(From.Innermost != 0 || To.Innermost != 0)
+        return From.Innermost == To.Innermost;
+
+    return From.Klass != nullptr && To.Klass != nullptr && From.Klass->IsAssignableTo(To.Klass);
+}
+
+/**
+ * Work out what the elements of a reference array can hold.
+ * @param Array the array, which must hold references
+ * @return the shape of its elements.
+ */
+static ArrayShape ElementOf(Object Array) {
+    ArrayShape Shape = ShapeOf(Array);
+    Shape.Dimensions--;
+    return Shape;
+}
+
+/**
+ * Check whether a reference can be stored in a reference array, as aastore would.
+ * @param Value the reference to store
+ * @param Element the shape of the array's elements; see ElementOf
+ * @return true if the store is allowed.
+ */
+static bool CanStore(Object Value, const ArrayShape& Element) {
+    return Value.Heap == 0 || Fits(ShapeOf(Value), Element);
+}
+
+/**
+ * System.arraycopy(Object src, int srcPos, Object dest, int destPos, int length)
+ *
+ * Primitive arrays of the same type are copied in one go.
+ * Reference arrays are too, as long as everything in the source is known to fit in the destination.
+ * If it isn't, the source is checked up front, and everything before the first element that doesn't fit is copied
+ *  before giving up, as Java does.
+ */
+static void SystemArrayCopy() {
+    static const char* Name = "System.arraycopy";
+    ObjectHeap& Heap = Engine::_ObjectHeap;
+
+    auto Args = Arguments();
+    Object Source = Args.at(0).object;
+    int64_t SourcePos = (int32_t) Args.at(1).intVal;
+    Object Dest = Args.at(2).object;
+    int64_t DestPos = (int32_t) Args.at(3).intVal;
+    int64_t Length = (int32_t) Args.at(4).intVal;
+
+    if(Source.Heap == 0 || Dest.Heap == 0)
+        Throw(Name, "java.lang.NullPointerException", "array is null");
+
+    if(!Heap.IsArray(Source) || !Heap.IsArray(Dest))
+        Throw(Name, "java.lang.ArrayStoreException", "argument is not an array");
+
+    // Reference arrays have an Array Type of 0, so this also stops a copy between a primitive and a reference array.
+    if(Heap.GetArrayType(Source) != Heap.GetArrayType(Dest))
+        Throw(Name, "java.lang.ArrayStoreException", "array types do not match");
+
+    if(SourcePos < 0 || DestPos < 0 || Length < 0 ||
+       SourcePos + Length > (int64_t) Heap.GetArraySize(Source) || DestPos + Length > (int64_t) Heap.GetArraySize(Dest))
+        Throw(Name, "java.lang.ArrayIndexOutOfBoundsException", "copy is out of bounds");
+
+    uint32_t Valid = (uint32_t) Length;
+
+    // If the source array as a whole fits in the destination's type, so does everything in it.
+    if(Heap.GetArrayType(Source) == 0 && !Fits(ShapeOf(Source), ShapeOf(Dest))) {
+        ArrayShape Element = ElementOf(Dest);
+        for(uint32_t i = 0; i < Valid; i++) {
+            if(!CanStore(Heap.LoadElement(Source, (uint32_t) SourcePos + i), Element))
+                Valid = i;
+        }
+    }
+
+    Heap.CopyElements(Source, (uint32_t) SourcePos, Dest, (uint32_t) DestPos, Valid);
+
+    if(Valid != Length)
+        Throw(Name, "java.lang.ArrayStoreException", "element does not fit in the destination array");
+}
+
+/**
+ * Arrays.fill(array, value) and Arrays.fill(array, fromIndex, toIndex, value), for every kind of array.
+ * The value is always one Variable, so the same function covers every overload.
+ */
+static void ArraysFill() {
+    static const char* Name = "Arrays.fill";
+    ObjectHeap& Heap = Engine::_ObjectHeap;
+
+    auto Args = Arguments();
+    Object Array = Args.at(0).object;
+
+    if(Array.Heap == 0)
+        Throw(Name, "java.lang.NullPointerException", "array is null");
+
+    int64_t Size = Heap.GetArraySize(Array);
+    int64_t From = 0;
+    int64_t To = Size;
+    if(Args.size() == 4) {
+        From = (int32_t) Args.at(1).intVal;
+        To = (int32_t) Args.at(2).intVal;
+    }
+    Variable Value = Args.back();
+
+    if(From > To)
+        Throw(Name, "java.lang.IllegalArgumentException", "fromIndex is after toIndex");
+
+    if(From < 0 || To > Size)
+        Throw(Name, "java.lang.ArrayIndexOutOfBoundsException", "fill is out of bounds");
+
+    if(Heap.GetArrayType(Array) == 0 && !CanStore(Value.object, ElementOf(Array)))
+        Throw(Name, "java.lang.ArrayStoreException", "value does not fit in the array");
+
+    Heap.FillElements(Array, (uint32_t) From, (uint32_t) To, Value);
+}
+
+/**
+ * Every intrinsic, by the class, name and descriptor of the method it implements.
+ *
+ * long and double take two slots on the Member Stack, and the interpreter can't make either yet, so their
+ *  overloads of Arrays.fill are left out until it can.
+ */
+std::map<std::string, intrinsic_t> Native::Intrinsics = {
+    { "java/lang/System.arraycopy(Ljava/lang/Object;ILjava/lang/Object;II)V", SystemArrayCopy },
+
+    { "java/util/Arrays.fill([ZZ)V", ArraysFill },
+    { "java/util/Arrays.fill([BB)V", ArraysFill },
+    { "java/util/Arrays.fill([CC)V", ArraysFill },
+    { "java/util/Arrays.fill([SS)V", ArraysFill },
+    { "java/util/Arrays.fill([II)V", ArraysFill },
+    { "java/util/Arrays.fill([FF)V", ArraysFill },
+    { "java/util/Arrays.fill([Ljava/lang/Object;Ljava/lang/Object;)V", ArraysFill },
+
+    { "java/util/Arrays.fill([ZIIZ)V", ArraysFill },
+    { "java/util/Arrays.fill([BIIB)V", ArraysFill },
+    { "java/util/Arrays.fill([CIIC)V", ArraysFill },
+    { "java/util/Arrays.fill([SIIS)V", ArraysFill },
+    { "java/util/Arrays.fill([IIII)V", ArraysFill },
+    { "java/util/Arrays.fill([FIIF)V", ArraysFill },
+    { "java/util/Arrays.fill([Ljava/lang/Object;IILjava/lang/Object;)V", ArraysFill },
+};
+
+intrinsic_t Native::FindIntrinsic(Symbol* ClassName, Symbol* MethodName, Symbol* Descriptor) {
+    // Every Method constant of every class comes through here, and almost none of them are in the table.
+    // The classes that are in it are few enough to check first, without building the whole name.
+    static const std::unordered_set<Symbol*> Owners = [] {
+        std::unordered_set<Symbol*> Classes;
+        for(const auto& [Name, Intrinsic] : Intrinsics)
+            Classes.insert(SymbolTable::Intern(std::string_view(Name).substr(0, Name.find('.'))));
+        return Classes;
+    }();
+
+    if(ClassName == nullptr || MethodName == nullptr || Descriptor == nullptr || !Owners.count(ClassName))
+        return nullptr;
+
+    auto Found = Intrinsics.find(ClassName->Text + "." + MethodName->Text + Descriptor->Text);
+    return Found == Intrinsics.end() ? nullptr : Found->second;
+}
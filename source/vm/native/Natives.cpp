@@ -22,6 +22,8 @@ std::map<std::string, void*> Native::LibraryHandleMap;
 
 std::vector<Variable> Native::Parameters;
 
+Object Native::Instance;
+
 void VM::Return(Variable retVal) {
     NativeReturn Return;
     Return.Value = retVal;
@@ -41,6 +43,33 @@ size_t VM::GetArrayLength(Object ID) {
     return Engine::_ObjectHeap.GetArraySize(ID);
 }
 
+uint8_t* VM::GetArrayData(Object ID) {
+    return Engine::_ObjectHeap.GetArrayData(ID);
+}
+
+Object VM::GetInstance() {
+    return Native::Instance;
+}
+
+Object VM::Intern(Object String) {
+    return Engine::_ObjectHeap.Intern(String);
+}
+
+uint32_t VM::GetIdentityHash(Object ID) {
+    return Engine::_ObjectHeap.GetIdentityHash(ID);
+}
+
+Variable VM::GetField(Object ID, const char* Name, const char* Descriptor) {
+    Class* ObjectClass = Engine::_ObjectHeap.GetClass(ID);
+    if(ObjectClass == nullptr) return Variable();
+
+    uint16_t Field;
+    Class* Owner = ObjectClass->FindField(Name, Descriptor, Field);
+    if(Owner == nullptr) return Variable();
+
+    return Engine::_ObjectHeap.LoadField(ID, Owner->GetFieldOffset(Field), Owner->GetFieldType(Field));
+}
+
 // Find and replace all instances of a substring inside a std::string
 void ICantBelieveThisIsNeededWithModernCPP(std::string& subject, const std::string& search,
                           const std::string& replace) {
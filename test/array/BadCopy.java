@@ -0,0 +1,11 @@
+// This one doesn't return; the VM stops with an ArrayStoreException.
+public class BadCopy {
+    public static int EntryPoint() {
+        String[][] names = new String[2][2];
+        String[] flat = new String[2];
+
+        // The rows of names are String[]s, and a String[] can't go where a String is expected.
+        System.arraycopy(names, 0, flat, 0, 2);
+        return flat.length;
+    }
+}
@@ -0,0 +1,24 @@
+import java.util.Arrays;
+
+public class Copy {
+    public static int EntryPoint() {
+        int[] numbers = new int[10];
+        for (int i = 0; i < numbers.length; i++) numbers[i] = i;
+
+        // Both of these copy an array onto itself, so the ranges overlap.
+        System.arraycopy(numbers, 0, numbers, 2, 6);
+        System.arraycopy(numbers, 3, numbers, 1, 4);
+        Arrays.fill(numbers, 8, 10, 7);
+
+        int total = 0;
+        for (int i = 0; i < numbers.length; i++) total = total * 10 + numbers[i];
+
+        // Arrays are Objects, so the rows of an array of arrays fit in an Object[].
+        String[][] names = new String[2][3];
+        Object[] objects = new Object[3];
+        System.arraycopy(names, 0, objects, 1, 2);
+        Arrays.fill(objects, 0, 1, numbers);
+
+        return total;
+    }
+}
@@ -0,0 +1,14 @@
+public class MultiArray {
+    public static int EntryPoint() {
+        int[][] grid = new int[3][4];
+        for (int i = 0; i < grid.length; i++)
+            for (int j = 0; j < grid[i].length; j++)
+                grid[i][j] = i * 10 + j;
+
+        // The last dimension isn't given, so only the outer two are made. The rows are filled in afterwards.
+        int[][][] cube = new int[2][3][];
+        cube[1][2] = grid[2];
+
+        return grid[2][3] + grid[1][1] * 100 + cube[1][2][3] * 1000 + cube[0].length * 100000;
+    }
+}
@@ -0,0 +1,7 @@
+// Run with -cp test/jar/library.jar. Library isn't next to this class; it's only in the JAR.
+public class JarMain {
+    public static int EntryPoint() {
+        Library library = new Library();
+        return library.twice(21) * 100 + Library.answer();
+    }
+}
@@ -0,0 +1,10 @@
+// Only the compiled class is used, from library.jar.
+public class Library {
+    public static int answer() {
+        return 42;
+    }
+
+    public int twice(int value) {
+        return value * 2;
+    }
+}
@@ -0,0 +1,12 @@
+// Run with -Xmx1m. This allocates about 5MB in all, but very little of it is reachable at once.
+public class Churn {
+    public static int EntryPoint() {
+        int total = 0;
+        for (int i = 0; i < 20000; i++) {
+            int[] block = new int[64];
+            block[63] = i;
+            total += block[63] & 1;
+        }
+        return total;
+    }
+}
@@ -0,0 +1,7 @@
+// Run with -Xmx1m. This doesn't return; the VM stops with an OutOfMemoryError.
+public class TooBig {
+    public static int EntryPoint() {
+        int[] block = new int[1000000];
+        return block.length;
+    }
+}
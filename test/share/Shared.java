@@ -0,0 +1,13 @@
+// Run once with -Xshare:dump, and then with -Xshare:on. Both should return the same value.
+// With -Xshare:on, the output should say "Loaded class Shared from the shared archive", and never search for Shared.class.
+public class Shared {
+    public static int EntryPoint() {
+        String text = "shared archive";
+        int[] counts = new int[4];
+        for (int i = 0; i < text.length(); i++) {
+            int bucket = text.charAt(i) & 3;
+            counts[bucket] = counts[bucket] + 1;
+        }
+        return counts[0] * 1000 + counts[1] * 100 + counts[2] * 10 + counts[3];
+    }
+}
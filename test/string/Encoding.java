@@ -0,0 +1,12 @@
+public class Encoding {
+    public static int EntryPoint() {
+        // Every char of this fits in Latin-1, so it's stored one byte per char.
+        String latin = "café";
+        // Pi doesn't, so this one is UTF-16.
+        String wide = "πr²";
+        char[] chars = wide.toCharArray();
+        String copy = new String(chars);
+
+        return latin.charAt(3) + wide.charAt(0) + copy.charAt(2) * 1000 + copy.length() * 1000000;
+    }
+}